@@ -7,6 +7,8 @@
 
 #include <math.h>
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 static const char *TAG = "adt7410";
 
@@ -31,6 +33,8 @@ static const char *TAG = "adt7410";
 #define BIT_T_HIGH 1
 #define BIT_T_CRIT 2
 
+#define BIT_STATUS_RDY 7 // low when a new result is ready
+
 #define BIT_CONFIG_FAULT_QUEUE0 0
 #define BIT_CONFIG_FAULT_QUEUE1 1
 #define BIT_CONFIG_CT_POLARITY  2
@@ -68,11 +72,18 @@ static esp_err_t write_reg_16(adt7410_t *dev, uint8_t reg, uint16_t val)
 static esp_err_t update_reg_8(adt7410_t *dev, uint8_t reg, uint8_t *data, uint8_t mask, uint8_t or)
 {
      uint8_t old;
+     // configuration changes only by our writes, the shadow is as good as a read
+     bool shadowed = reg == REG_CONF && dev->shadow;
      I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
-     I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, reg, &old, 1));
+     if (shadowed)
+          old = dev->shadow->conf;
+     else
+          I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, reg, &old, 1));
      uint8_t new = (old & ~mask) | or;
      if (old != new)
           I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_write_reg(&dev->i2c_dev, reg, &new, 1));
+     if (shadowed)
+          dev->shadow->conf = new;
      I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
      if (data) *data = new;
      return ESP_OK;
@@ -118,10 +129,16 @@ esp_err_t adt7410_init(adt7410_t *dev, adt7410_mode_t mode, adt7410_resolution_t
 {
     uint8_t v;
 
-    CHECK(read_reg_8(dev, REG_ID, &v));
-    if ((v >> 3) != MANUFACTURER_ID) {
-        ESP_LOGE(TAG, "Invalid device ID 0x%02x", v);
-        return ESP_ERR_INVALID_RESPONSE;
+    if (dev->shadow && dev->shadow->id != 0) {
+        v = dev->shadow->id;
+    } else {
+        CHECK(read_reg_8(dev, REG_ID, &v));
+        if ((v >> 3) != MANUFACTURER_ID) {
+            ESP_LOGE(TAG, "Invalid device ID 0x%02x", v);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (dev->shadow)
+            dev->shadow->id = v;
     }
     ESP_LOGD(TAG, "Device revision: 0x%02x", v & 0b111);
 
@@ -129,12 +146,17 @@ esp_err_t adt7410_init(adt7410_t *dev, adt7410_mode_t mode, adt7410_resolution_t
                        (1 << BIT_CONFIG_RESOLUTION)|(0b11 << BIT_CONFIG_MODE0),
                        (res << BIT_CONFIG_RESOLUTION)|(mode << BIT_CONFIG_MODE0)));
     dev->res = res;
+    dev->mode = mode;
+    dev->started = xTaskGetTickCount();
     return ESP_OK;
 }
 
 esp_err_t adt7410_set_mode(adt7410_t *dev, adt7410_mode_t mode)
 {
-     return update_reg_8(dev, REG_CONF, NULL, 0b11 << BIT_CONFIG_MODE0, mode << BIT_CONFIG_MODE0);
+     CHECK(update_reg_8(dev, REG_CONF, NULL, 0b11 << BIT_CONFIG_MODE0, mode << BIT_CONFIG_MODE0));
+     dev->mode = mode;
+     dev->started = xTaskGetTickCount();
+     return ESP_OK;
 }
 
 esp_err_t adt7410_get_mode(adt7410_t *dev, adt7410_mode_t *mode)
@@ -165,3 +187,79 @@ esp_err_t adt7410_get_temperature(adt7410_t *dev, float *t)
     return ESP_OK;
 }
 
+esp_err_t adt7410_get_temperature_fixed(adt7410_t *dev, int16_t *t)
+{
+    int16_t v;
+    CHECK(read_reg_16(dev, REG_T_MSB, (uint16_t *)&v));
+    if (dev->res == ADT7410_RES_12)
+         v &= ~0b111;
+    // v / 128 °C in 0.01 °C, rounded half to even like printf("%.2f")
+    int32_t x = v * 100, q = x >> 7, rem = x & 127;
+    if (rem > 64 || (rem == 64 && (q & 1)))
+         q++;
+    *t = q;
+    return ESP_OK;
+}
+
+
+uint32_t adt7410_conversion_time(adt7410_mode_t mode)
+{
+    switch (mode) {
+    case ADT7410_1SPC:
+        return 60;
+    case ADT7410_SHUTDOWN:
+        return 0;
+    default:
+        return 240;
+    }
+}
+
+esp_err_t adt7410_start_conversion(adt7410_t *dev)
+{
+    uint8_t conf;
+
+    if (dev->mode != ADT7410_ONE_SHOT && dev->mode != ADT7410_1SPC)
+        return ESP_ERR_INVALID_STATE;
+
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    if (dev->shadow)
+        conf = dev->shadow->conf;
+    else
+        I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_read_reg(&dev->i2c_dev, REG_CONF, &conf, 1));
+    // written even if unchanged, the write itself starts conversion
+    conf = (conf & ~(0b11 << BIT_CONFIG_MODE0)) | (dev->mode << BIT_CONFIG_MODE0);
+    I2C_DEV_CHECK(&dev->i2c_dev, i2c_dev_write_reg(&dev->i2c_dev, REG_CONF, &conf, 1));
+    if (dev->shadow)
+        dev->shadow->conf = conf;
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+    dev->started = xTaskGetTickCount();
+    return ESP_OK;
+}
+
+esp_err_t adt7410_wait_ready(adt7410_t *dev, uint32_t timeout_ms)
+{
+    uint32_t typical = adt7410_conversion_time(dev->mode);
+    uint32_t waited = (xTaskGetTickCount() - dev->started) * portTICK_PERIOD_MS, step = 2;
+    uint8_t status;
+
+    if (waited < typical * 3 / 4 && waited < timeout_ms) {
+        uint32_t delay = (typical * 3 / 4 < timeout_ms ? typical * 3 / 4 : timeout_ms) - waited;
+        vTaskDelay(pdMS_TO_TICKS(delay));
+        waited += delay;
+    }
+    for (;;) {
+        CHECK(read_reg_8(dev, REG_STATUS, &status));
+        if ((status & (1 << BIT_STATUS_RDY)) == 0) {
+            ESP_LOGD(TAG, "Conversion ready in %u ms", waited);
+            return ESP_OK;
+        }
+        if (waited >= timeout_ms)
+            return ESP_ERR_TIMEOUT;
+        // at least one tick, otherwise the delay is no delay at all
+        uint32_t delay = step < portTICK_PERIOD_MS ? portTICK_PERIOD_MS : step;
+        vTaskDelay(delay / portTICK_PERIOD_MS);
+        waited += delay;
+        if (step < 16)
+            step *= 2;
+    }
+}
@@ -24,6 +24,7 @@ typedef enum {
     ADT7410_CONTINUOUS, //!< Continuous conversion, default
     ADT7410_ONE_SHOT,   //!< One shot mode, conversion time is typically 240 ms
     ADT7410_1SPC,       //!< One measurement per second,  conversion time is typically 60 ms
+                        //!< and the device is idle in between, lowest average current
     ADT7410_SHUTDOWN    //!< Shutdown mode
 } adt7410_mode_t;
 
@@ -33,16 +34,33 @@ typedef enum {
  */
 typedef enum {
     ADT7410_RES_12 = 0, //!< Resolution = +0.0625°C
+    ADT7410_RES_13 = ADT7410_RES_12, //!< Same, 12 bits and sign
     ADT7410_RES_16,     //!< Resolution = +0.0078°C
 } adt7410_resolution_t;
 
 
+/**
+ * Register shadow
+ *
+ * Kept by the caller across deep sleep, e.g. in RTC memory, to skip
+ * identification and configuration reads on the next init. Reset it to
+ * all zeros whenever the device may have lost power: that is also its
+ * power-on register state.
+ */
+typedef struct {
+    uint8_t id;    //!< REG_ID, 0 if not read yet
+    uint8_t conf;  //!< REG_CONF as the device holds it
+} adt7410_shadow_t;
+
 /**
  * Device descriptor
  */
 typedef struct {
     i2c_dev_t i2c_dev;         //!< I2C device descriptor
     adt7410_resolution_t res;  //!< Currently configured resolution
+    adt7410_mode_t mode;       //!< Currently configured mode
+    adt7410_shadow_t *shadow;  //!< Optional register shadow, set before adt7410_init()
+    uint32_t started;          //!< Tick count at the last conversion start
 } adt7410_t;
 
 /**
@@ -70,6 +88,10 @@ esp_err_t adt7410_free_desc(adt7410_t *dev);
  *
  * Set device configuration to default, clear lock bits
  *
+ * With a register shadow that holds the device ID this is a single
+ * write of the configuration register, or none if the shadow shows the
+ * requested configuration already.
+ *
  * @param dev Device descriptor
  * @param mode Temperature sampling mode
  * @param res Resolution mode
@@ -113,6 +135,42 @@ esp_err_t adt7410_set_resolution(adt7410_t *dev, adt7410_resolution_t res);
  */
 esp_err_t adt7410_get_resolution(adt7410_t *dev, adt7410_resolution_t *res);
 
+/**
+ * @brief Typical conversion time in the given mode
+ *
+ * Resolution does not affect conversion time. 1 SPS mode with 13-bit
+ * resolution is the fast path for battery powered nodes.
+ *
+ * @param mode Device mode
+ * @return Conversion time in milliseconds, 0 in shutdown mode
+ */
+uint32_t adt7410_conversion_time(adt7410_mode_t mode);
+
+/**
+ * @brief Start conversion
+ *
+ * Writes one shot or 1 SPS mode bits, which starts a conversion and
+ * resets the RDY status bit. Device powers up in continuous mode and
+ * adt7410_init() starts the first conversion when it changes the mode.
+ *
+ * @param dev Device descriptor
+ * @return `ESP_OK` on success
+ */
+esp_err_t adt7410_start_conversion(adt7410_t *dev);
+
+/**
+ * @brief Wait until conversion result is ready
+ *
+ * Sleeps until most of the typical conversion time since the conversion
+ * start has passed, then polls the RDY bit of the status register with
+ * growing intervals.
+ *
+ * @param dev Device descriptor
+ * @param timeout_ms Maximum time since the conversion start
+ * @return `ESP_OK` on success, `ESP_ERR_TIMEOUT` if RDY is not set in time
+ */
+esp_err_t adt7410_wait_ready(adt7410_t *dev, uint32_t timeout_ms);
+
 /**
  * @brief Read temperature
  *
@@ -122,6 +180,15 @@ esp_err_t adt7410_get_resolution(adt7410_t *dev, adt7410_resolution_t *res);
  */
 esp_err_t adt7410_get_temperature(adt7410_t *dev, float *t);
 
+/**
+ * @brief Read temperature without floating point arithmetic
+ *
+ * @param dev Device descriptor
+ * @param[out] t Ambient temperature in 0.01°C
+ * @return `ESP_OK` on success
+ */
+esp_err_t adt7410_get_temperature_fixed(adt7410_t *dev, int16_t *t);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,287 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "flashlog.h"
+
+static const char *TAG = "yaws-flashlog";
+
+#define FLASHLOG_MAGIC 0x594c4f31
+#define FLASHLOG_READ 1024      // bytes per flash read when draining
+#define NOT_DRAINED 0xffffffff
+
+struct header {
+        uint32_t magic;
+        uint32_t seq;
+        uint16_t record;
+        uint16_t reserved;
+        uint32_t crc;           // of the fields above
+        uint32_t drained;       // zeroed when the tail leaves the sector
+};
+
+// reflected CRC-32 (zlib), a nibble at a time: 64 bytes of table instead of 1 KiB
+static uint32_t crc32(const void *buf, int len)
+{
+        static const uint32_t t[16] = {
+                0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+                0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+        };
+        const uint8_t *p = buf;
+        uint32_t crc = ~0u;
+        while (len-- > 0) {
+                crc ^= *p++;
+                crc = (crc >> 4) ^ t[crc & 15];
+                crc = (crc >> 4) ^ t[crc & 15];
+        }
+        return ~crc;
+}
+
+static size_t offset(const struct flashlog *log, uint16_t sector, uint16_t slot)
+{
+        return (size_t)sector * FLASHLOG_SECTOR + (size_t)slot * log->slot;
+}
+
+static uint16_t next(const struct flashlog *log, uint16_t sector)
+{
+        return sector + 1 == log->sectors ? 0 : sector + 1;
+}
+
+static bool header_read(const struct flashlog *log, uint16_t sector, struct header *h)
+{
+        if (esp_partition_read(log->part, offset(log, sector, 0), h, sizeof *h) != ESP_OK)
+                return false;
+        return h->magic == FLASHLOG_MAGIC && h->record == log->record &&
+                h->crc == crc32(h, offsetof(struct header, crc));
+}
+
+static bool erased(const struct flashlog *log, uint16_t sector, uint16_t slot)
+{
+        uint32_t buf[FLASHLOG_PAGE / 4];
+        if (esp_partition_read(log->part, offset(log, sector, slot), buf, log->slot) != ESP_OK)
+                return false;
+        for (int i = 0; i < log->slot / 4; i++)
+                if (buf[i] != 0xffffffff)
+                        return false;
+        return true;
+}
+
+static esp_err_t mark_drained(const struct flashlog *log, uint16_t sector)
+{
+        static const uint32_t zero = 0;
+        return esp_partition_write(log->part, offset(log, sector, 0) + offsetof(struct header, drained),
+                                   &zero, sizeof zero);
+}
+
+// rebuilds the index from sector headers
+static void recover(struct flashlog *log)
+{
+        struct flashlog_index *x = log->index;
+        struct header h;
+        int head = -1;
+
+        for (int s = 0; s < log->sectors; s++)
+                if (header_read(log, s, &h) && (head < 0 || (int32_t)(h.seq - x->seq) > 0)) {
+                        head = s;
+                        x->seq = h.seq;
+                }
+        if (head < 0) {
+                // blank: the first append opens sector 0
+                x->seq = 0;
+                x->head = x->tail = (struct flashlog_pos) { log->sectors - 1, log->slots };
+                return;
+        }
+
+        // slots are written in order, so the erased ones are at the end;
+        // the last written one may be cut, its CRC tells
+        int lo = 1, hi = log->slots;
+        while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (erased(log, head, mid))
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+        x->head = (struct flashlog_pos) { head, lo };
+
+        header_read(log, head, &h);
+        if (h.drained != NOT_DRAINED) {
+                // consumed to the end of a full head sector
+                x->tail = x->head;
+                return;
+        }
+        // tail: the oldest of the sectors before the head that are not drained
+        int tail = head;
+        for (int k = 1; k < log->sectors; k++) {
+                int s = (head + log->sectors - k) % log->sectors;
+                if (!header_read(log, s, &h) || h.seq != x->seq - k || h.drained != NOT_DRAINED)
+                        break;
+                tail = s;
+        }
+        x->tail = (struct flashlog_pos) { tail, 1 };
+}
+
+esp_err_t flashlog_open(struct flashlog *log, const char *label, int record, struct flashlog_index *index)
+{
+        int slot = 32;
+        while (slot < record + 4)
+                slot *= 2;
+        if (record <= 0 || slot > FLASHLOG_PAGE)
+                return ESP_ERR_INVALID_SIZE;
+
+        const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        if (part == NULL)
+                return ESP_ERR_NOT_FOUND;
+        uint32_t sectors = part->size / FLASHLOG_SECTOR;
+        if (sectors < 2)
+                return ESP_ERR_INVALID_SIZE;
+        *log = (struct flashlog) {
+                .part = part,
+                .index = index,
+                .record = record,
+                .slot = slot,
+                .slots = FLASHLOG_SECTOR / slot,
+                .sectors = sectors < UINT16_MAX ? sectors : UINT16_MAX,
+        };
+
+        uint32_t magic = FLASHLOG_MAGIC ^ record << 16 ^ log->sectors;
+        if (index->magic != magic) {
+                memset(index, 0, sizeof *index);
+                recover(log);
+                index->magic = magic;
+                ESP_LOGI(TAG, "%s recovered: head %u/%u, tail %u/%u", label,
+                         index->head.sector, index->head.slot, index->tail.sector, index->tail.slot);
+                return ESP_OK;
+        }
+        // a reset keeps RTC memory, but may have cut a write: skip what it left
+        while (index->head.slot < log->slots && !erased(log, index->head.sector, index->head.slot)) {
+                ESP_LOGW(TAG, "slot %u/%u is not erased", index->head.sector, index->head.slot);
+                index->head.slot++;
+        }
+        return ESP_OK;
+}
+
+static esp_err_t sector_open(struct flashlog *log)
+{
+        struct flashlog_index *x = log->index;
+        uint16_t s = next(log, x->head.sector);
+        bool empty = flashlog_empty(log);
+        struct header h;
+        esp_err_t err;
+
+        if (!empty && x->tail.sector == s) {
+                // full: the oldest sector goes
+                x->dropped += log->slots - x->tail.slot;
+                x->tail = (struct flashlog_pos) { next(log, s), 1 };
+                ESP_LOGW(TAG, "full, %u records dropped so far", x->dropped);
+        }
+        // a valid header is spoilt first, so that an erase cut by power loss can't leave one behind
+        if (header_read(log, s, &h)) {
+                static const uint32_t zero = 0;
+                if ((err = esp_partition_write(log->part, offset(log, s, 0), &zero, sizeof zero)) != ESP_OK)
+                        return err;
+        }
+        if ((err = esp_partition_erase_range(log->part, offset(log, s, 0), FLASHLOG_SECTOR)) != ESP_OK)
+                return err;
+
+        h = (struct header) {
+                .magic = FLASHLOG_MAGIC,
+                .seq = x->seq + 1,
+                .record = log->record,
+                .drained = NOT_DRAINED,
+        };
+        h.crc = crc32(&h, offsetof(struct header, crc));
+        if ((err = esp_partition_write(log->part, offset(log, s, 0), &h, sizeof h)) != ESP_OK)
+                return err;
+        x->seq++;
+        x->head = (struct flashlog_pos) { s, 1 };
+        if (empty)
+                x->tail = x->head;
+        return ESP_OK;
+}
+
+esp_err_t flashlog_append(struct flashlog *log, const void *records, int n)
+{
+        static uint32_t page[FLASHLOG_PAGE / 4];
+        struct flashlog_index *x = log->index;
+        const uint8_t *r = records;
+        const int per_page = FLASHLOG_PAGE / log->slot;
+        esp_err_t err;
+
+        while (n > 0) {
+                if (x->head.slot >= log->slots && (err = sector_open(log)) != ESP_OK)
+                        return err;
+                // slots up to the end of the page, one write
+                int k = per_page - x->head.slot % per_page;
+                if (k > n)
+                        k = n;
+                memset(page, 0xff, k * log->slot);
+                for (int i = 0; i < k; i++, r += log->record) {
+                        uint8_t *w = (uint8_t *)page + i * log->slot;
+                        uint32_t crc = crc32(r, log->record);
+                        memcpy(w, r, log->record);
+                        memcpy(w + log->slot - 4, &crc, 4);
+                }
+                err = esp_partition_write(log->part, offset(log, x->head.sector, x->head.slot), page, k * log->slot);
+                // slots are spoilt either way
+                x->head.slot += k;
+                n -= k;
+                if (err != ESP_OK)
+                        return err;
+        }
+        return ESP_OK;
+}
+
+int flashlog_read(struct flashlog *log, struct flashlog_pos *pos, void *records, int n)
+{
+        static uint32_t buf[FLASHLOG_READ / 4];
+        const struct flashlog_index *x = log->index;
+        uint8_t *out = records;
+        int got = 0;
+
+        while (got < n) {
+                if (pos->slot >= log->slots && pos->sector != x->head.sector)
+                        *pos = (struct flashlog_pos) { next(log, pos->sector), 1 };
+                int end = pos->sector == x->head.sector ? x->head.slot : log->slots;
+                int k = end - pos->slot;
+                if (k <= 0)
+                        break;
+                if (k > n - got)
+                        k = n - got;
+                if (k > FLASHLOG_READ / log->slot)
+                        k = FLASHLOG_READ / log->slot;
+                if (esp_partition_read(log->part, offset(log, pos->sector, pos->slot), buf, k * log->slot) != ESP_OK)
+                        return -1;
+                for (int i = 0; i < k; i++) {
+                        const uint8_t *r = (const uint8_t *)buf + i * log->slot;
+                        uint32_t crc;
+                        memcpy(&crc, r + log->slot - 4, 4);
+                        if (crc != crc32(r, log->record)) {
+                                ESP_LOGW(TAG, "slot %u/%u is bad", pos->sector, pos->slot + i);
+                                continue;
+                        }
+                        memcpy(out, r, log->record);
+                        out += log->record;
+                        got++;
+                }
+                pos->slot += k;
+        }
+        if (pos->slot >= log->slots && pos->sector != x->head.sector)
+                *pos = (struct flashlog_pos) { next(log, pos->sector), 1 };
+        return got;
+}
+
+esp_err_t flashlog_consume(struct flashlog *log, struct flashlog_pos pos)
+{
+        struct flashlog_index *x = log->index;
+        esp_err_t err = ESP_OK;
+
+        for (uint16_t s = x->tail.sector; s != pos.sector && err == ESP_OK; s = next(log, s))
+                err = mark_drained(log, s);
+        // the head sector is drained too once it is full and read to the end
+        if (err == ESP_OK && pos.slot >= log->slots && x->seq != 0 &&
+            !(x->tail.sector == pos.sector && x->tail.slot >= log->slots))
+                err = mark_drained(log, pos.sector);
+        x->tail = pos;
+        return err;
+}
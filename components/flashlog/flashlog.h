@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_partition.h>
+
+/*
+  Append-only log of fixed-size records in a flash partition, for samples
+  that have to wait days for the network.
+
+  The partition is a ring of 4 KiB sectors, the erase unit of the ESP8266
+  flash. The first slot of a sector is its header with a sequence number,
+  the rest hold records, each with a CRC-32 at the end of its slot. Slots
+  are a power of two of at least 32 bytes, so that they never straddle a
+  256-byte program page; records are written a page at a time. A sector
+  is erased only when the head of the log gets to it again, so all of
+  them wear evenly. When the log is full the oldest sector is dropped.
+
+  Head and tail are kept in struct flashlog_index, which the caller keeps
+  in RTC memory. When it doesn't survive (power loss), flashlog_open()
+  finds the head by sector sequence numbers and a binary search for the
+  first erased slot, and the tail as the oldest sector not marked drained.
+  A record cut by power loss fails its CRC and is skipped. Records of the
+  tail sector consumed before power loss are read again.
+ */
+#define FLASHLOG_SECTOR 4096
+#define FLASHLOG_PAGE 256
+
+struct flashlog_pos {
+        uint16_t sector;
+        uint16_t slot;          // 0 is the header
+};
+
+struct flashlog_index {
+        uint32_t magic;
+        uint32_t seq;           // of the head sector
+        struct flashlog_pos head; // next slot to write
+        struct flashlog_pos tail; // oldest record not consumed
+        uint32_t dropped;       // records overwritten while the log was full
+};
+
+struct flashlog {
+        const esp_partition_t *part;
+        struct flashlog_index *index;
+        uint16_t record;        // bytes
+        uint16_t slot;          // bytes
+        uint16_t slots;         // per sector, header included
+        uint16_t sectors;
+};
+
+// index is kept as is if it matches the partition, otherwise rebuilt from flash
+esp_err_t flashlog_open(struct flashlog *log, const char *label, int record, struct flashlog_index *index);
+// records are written in the order given, a page at a time
+esp_err_t flashlog_append(struct flashlog *log, const void *records, int n);
+
+static inline bool flashlog_empty(const struct flashlog *log)
+{
+        return log->index->head.sector == log->index->tail.sector &&
+                log->index->head.slot == log->index->tail.slot;
+}
+
+/*
+  Reading doesn't consume: records are copied from *pos, which starts at
+  index->tail, and *pos is moved past them. Returns the number of records
+  copied, 0 at the head, or -1 on a flash error. Bad records are skipped.
+ */
+int flashlog_read(struct flashlog *log, struct flashlog_pos *pos, void *records, int n);
+// records before pos are gone, sectors left behind are marked drained
+esp_err_t flashlog_consume(struct flashlog *log, struct flashlog_pos pos);
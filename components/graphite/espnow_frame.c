@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "espnow_frame.h"
+#include "ftoa.h"
+
+#define HEAD_PRECISION 0x07
+#define HEAD_TS 0x08
+
+// append only: ids are on the air and gateways may lag behind sensors
+static const char *const metric_id[] = {
+        NULL,                   // name follows
+        "temperature",
+        "pressure",
+        "humidity",
+        "voltage",
+        "wake.boot_ms",
+        "wake.init_ms",
+        "wake.wifi_ms",
+        "wake.ota_ms",
+        "wake.sensor_ms",
+        "wake.display_ms",
+        "wake.send_ms",
+        "wake.disconnect_ms",
+        "wake.total_ms",
+        "wake.energy_uah",
+        "wake.avg_energy_uah",
+        "tx.success",
+        "tx.retry",
+        "tx.fail",
+        "tx.noack",
+};
+#define METRIC_IDS (sizeof metric_id / sizeof metric_id[0])
+
+static int lookup(const char *metric)
+{
+        for (int i = 1; i < METRIC_IDS; i++)
+                if (strcmp(metric, metric_id[i]) == 0)
+                        return i;
+        return 0;
+}
+
+void espnow_frame_init(struct espnow_frame *f, const uint8_t *mac, uint16_t seq)
+{
+        f->buf[0] = ESPNOW_FRAME_VERSION;
+        memcpy(f->buf + 1, mac, 6);
+        f->buf[7] = seq;
+        f->buf[8] = seq >> 8;
+        f->len = ESPNOW_FRAME_HEADER;
+        f->ts = 0;
+}
+
+esp_err_t espnow_frame_add(struct espnow_frame *f, const char *metric, int32_t value, int precision, uint32_t ts)
+{
+        uint8_t rec[1 + 1 + 255 + 1 + 4 + 5], *w = rec;
+        int id = lookup(metric);
+        size_t name_len = strlen(metric);
+
+        if (precision < 0 || precision > FTOA_MAX_PRECISION || (id == 0 && name_len > 255))
+                return ESP_ERR_INVALID_ARG;
+
+        *w++ = id;
+        if (id == 0) {
+                *w++ = name_len;
+                memcpy(w, metric, name_len);
+                w += name_len;
+        }
+        // the first record always carries the timestamp
+        bool with_ts = espnow_frame_empty(f) || ts != f->ts;
+        *w++ = precision | (with_ts ? HEAD_TS : 0);
+        if (with_ts)
+                for (int i = 0; i < 4; i++)
+                        *w++ = ts >> (8 * i);
+        uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+        do {
+                *w++ = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+                v >>= 7;
+        } while (v != 0);
+
+        int n = w - rec;
+        if (f->len + n > ESPNOW_FRAME_MAX)
+                return ESP_ERR_INVALID_SIZE;
+        memcpy(f->buf + f->len, rec, n);
+        f->len += n;
+        f->ts = ts;
+        return ESP_OK;
+}
+
+esp_err_t espnow_frame_parse(const uint8_t *buf, int len, uint8_t *mac, uint16_t *seq,
+                             espnow_record_fn fn, void *ctx)
+{
+        const uint8_t *r = buf + ESPNOW_FRAME_HEADER, *end = buf + len;
+        char name[256];
+        struct espnow_record rec = {0};
+        bool first = true;
+
+        if (len < ESPNOW_FRAME_HEADER || len > ESPNOW_FRAME_MAX || buf[0] != ESPNOW_FRAME_VERSION)
+                return ESP_ERR_INVALID_RESPONSE;
+        if (mac != NULL)
+                memcpy(mac, buf + 1, 6);
+        if (seq != NULL)
+                *seq = buf[7] | buf[8] << 8;
+
+        while (r < end) {
+                uint8_t id = *r++;
+                if (id >= METRIC_IDS)
+                        return ESP_ERR_INVALID_RESPONSE;
+                if (id == 0) {
+                        if (r == end || end - r - 1 < *r || *r == 0)
+                                return ESP_ERR_INVALID_RESPONSE;
+                        memcpy(name, r + 1, *r);
+                        name[*r] = 0;
+                        r += 1 + *r;
+                        rec.metric = name;
+                } else {
+                        rec.metric = metric_id[id];
+                }
+
+                if (r == end)
+                        return ESP_ERR_INVALID_RESPONSE;
+                uint8_t head = *r++;
+                rec.precision = head & HEAD_PRECISION;
+                if (rec.precision > FTOA_MAX_PRECISION || head & ~(HEAD_PRECISION | HEAD_TS))
+                        return ESP_ERR_INVALID_RESPONSE;
+                if (head & HEAD_TS) {
+                        if (end - r < 4)
+                                return ESP_ERR_INVALID_RESPONSE;
+                        rec.ts = r[0] | r[1] << 8 | r[2] << 16 | (uint32_t)r[3] << 24;
+                        r += 4;
+                } else if (first) {
+                        return ESP_ERR_INVALID_RESPONSE;
+                }
+                first = false;
+
+                uint32_t v = 0;
+                for (int shift = 0;; shift += 7) {
+                        if (r == end || shift > 28)
+                                return ESP_ERR_INVALID_RESPONSE;
+                        v |= (uint32_t)(*r & 0x7f) << shift;
+                        if ((*r++ & 0x80) == 0)
+                                break;
+                }
+                rec.value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+
+                if (fn != NULL) {
+                        esp_err_t err = fn(ctx, &rec);
+                        if (err != ESP_OK)
+                                return err;
+                }
+        }
+        return ESP_OK;
+}
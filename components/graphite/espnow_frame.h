@@ -0,0 +1,83 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+/*
+  Binary metric frame of the ESP-NOW transport, at most one ESP-NOW
+  payload. Integers are little endian.
+
+    0  version
+    1  MAC address of the sensor (6)
+    7  sequence number (2), the same for retransmissions of a frame
+    9  records
+
+  Record:
+
+    metric      id from the table in espnow_frame.c, or 0 followed by
+                name length (1) and name
+    head        bits 0-2: precision, bit 3: timestamp follows, otherwise
+                it is the same as in the previous record
+    [timestamp] unix time (4), 0 - unknown
+    value       in units of 10^-precision, zigzag LEB128
+
+  A reading of four metrics takes about 20 bytes instead of 120 of
+  Graphite plaintext.
+ */
+#define ESPNOW_FRAME_VERSION 1
+#define ESPNOW_FRAME_MAX 250            // ESP_NOW_MAX_DATA_LEN
+#define ESPNOW_FRAME_HEADER 9
+
+/*
+  Acknowledgement of a frame, sent back by yaws-relay to the source
+  address of the frame:
+
+    0  ESPNOW_FRAME_ACK
+    1  sequence number of the frame (2)
+ */
+#define ESPNOW_FRAME_ACK 0x80
+#define ESPNOW_FRAME_ACK_LEN 3
+
+struct espnow_frame {
+        uint8_t buf[ESPNOW_FRAME_MAX];
+        int len;
+        uint32_t ts;            // of the last record
+};
+
+struct espnow_record {
+        const char *metric;
+        int32_t value;          // in units of 10^-precision
+        uint8_t precision;
+        uint32_t ts;            // unix time, 0 - unknown
+};
+
+void espnow_frame_init(struct espnow_frame *f, const uint8_t *mac, uint16_t seq);
+// ESP_ERR_INVALID_SIZE if the record doesn't fit, the frame is unchanged then
+esp_err_t espnow_frame_add(struct espnow_frame *f, const char *metric, int32_t value, int precision, uint32_t ts);
+
+static inline bool espnow_frame_empty(const struct espnow_frame *f)
+{
+        return f->len <= ESPNOW_FRAME_HEADER;
+}
+
+// ack must have ESPNOW_FRAME_ACK_LEN bytes, frame is a whole one
+static inline void espnow_frame_ack(uint8_t *ack, const uint8_t *frame)
+{
+        ack[0] = ESPNOW_FRAME_ACK;
+        ack[1] = frame[7];
+        ack[2] = frame[8];
+}
+
+static inline bool espnow_frame_acked(const uint8_t *ack, int len, uint16_t seq)
+{
+        return len == ESPNOW_FRAME_ACK_LEN && ack[0] == ESPNOW_FRAME_ACK && (ack[1] | ack[2] << 8) == seq;
+}
+
+/*
+  Calls fn for each record, stops at the first error returned by it.
+  Returns ESP_ERR_INVALID_RESPONSE if the frame is malformed, fn may have
+  been called for the records before the bad one. mac and seq may be NULL.
+ */
+typedef esp_err_t (*espnow_record_fn)(void *ctx, const struct espnow_record *r);
+esp_err_t espnow_frame_parse(const uint8_t *buf, int len, uint8_t *mac, uint16_t *seq,
+                             espnow_record_fn fn, void *ctx);
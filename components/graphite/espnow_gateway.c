@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "espnow_gateway.h"
+
+struct emit {
+        const char *prefix;
+        espnow_gateway_fn fn;
+        void *ctx;
+};
+
+static esp_err_t emit(void *ctx, const struct espnow_record *r)
+{
+        struct emit *e = ctx;
+        return e->fn(e->ctx, e->prefix, r);
+}
+
+void espnow_gateway_init(struct espnow_gateway *g, struct espnow_gateway_node *node, uint32_t nodes)
+{
+        memset(node, 0, nodes * sizeof *node);
+        *g = (struct espnow_gateway) { .node = node, .nodes = nodes };
+}
+
+// slot of the sensor, or the one to take for it
+static struct espnow_gateway_node *lookup(struct espnow_gateway *g, const uint8_t *mac, uint32_t now)
+{
+        uint32_t h = 2166136261u; // FNV-1a
+        for (int i = 0; i < 6; i++)
+                h = (h ^ mac[i]) * 16777619u;
+
+        struct espnow_gateway_node *victim = NULL;
+        for (uint32_t i = 0; i < ESPNOW_GATEWAY_PROBE && i < g->nodes; i++) {
+                struct espnow_gateway_node *n = &g->node[(h + i) & (g->nodes - 1)];
+                if (n->seen != 0 && memcmp(n->mac, mac, 6) == 0)
+                        return n;
+                if (victim == NULL || n->seen == 0 || (victim->seen != 0 && now - n->seen > now - victim->seen))
+                        victim = n;
+        }
+        return victim;
+}
+
+esp_err_t espnow_gateway_receive(struct espnow_gateway *g, const uint8_t *buf, int len, uint32_t now,
+                                 espnow_gateway_fn fn, void *ctx)
+{
+        uint8_t mac[6];
+        uint16_t seq;
+
+        // records are passed on only from frames that are whole
+        if (espnow_frame_parse(buf, len, mac, &seq, NULL, NULL) != ESP_OK) {
+                g->malformed++;
+                return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        now |= 1; // keep seen of a used slot non-zero
+        struct espnow_gateway_node *n = lookup(g, mac, now);
+        if (n->seen != 0 && memcmp(n->mac, mac, 6) == 0 &&
+            n->seq == seq && now - n->seen < ESPNOW_GATEWAY_DEDUPE) {
+                g->duplicates++;
+                return ESP_OK;
+        }
+
+        char prefix[32];
+        snprintf(prefix, sizeof prefix, "yaws.sensor_%02x:%02x:%02x:%02x:%02x:%02x",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        struct emit e = { prefix, fn, ctx };
+        esp_err_t err = espnow_frame_parse(buf, len, NULL, NULL, emit, &e);
+        if (err == ESP_OK)
+                err = fn(ctx, prefix, NULL);
+        // a frame not passed on whole is not seen, its retransmission is taken
+        if (err != ESP_OK)
+                return err;
+        memcpy(n->mac, mac, 6);
+        n->seq = seq;
+        n->seen = now;
+        g->frames++;
+        return ESP_OK;
+}
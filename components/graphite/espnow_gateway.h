@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "espnow_frame.h"
+
+/*
+  Gateway side of the ESP-NOW transport: frames are checked, duplicates
+  dropped and records passed on with the Graphite prefix of the sensor,
+  "yaws.sensor_<MAC>", the same one it would use over UDP.
+
+  A frame is a duplicate if the same sensor sent the same sequence number
+  less than ESPNOW_GATEWAY_DEDUPE seconds ago: retransmissions follow
+  within milliseconds, while a sensor that lost its RTC memory may count
+  from any number again.
+ */
+#define ESPNOW_GATEWAY_NODES 32         // enough for a house
+#define ESPNOW_GATEWAY_DEDUPE 60
+#define ESPNOW_GATEWAY_PROBE 8          // slots looked at per frame
+
+struct espnow_gateway_node {
+        uint8_t mac[6];
+        uint16_t seq;
+        uint32_t seen;          // 0 - free slot
+};
+
+// sensors are hashed by MAC; when a table is full, the one silent for the
+// longest time among the probed slots is forgotten
+struct espnow_gateway {
+        struct espnow_gateway_node *node;
+        uint32_t nodes;         // power of two
+        uint32_t frames, duplicates, malformed;
+};
+
+typedef esp_err_t (*espnow_gateway_fn)(void *ctx, const char *prefix, const struct espnow_record *r);
+
+void espnow_gateway_init(struct espnow_gateway *g, struct espnow_gateway_node *node, uint32_t nodes);
+/*
+  now is any monotonic clock in seconds; duplicates are counted and
+  return ESP_OK. fn gets each record of the frame, then r NULL at its end,
+  to send what it has batched. Error of fn is returned, and the frame is
+  not taken for seen then, so that its retransmission is passed on again.
+ */
+esp_err_t espnow_gateway_receive(struct espnow_gateway *g, const uint8_t *buf, int len, uint32_t now,
+                                 espnow_gateway_fn fn, void *ctx);
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "wifi.h"
+#include "espnow_link.h"
+
+static const char *TAG = "yaws-espnow";
+
+static bool opened;
+static bool radio;              // started here rather than by wifi_connect()
+static uint8_t gateway[6];
+static TaskHandle_t sender;
+static volatile esp_now_send_status_t sent_status;
+
+static void on_sent(const uint8_t *mac, esp_now_send_status_t status)
+{
+        sent_status = status;
+        if (sender != NULL)
+                xTaskNotifyGive(sender);
+}
+
+static esp_err_t radio_start()
+{
+        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+        esp_err_t err = esp_wifi_init(&cfg);
+        if (err == ESP_OK)
+                err = esp_wifi_set_storage(WIFI_STORAGE_RAM);
+        if (err == ESP_OK)
+                err = esp_wifi_set_mode(WIFI_MODE_STA);
+        if (err == ESP_OK)
+                err = esp_wifi_start();
+        // the gateway listens on the channel of its AP, no scan needed
+        if (err == ESP_OK)
+                err = esp_wifi_set_channel(CONFIG_GRAPHITE_ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE);
+        if (err != ESP_OK)
+                ESP_LOGE(TAG, "radio start: %s", esp_err_to_name(err));
+        return err;
+}
+
+esp_err_t espnow_link_open(uint8_t *mac)
+{
+        esp_err_t err;
+
+        if (!opened) {
+                // associated, the radio is already on the channel of the AP
+                radio = !wifi_connected();
+                if (radio && (err = radio_start()) != ESP_OK)
+                        return err;
+
+                unsigned g[6];
+                if (sscanf(CONFIG_GRAPHITE_ESPNOW_GATEWAY, "%x:%x:%x:%x:%x:%x",
+                           &g[0], &g[1], &g[2], &g[3], &g[4], &g[5]) != 6) {
+                        ESP_LOGE(TAG, "invalid CONFIG_GRAPHITE_ESPNOW_GATEWAY: %s", CONFIG_GRAPHITE_ESPNOW_GATEWAY);
+                        espnow_link_close();
+                        return ESP_ERR_INVALID_ARG;
+                }
+                esp_now_peer_info_t peer = {
+                        .channel = 0, // current one
+                        .ifidx = ESP_IF_WIFI_STA,
+                };
+                for (int i = 0; i < 6; i++)
+                        peer.peer_addr[i] = gateway[i] = g[i];
+
+                opened = true;
+                if ((err = esp_now_init()) != ESP_OK ||
+                    (err = esp_now_register_send_cb(on_sent)) != ESP_OK ||
+                    (err = esp_now_add_peer(&peer)) != ESP_OK) {
+                        ESP_LOGE(TAG, "esp_now: %s", esp_err_to_name(err));
+                        espnow_link_close();
+                        return err;
+                }
+        }
+        return esp_wifi_get_mac(ESP_IF_WIFI_STA, mac);
+}
+
+esp_err_t espnow_link_send(const void *buf, int len)
+{
+        esp_err_t err = ESP_ERR_INVALID_STATE;
+
+        if (!opened)
+                return err;
+        sender = xTaskGetCurrentTaskHandle();
+        for (char i = 0; i < 3; i++) {
+                ulTaskNotifyTake(pdTRUE, 0);
+                err = esp_now_send(gateway, buf, len);
+                if (err != ESP_OK) {
+                        vTaskDelay(50 / portTICK_PERIOD_MS);
+                        continue;
+                }
+                // unicast frames are acknowledged by the gateway MAC within a few ms
+                if (ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS) == 0)
+                        err = ESP_ERR_TIMEOUT;
+                else if (sent_status != ESP_NOW_SEND_SUCCESS)
+                        err = ESP_FAIL;
+                else
+                        break;
+        }
+        sender = NULL;
+        return err;
+}
+
+static void (*listener)(const uint8_t *buf, int len);
+
+static void on_received(const uint8_t *mac, const uint8_t *data, int len)
+{
+        listener(data, len);
+}
+
+esp_err_t espnow_link_listen(void (*fn)(const uint8_t *buf, int len))
+{
+        esp_err_t err;
+
+        listener = fn;
+        radio = !wifi_connected();
+        if (radio && (err = radio_start()) != ESP_OK)
+                return err;
+        // a sleeping modem misses frames, the gateway is mains-powered
+        if ((err = esp_wifi_set_ps(WIFI_PS_NONE)) != ESP_OK ||
+            (err = esp_now_init()) != ESP_OK ||
+            (err = esp_now_register_recv_cb(on_received)) != ESP_OK) {
+                ESP_LOGE(TAG, "esp_now: %s", esp_err_to_name(err));
+                return err;
+        }
+        opened = true;
+
+        uint8_t mac[6];
+        esp_wifi_get_mac(ESP_IF_WIFI_STA, mac);
+        ESP_LOGI(TAG, "listening as "MACSTR, MAC2STR(mac));
+        return ESP_OK;
+}
+
+void espnow_link_close(void)
+{
+        if (opened)
+                esp_now_deinit();
+        opened = false;
+        if (radio) {
+                esp_wifi_stop();
+                esp_wifi_deinit();
+                radio = false;
+        }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+
+/*
+  Air link of the ESP-NOW transport. On the devices it is ESP-NOW itself
+  (espnow_link.c), on Linux a UDP socket on localhost stands in for it
+  (host/link_udp.c), so that both ends run on a PC.
+ */
+
+// brings the radio up if WiFi is not connected, mac is the address of this node
+esp_err_t espnow_link_open(uint8_t *mac);
+// sends to CONFIG_GRAPHITE_ESPNOW_GATEWAY, retrying until the frame is acknowledged
+esp_err_t espnow_link_send(const void *buf, int len);
+// gateway: fn is called for each frame received, from the link task, it must not block
+esp_err_t espnow_link_listen(void (*fn)(const uint8_t *buf, int len));
+void espnow_link_close(void);
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "ftoa.h"
+
+static const uint32_t pow10_tab[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+static int clamp_precision(int precision)
+{
+        if (precision < 0)
+                return 0;
+        if (precision > FTOA_MAX_PRECISION)
+                return FTOA_MAX_PRECISION;
+        return precision;
+}
+
+/*
+  Value is taken apart into mantissa and binary exponent and scaled by
+  10^precision in 64-bit integer arithmetic. With precision <= 6 the
+  product fits into 44 bits, so the result is exact and rounding (half
+  to even) gives the same digits as printf("%.*f").
+
+  |value| * 10^precision goes to x, the exponent must be finite.
+ */
+static int scale(uint64_t *x, uint32_t u, int precision)
+{
+        int exp = (u >> 23) & 0xff;
+        uint64_t m = u & 0x7fffff;
+
+        if (exp == 0)
+                exp = 1;        // subnormal
+        else
+                m |= 1 << 23;   // implicit leading bit
+        exp -= 127 + 23;        // value = m * 2^exp
+
+        *x = m * pow10_tab[precision];
+        if (exp >= 0) {
+                if (exp > 63 || (exp > 0 && *x >> (64 - exp) != 0))
+                        return -1; // doesn't fit into 64 bits, far beyond any sensor range
+                *x <<= exp;
+        } else if (exp > -64) {
+                uint64_t rem = *x & ((1ULL << -exp) - 1), half = 1ULL << (-exp - 1);
+                *x >>= -exp;
+                if (rem > half || (rem == half && (*x & 1)))
+                        (*x)++;
+        } else {
+                *x = 0;
+        }
+        return 0;
+}
+
+int ftoa(char *buf, int size, float value, int precision)
+{
+        union { float f; uint32_t u; } fu = { .f = value };
+        int neg = fu.u >> 31;
+        uint64_t x;
+        char tmp[32], *w = tmp + sizeof tmp;
+
+        precision = clamp_precision(precision);
+        if (((fu.u >> 23) & 0xff) == 0xff) {
+                const char *s = fu.u & 0x7fffff ? "nan" : "inf";
+                int n = strlen(s) + neg;
+                if (n >= size)
+                        return -1;
+                if (neg)
+                        *buf++ = '-';
+                memcpy(buf, s, 4);
+                return n;
+        }
+        if (scale(&x, fu.u, precision) < 0)
+                return -1;
+
+        for (int i = 0; i < precision; i++) {
+                *--w = '0' + x % 10;
+                x /= 10;
+        }
+        if (precision > 0)
+                *--w = '.';
+        do {
+                *--w = '0' + x % 10;
+                x /= 10;
+        } while (x);
+        if (neg)
+                *--w = '-';
+
+        int n = tmp + sizeof tmp - w;
+        if (n >= size)
+                return -1;
+        memcpy(buf, w, n);
+        buf[n] = 0;
+        return n;
+}
+
+int ftofix(int32_t *out, float value, int precision)
+{
+        union { float f; uint32_t u; } fu = { .f = value };
+        uint64_t x;
+
+        if (((fu.u >> 23) & 0xff) == 0xff || scale(&x, fu.u, clamp_precision(precision)) < 0 ||
+            x > (fu.u >> 31 ? 1ULL << 31 : INT32_MAX))
+                return -1;
+        *out = fu.u >> 31 ? -(int64_t)x : (int64_t)x;
+        return 0;
+}
+
+int fixtoa(char *buf, int size, int32_t value, int precision)
+{
+        uint32_t x = value < 0 ? -(uint32_t)value : value;
+        char tmp[16], *w = tmp + sizeof tmp;
+
+        precision = clamp_precision(precision);
+
+        for (int i = 0; i < precision; i++) {
+                *--w = '0' + x % 10;
+                x /= 10;
+        }
+        if (precision > 0)
+                *--w = '.';
+        do {
+                *--w = '0' + x % 10;
+                x /= 10;
+        } while (x);
+        if (value < 0)
+                *--w = '-';
+
+        int n = tmp + sizeof tmp - w;
+        if (n >= size)
+                return -1;
+        memcpy(buf, w, n);
+        buf[n] = 0;
+        return n;
+}
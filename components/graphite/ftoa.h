@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+#define FTOA_MAX_PRECISION 6
+
+/*
+  Format value with given number of digits after decimal point, same as
+  printf("%.*f", precision, value) does, but without floating point
+  arithmetic, heap or newlib float printf support (which is missing from
+  nano format library).
+
+  Returns string length or -1 if buf is too small or |value| >= 2^64 / 10^precision.
+ */
+int ftoa(char *buf, int size, float value, int precision);
+
+/*
+  Value in units of 10^-precision, rounded as ftoa() does, so that
+  fixtoa() of it gives the digits of ftoa(). Returns -1 for NaN,
+  infinities and results outside the range of int32_t.
+ */
+int ftofix(int32_t *out, float value, int precision);
+
+/*
+  Format fixed-point value in units of 10^-precision, e.g. 2137 with
+  precision 2 is "21.37". Returns string length or -1 if buf is too small.
+ */
+int fixtoa(char *buf, int size, int32_t value, int precision);
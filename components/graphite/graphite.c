@@ -20,43 +20,54 @@
 #include "lwip/dns.h"
 
 #include "wifi.h"
+#include "graphite.h"
+#include "ftoa.h"
+#include "esp_attr.h"
+#if defined(CONFIG_GRAPHITE_ESPNOW) || defined(CONFIG_GRAPHITE_BINARY)
+#define GRAPHITE_FRAMES
+#include "espnow_frame.h"
+#include "espnow_link.h"
+#endif
 
 static const char* TAG = "yaws-graphite";
 
-static char *format(const char *prefix, const char **metric, float *value, int *msglen)
-{
-        int prefix_len = strlen(prefix);
-        int len = 0;
-        for (const char **m = metric; *m; m++) {
-                len += prefix_len;
-                len += 1;          // '.'
-                len += strlen(*m);
-                len += 1;          // ' '
-                len += 24;         // enough to represent double
-                len += 4;          // ' -1\n'
-        }
-
-        char *buf = malloc(len);
-        if (buf == NULL) {
-                ESP_LOGE(TAG, "Unable to allocate memory for message buffer");
-                return NULL;
-        }
-
-        char *w = buf;
-        for (const char **m = metric; *m; m++) {
-                w += sprintf(w, "%s.%s %f -1\n", prefix, *m, *value++);
-                assert(w - buf < len);
-        }
-        *msglen = w - buf;
+/*
+  Metrics are accumulated in a datagram sized to fit into a single
+  Ethernet frame, so that packets are never IP-fragmented: a lost
+  fragment loses the whole datagram. When the next line doesn't fit, the
+  datagram is sent and a new one is started.
+ */
+#define MTU_PAYLOAD 1472 // 1500 - IP header (20) - UDP header (8)
 
-        if (*msglen > 0xffff - 28) {
-                ESP_LOGE(TAG, "Too many metrics: packet size %d exceeds %d", *msglen, 0xffff - 28);
-                free(buf);
-                return NULL ;
-        }
+#ifndef GRAPHITE_FRAMES
+static char packet[MTU_PAYLOAD + 1]; // +1 for terminating zero written by snprintf
+static int packet_len;
+#ifdef CONFIG_GRAPHITE_COMPACT
+static char packet_prefix[64];
+static uint32_t packet_ts;
+#endif
 
-        return buf;
+static int format(char *buf, int size, const char *prefix, const char *metric, const char *v, uint32_t ts)
+{
+#ifdef CONFIG_GRAPHITE_COMPACT
+        int n = 0;
+        if (packet_len == 0)
+                n += snprintf(buf, size, "@%s\n", prefix);
+        if (n >= size)
+                return n;
+        if (packet_len != 0 && ts == packet_ts)
+                return n + snprintf(buf + n, size - n, "%s %s\n", metric, v);
+        // zero timestamp means "unknown": let Graphite stamp the point on arrival
+        if (ts == 0)
+                return n + snprintf(buf + n, size - n, "%s %s -1\n", metric, v);
+        return n + snprintf(buf + n, size - n, "%s %s %u\n", metric, v, ts);
+#else
+        if (ts == 0)
+                return snprintf(buf, size, "%s.%s %s -1\n", prefix, metric, v);
+        return snprintf(buf, size, "%s.%s %s %u\n", prefix, metric, v, ts);
+#endif
 }
+#endif
 
 static int sock = -1;
 static struct sockaddr_in addr;
@@ -68,7 +79,7 @@ static esp_err_t graphite_init()
                 .sin_addr = (struct in_addr){
                         .s_addr = inet_addr(CONFIG_GRAPHITE_ADDR),
                 },
-                .sin_port = htons(2003)
+                .sin_port = htons(CONFIG_GRAPHITE_PORT)
         };
 
         if (addr.sin_addr.s_addr == INADDR_NONE) {
@@ -85,8 +96,56 @@ static esp_err_t graphite_init()
         return ESP_OK;
 }
 
+#define TX_MAGIC 0x74780002
+
+RTC_DATA_ATTR struct graphite_tx graphite_tx;
+
+static void tx_count(int attempts, bool ok)
+{
+        if (graphite_tx.magic != TX_MAGIC)
+                graphite_tx = (struct graphite_tx) { .magic = TX_MAGIC };
+        if (attempts > 1 && graphite_tx.retry < UINT16_MAX)
+                graphite_tx.retry += attempts - 1;
+        if (ok && graphite_tx.success < UINT16_MAX)
+                graphite_tx.success++;
+        if (!ok && graphite_tx.fail < UINT16_MAX)
+                graphite_tx.fail++;
+}
+
+/*
+  Counters added to the batch by graphite_tx_publish(). They are taken
+  off graphite_tx only once the datagram carrying them is delivered, so
+  a window whose datagram is lost is published again with the next one.
+ */
+static struct graphite_tx tx_published;
+static bool tx_pending;
+
+esp_err_t graphite_tx_publish(const char *prefix)
+{
+        esp_err_t err = ESP_OK;
+
+        if (graphite_tx.magic != TX_MAGIC)
+                return ESP_OK;
+        struct graphite_tx tx = graphite_tx;
+        err = graphite_batch_add_fixed(prefix, "tx.success", tx.success, 0, 0);
+        if (err == ESP_OK)
+                err = graphite_batch_add_fixed(prefix, "tx.retry", tx.retry, 0, 0);
+        if (err == ESP_OK)
+                err = graphite_batch_add_fixed(prefix, "tx.fail", tx.fail, 0, 0);
+#ifdef CONFIG_GRAPHITE_ACK
+        if (err == ESP_OK)
+                err = graphite_batch_add_fixed(prefix, "tx.noack", tx.noack, 0, 0);
+#endif
+        // the last of them is in the datagram sent next; counters only
+        // grow, so this snapshot covers an earlier one still pending
+        tx_published = tx;
+        tx_pending = err == ESP_OK;
+        return err;
+}
+
 #ifdef CONFIG_IDF_TARGET_ESP8266
-static int packet_tx_status;
+static volatile int packet_tx_status;
+static TaskHandle_t packet_tx_task;
 static void track_packet_status(const esp_aio_t *aio)
 {
 	wifi_tx_status_t *status = (wifi_tx_status_t *) &(aio->ret);
@@ -95,14 +154,54 @@ static void track_packet_status(const esp_aio_t *aio)
 
 	if (buf[12] == 0x08 && buf[13] == 0x00 && // IP
 	    buf[23] == 17 && // UDP
-	    buf[36] == 7 && buf[37] == 211) // port 2003
+	    buf[36] == (CONFIG_GRAPHITE_PORT >> 8) && buf[37] == (CONFIG_GRAPHITE_PORT & 0xff)) // destination port
 	{
 		packet_tx_status = status->wifi_tx_result;
+		// WiFi task: wake the sender right when the MAC layer is done
+		if (packet_tx_task != NULL)
+			xTaskNotifyGive(packet_tx_task);
 	}
 }
 #endif
 
-esp_err_t graphite(const char *prefix, const char **metric, float *value)
+// ticks left until deadline, 0 if it has passed
+static TickType_t ticks_left(TickType_t deadline)
+{
+        TickType_t now = xTaskGetTickCount();
+        return (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+}
+
+// waits ms, but not past deadline
+static void delay_until(TickType_t deadline, uint32_t ms)
+{
+        TickType_t left = ticks_left(deadline);
+        vTaskDelay(pdMS_TO_TICKS(ms) < left ? pdMS_TO_TICKS(ms) : left);
+}
+
+static uint32_t batch_sent;
+
+uint32_t graphite_batch_sent()
+{
+        return batch_sent;
+}
+
+// outcome of a datagram, or frame, of the batch
+static void batch_done(bool delivered)
+{
+        if (delivered)
+                batch_sent++;
+        if (!tx_pending)
+                return;
+        tx_pending = false;
+        if (!delivered)
+                return;
+        graphite_tx.success -= tx_published.success;
+        graphite_tx.retry -= tx_published.retry;
+        graphite_tx.fail -= tx_published.fail;
+        graphite_tx.noack -= tx_published.noack;
+}
+
+static esp_err_t packet_send(const char *msg, int msglen)
 {
         if (sock < 0) {
                 esp_err_t err = graphite_init();
@@ -110,11 +209,6 @@ esp_err_t graphite(const char *prefix, const char **metric, float *value)
                         return err;
         }
 
-        int msglen = 0;
-        char *msg = format(prefix, metric, value, &msglen);
-        if (msg == NULL)
-                return ESP_FAIL;
-
 // call below relies on the following change to SDK
 #if 0
 diff --git a/components/lwip/port/esp8266/netif/wlanif.c b/components/lwip/port/esp8266/netif/wlanif.c
@@ -138,34 +232,267 @@ index c301ee81..6867d852 100644
 +
 #endif
 
+        // attempts share one deadline, so that a bad link can't keep the radio up for long
+        const TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_GRAPHITE_TX_DEADLINE);
+        esp_err_t err = ESP_ERR_TIMEOUT;
+        int attempts = 0;
 #ifdef CONFIG_IDF_TARGET_ESP8266
         extern void (* volatile low_level_send_callback)(const esp_aio_t*);
+        packet_tx_task = xTaskGetCurrentTaskHandle();
 	low_level_send_callback = track_packet_status;
-        for (char i = 0; i < 3; i++) {
+        while (attempts < 3 && ticks_left(deadline) > 0) {
+                attempts++;
                 packet_tx_status = -1;
+                ulTaskNotifyTake(pdTRUE, 0); // late status of the previous attempt
                 int n = sendto(sock, msg, msglen, 0, (struct sockaddr *)&addr, sizeof addr);
                 if (n != msglen) {
-                        vTaskDelay(150 / portTICK_PERIOD_MS);
+                        err = ESP_FAIL;
+                        delay_until(deadline, 150);
                         continue;
                 }
-                for (char j = 0; j < 64; j++) {
-                        vTaskDelay(50 / portTICK_PERIOD_MS);
-                        if (packet_tx_status != -1)
-                                break;
-                }
-                if (packet_tx_status == TX_STATUS_SUCCESS)
+                ulTaskNotifyTake(pdTRUE, ticks_left(deadline));
+                if (packet_tx_status == TX_STATUS_SUCCESS) {
+                        err = ESP_OK;
                         break;
+                }
+                err = packet_tx_status == -1 ? ESP_ERR_TIMEOUT : ESP_FAIL;
         }
         low_level_send_callback = NULL;
+        packet_tx_task = NULL;
 #else
-        for (char i = 0; i < 3; i++) {
+        while (attempts < 3 && ticks_left(deadline) > 0) {
+                attempts++;
                 int n = sendto(sock, msg, msglen, 0, (struct sockaddr *)&addr, sizeof addr);
-                if (n == msglen)
+                if (n == msglen) {
+                        err = ESP_OK;
                         break;
-                vTaskDelay(150 / portTICK_PERIOD_MS);
+                }
+                err = ESP_FAIL;
+                delay_until(deadline, 150);
         }
 #endif
-        free(msg);
+        tx_count(attempts, err == ESP_OK);
+        if (err != ESP_OK)
+                ESP_LOGE(TAG, "datagram of %d bytes not sent after %d attempts: %s", msglen, attempts, esp_err_to_name(err));
+        return err;
+}
+
+#ifdef GRAPHITE_FRAMES
+/*
+  Binary transports: metrics go in frames (see espnow_frame.h) either over
+  ESP-NOW to the gateway, without association and IP, or over UDP to
+  yaws-relay. prefix is not sent, the receiver derives it from the MAC
+  address in the frame.
+ */
+static RTC_DATA_ATTR uint16_t frame_seq; // any value will do after power-on
+static struct espnow_frame frame;
+static bool frame_started;
+
+#if defined(CONFIG_GRAPHITE_ACK) && !defined(CONFIG_GRAPHITE_ESPNOW)
+/*
+  yaws-relay acknowledges each frame it has queued for carbon. A frame
+  that is not acknowledged in CONFIG_GRAPHITE_ACK_TIMEOUT ms is sent again
+  with the same sequence number, so that the relay drops it if only the
+  acknowledgement was lost. After CONFIG_GRAPHITE_ACK_RETRIES the frame is
+  given up and it is up to the caller to keep its records for next wake.
+ */
+static esp_err_t ack_wait(uint16_t seq)
+{
+        const TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_GRAPHITE_ACK_TIMEOUT);
+        uint8_t ack[ESPNOW_FRAME_ACK_LEN + 1];
+
+        for (TickType_t left; (left = ticks_left(deadline)) > 0;) {
+                uint32_t ms = left * portTICK_PERIOD_MS;
+                struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = ms % 1000 * 1000 };
+                fd_set fds;
+                FD_ZERO(&fds);
+                FD_SET(sock, &fds);
+                int n = select(sock + 1, &fds, NULL, NULL, &tv);
+                if (n < 0 && errno != EINTR)
+                        return ESP_FAIL;
+                if (n <= 0)
+                        continue;
+                n = recv(sock, ack, sizeof ack, MSG_DONTWAIT);
+                // anything else is a late acknowledgement of an earlier frame
+                if (espnow_frame_acked(ack, n, seq))
+                        return ESP_OK;
+        }
+        return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t frame_send()
+{
+        const uint16_t seq = frame.buf[7] | frame.buf[8] << 8;
+        esp_err_t err = ESP_OK;
+
+        for (int i = 0; i <= CONFIG_GRAPHITE_ACK_RETRIES; i++) {
+                if ((err = packet_send((const char *)frame.buf, frame.len)) != ESP_OK)
+                        return err;
+                if ((err = ack_wait(seq)) != ESP_ERR_TIMEOUT)
+                        break;
+        }
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "frame %u not acknowledged: %s", seq, esp_err_to_name(err));
+                if (graphite_tx.noack < UINT16_MAX)
+                        graphite_tx.noack++;
+        }
+        return err;
+}
+#endif
 
+static esp_err_t frame_flush()
+{
+        esp_err_t err;
+
+        if (!frame_started || espnow_frame_empty(&frame))
+                return ESP_OK;
+        frame_started = false;
+#if defined(CONFIG_GRAPHITE_ESPNOW)
+        // the link retries on its own, only the outcome is counted
+        err = espnow_link_send(frame.buf, frame.len);
+        tx_count(1, err == ESP_OK);
+#elif defined(CONFIG_GRAPHITE_ACK)
+        err = frame_send();
+#else
+        err = packet_send((const char *)frame.buf, frame.len);
+#endif
+        batch_done(err == ESP_OK);
+        return err;
+}
+
+static esp_err_t frame_add(const char *metric, int32_t value, int precision, uint32_t ts)
+{
+        esp_err_t err;
+        for (char i = 0; i < 2; i++) {
+                if (!frame_started) {
+                        uint8_t mac[6];
+#ifdef CONFIG_GRAPHITE_ESPNOW
+                        if ((err = espnow_link_open(mac)) != ESP_OK)
+                                return err;
+#else
+                        memcpy(mac, mac_addr, sizeof mac); // set by wifi_connect()
+#endif
+                        espnow_frame_init(&frame, mac, frame_seq++);
+                        frame_started = true;
+                }
+                err = espnow_frame_add(&frame, metric, value, precision, ts);
+                if (err != ESP_ERR_INVALID_SIZE || espnow_frame_empty(&frame))
+                        break;
+                if ((err = frame_flush()) != ESP_OK)
+                        return err;
+        }
+        if (err == ESP_ERR_INVALID_SIZE)
+                ESP_LOGE(TAG, "%s doesn't fit into a frame", metric);
+        return err;
+}
+#endif
+
+void graphite_close()
+{
+        // a batch not flushed is lost
+        tx_pending = false;
+#ifdef GRAPHITE_FRAMES
+        frame_started = false;
+#endif
+#ifdef CONFIG_GRAPHITE_ESPNOW
+        espnow_link_close();
+#endif
+        if (sock >= 0) {
+                close(sock);
+                sock = -1;
+        }
+}
+
+esp_err_t graphite_batch_flush()
+{
+#ifdef GRAPHITE_FRAMES
+        return frame_flush();
+#else
+        if (packet_len == 0)
+                return ESP_OK;
+        esp_err_t err = packet_send(packet, packet_len);
+        packet_len = 0;
+        batch_done(err == ESP_OK);
+        return err;
+#endif
+}
+
+#ifndef GRAPHITE_FRAMES
+static esp_err_t batch_add(const char *prefix, const char *metric, const char *value, uint32_t ts)
+{
+        esp_err_t err;
+#ifdef CONFIG_GRAPHITE_COMPACT
+        if (packet_len != 0 && strcmp(prefix, packet_prefix) != 0)
+                if ((err = graphite_batch_flush()) != ESP_OK)
+                        return err;
+#endif
+        int size = MTU_PAYLOAD - packet_len + 1;
+        int n = format(packet + packet_len, size, prefix, metric, value, ts);
+        if (n >= size && packet_len != 0) {
+                if ((err = graphite_batch_flush()) != ESP_OK)
+                        return err;
+                size = MTU_PAYLOAD + 1;
+                n = format(packet, size, prefix, metric, value, ts);
+        }
+        if (n < 0 || n >= size) {
+                ESP_LOGE(TAG, "%s.%s doesn't fit into a packet", prefix, metric);
+                return ESP_ERR_INVALID_SIZE;
+        }
+
+#ifdef CONFIG_GRAPHITE_COMPACT
+        if (packet_len == 0)
+                strlcpy(packet_prefix, prefix, sizeof packet_prefix);
+        packet_ts = ts;
+#endif
+        packet_len += n;
         return ESP_OK;
 }
+#endif
+
+esp_err_t graphite_batch_add(const char *prefix, const char *metric, float value, int precision, uint32_t ts)
+{
+#ifdef GRAPHITE_FRAMES
+        int32_t fixed;
+        if (ftofix(&fixed, value, precision) < 0) {
+                ESP_LOGE(TAG, "%s.%s is out of range", prefix, metric);
+                return ESP_ERR_INVALID_ARG;
+        }
+        return frame_add(metric, fixed, precision, ts);
+#else
+        char v[24];
+        if (ftoa(v, sizeof v, value, precision) < 0) {
+                ESP_LOGE(TAG, "%s.%s is out of range", prefix, metric);
+                return ESP_ERR_INVALID_ARG;
+        }
+        return batch_add(prefix, metric, v, ts);
+#endif
+}
+
+esp_err_t graphite_batch_add_fixed(const char *prefix, const char *metric, int32_t value, int precision, uint32_t ts)
+{
+#ifdef GRAPHITE_FRAMES
+        return frame_add(metric, value, precision, ts);
+#else
+        char v[24];
+        if (fixtoa(v, sizeof v, value, precision) < 0) {
+                ESP_LOGE(TAG, "%s.%s is out of range", prefix, metric);
+                return ESP_ERR_INVALID_ARG;
+        }
+        return batch_add(prefix, metric, v, ts);
+#endif
+}
+
+esp_err_t graphite_at(const char *prefix, const char **metric, const float *value, const uint32_t *ts)
+{
+        for (int i = 0; metric[i]; i++) {
+                esp_err_t err = graphite_batch_add(prefix, metric[i], value[i], CONFIG_GRAPHITE_PRECISION, ts ? ts[i] : 0);
+                if (err != ESP_OK)
+                        return err;
+        }
+        return graphite_batch_flush();
+}
+
+esp_err_t graphite(const char *prefix, const char **metric, const float *value)
+{
+        return graphite_at(prefix, metric, value, NULL);
+}
@@ -1,4 +1,66 @@
 #pragma once
+#include <stdint.h>
 #include <esp_err.h>
 
+// values are sent with CONFIG_GRAPHITE_PRECISION digits after decimal point
 esp_err_t graphite(const char *prefix, const char **metric, const float *value);
+// same as graphite(), but each metric carries its own unix timestamp (0 - unknown)
+esp_err_t graphite_at(const char *prefix, const char **metric, const float *value, const uint32_t *ts);
+
+/*
+  Batch API: metrics are packed into datagrams of at most 1472 bytes,
+  full datagrams are sent right away by graphite_batch_add(), the last
+  one by graphite_batch_flush(). WiFi must be connected. precision is
+  the number of digits after decimal point, up to FTOA_MAX_PRECISION.
+
+  With CONFIG_GRAPHITE_COMPACT datagrams use the relay line format:
+
+    @<prefix>
+    <metric> <value> <timestamp>
+    <metric> <value>
+
+  prefix is sent once per datagram, omitted timestamp is the same as in
+  the previous line, -1 is "unknown".
+ */
+esp_err_t graphite_batch_add(const char *prefix, const char *metric, float value, int precision, uint32_t ts);
+// value is in units of 10^-precision, e.g. centi-°C with precision 2: no soft-float on ESP8266
+esp_err_t graphite_batch_add_fixed(const char *prefix, const char *metric, int32_t value, int precision, uint32_t ts);
+esp_err_t graphite_batch_flush();
+/*
+  Datagrams, or frames, delivered since boot: acknowledged by yaws-relay
+  with CONFIG_GRAPHITE_ACK, sent otherwise. If it changed while a record
+  was being added, all records added before that one are delivered, even
+  if the batch fails later, so a caller may drop them from its queue.
+ */
+uint32_t graphite_batch_sent();
+/*
+  Outcomes of datagrams sent since the last graphite_tx_publish(), kept
+  in RTC memory. On ESP8266 a datagram succeeds once the MAC layer of the
+  AP has acknowledged it, elsewhere once it is queued. Each datagram is
+  tried up to three times within CONFIG_GRAPHITE_TX_DEADLINE.
+ */
+struct graphite_tx {
+        uint32_t magic;
+        uint16_t success;       // datagrams sent
+        uint16_t retry;         // attempts beyond the first one
+        uint16_t fail;          // datagrams given up
+        uint16_t noack;         // frames never acknowledged, CONFIG_GRAPHITE_ACK
+};
+extern struct graphite_tx graphite_tx;
+/*
+  Add the counters to the batch as <prefix>.tx.*. What was published is
+  taken off them once the datagram carrying it is delivered, see
+  graphite_batch_sent(); if it isn't, they are published again next time.
+ */
+esp_err_t graphite_tx_publish(const char *prefix);
+
+// drops the socket, or the ESP-NOW link and the radio it brought up
+void graphite_close();
+
+/*
+  With CONFIG_GRAPHITE_ESPNOW the batch API sends binary frames over
+  ESP-NOW to a gateway (see espnow_frame.h, espnow_gateway.h), which
+  emits Graphite plaintext under "yaws.sensor_<MAC>", whatever prefix
+  was given. WiFi need not be connected. With CONFIG_GRAPHITE_BINARY the
+  same frames go over UDP to yaws-relay, which does the same.
+ */
@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "lwip/err.h"
@@ -16,23 +16,69 @@ static const char* TAG = "yaws-syslog";
 
 #if defined(CONFIG_IDF_TARGET_ESP8266)
 static putchar_like_t old_putchar;
-#elif defined(CONFIG_IDF_TARGET_ESP32)
+#elif defined(CONFIG_IDF_TARGET_ESP32) || defined(CONFIG_IDF_TARGET_LINUX)
 static vprintf_like_t old_vprintf;
 #endif
 
 static int sock = -1;
-static SemaphoreHandle_t lock;
-static MessageBufferHandle_t msgbuf;
 
 const int facility = CONFIG_SYSLOG_FACILITY;
 
-#define SIZE 512
+#define SIZE 512                // longer lines are cut
+#define RING 4096               // bytes of pending lines, a power of two
+#define WRITERS 3               // tasks in the middle of a line at once
+
+/*
+  The log hook assembles a line in a line buffer of the task writing it,
+  so that lines of tasks logging at once don't mix. When the line is
+  complete, its ESP_LOG header "E (tick) tag: " is parsed once and the
+  line is appended to a ring of variable-size records with the result in
+  the record header; syslog_task sends it from the ring without copying.
+  Tasks take the lock to claim a line buffer and to append to the ring,
+  syslog_task is the only consumer of ring[tail..head).
+ */
+struct record {
+        uint16_t size;          // bytes taken in the ring, header included; 0 - rest of the ring is skipped
+        uint16_t len;           // line length, color escape sequences and newlines removed
+        uint16_t body;          // offset of message text
+        uint8_t tag, tag_len;   // offset and length of ESP_LOG tag
+        int8_t prio;            // syslog severity, -1 if the line isn't ESP_LOG formatted
+        uint32_t tick;
+        char data[];
+};
+#define RECORD_MAX (sizeof(struct record) + SIZE)
+
+struct writer {
+        TaskHandle_t task;
+        volatile bool busy;
+        int len;
+        char line[SIZE];
+};
+
+static SemaphoreHandle_t lock;
+static struct writer writer[WRITERS];
+static uint32_t ring[RING / 4];
+static volatile unsigned head, tail; // bytes ever appended and consumed
+static unsigned dropped;
+
+static struct record *record_at(unsigned pos)
+{
+        return (struct record *)((char *)ring + pos % RING);
+}
+
+// pos, or the start of the ring if the record at pos is the end marker
+static unsigned record_first(unsigned pos)
+{
+        if (record_at(pos)->size == 0)
+                pos += RING - pos % RING;
+        return pos;
+}
 
 static int trim_color_escape_seq_and_newline(char *msg, int len)
 {
         char *w = msg, *r = msg, *end = msg + len;
         while (r < end) {
-                if (end - r >= 6 &&
+                if (end - r >= 7 &&
                     r[0] == '\033' &&
                     r[1] == '[' &&
                     r[3] == ';' &&
@@ -65,78 +111,185 @@ static int decode_prio(char ch)
         case 'I': return 5;
         case 'D': return 6;
         case 'V': return 7;
-        default: return 7;
+        default: return -1;
         }
 }
 
-static void buffer_send(char *msg, int len)
+// parse "E (1234) tag: message"
+static void parse_header(struct record *s, const char *data)
 {
-        len = trim_color_escape_seq_and_newline(msg, len);
-        msg[len] = 0;
-
-        // Ignore garbage produced by SDK
-        // "wifi E (238) timer:0x3ffe9a24 cb is null" messages
-        // W (787) wifi:<ba-add>idx:1 (ifx:0, 4c:ed:fb:b2:df:a8), tid:0, ssn:0, winSize:64
-        // W (817) wifi:<ba-del>idx
-        // W (817) wifi:hmac tx: ifx0 stop, discard
-        if (strstr(msg, "wifi") && (strstr(msg, "cb is null")))
-                return;
-        if (strstr(msg, "wifi:<ba-add>"))
-                return;
-        if (strstr(msg, "wifi:<ba-del>"))
-                return;
-        if (strstr(msg, "wifi:hmac") && strstr(msg, "stop, discard"))
+        const char *p = data, *end = data + s->len;
+
+        s->prio = -1;
+        s->body = 0;
+        s->tag_len = 0;
+        if (end - p < 4 || p[1] != ' ' || p[2] != '(' || decode_prio(p[0]) < 0)
                 return;
-        if (strstr(msg, "@@"))
+
+        uint32_t tick = 0;
+        for (p += 3; p < end && *p >= '0' && *p <= '9'; p++)
+                tick = tick * 10 + *p - '0';
+        if (end - p < 2 || p[0] != ')' || p[1] != ' ')
                 return;
-        if (len == 0)
+
+        const char *tag = p += 2;
+        while (p < end && *p != ':' && p - tag < 32)
+                p++;
+        if (p == end || *p != ':' || p == tag)
                 return;
 
-        bool taken = xSemaphoreTake(lock, portMAX_DELAY);
-        assert(taken == true);
-        xMessageBufferSend(msgbuf, msg, len < SIZE ? len : SIZE, 100);
-        xSemaphoreGive(lock);
+        s->tag = tag - data;
+        s->tag_len = p - tag;
+        for (p++; p < end && *p == ' '; p++)
+                ;
+        s->body = p - data;
+        s->tick = tick;
+        s->prio = decode_prio(data[0]);
+}
+
+static bool has_prefix(const char *s, const char *end, const char *prefix)
+{
+        int n = strlen(prefix);
+        return end - s >= n && memcmp(s, prefix, n) == 0;
+}
+
+static bool contains(const char *s, const char *end, const char *needle)
+{
+        int n = strlen(needle);
+        for (; end - s >= n; s++)
+                if (*s == *needle && memcmp(s, needle, n) == 0)
+                        return true;
+        return false;
+}
+
+// Ignore garbage produced by SDK
+// "wifi E (238) timer:0x3ffe9a24 cb is null" messages
+// W (787) wifi:<ba-add>idx:1 (ifx:0, 4c:ed:fb:b2:df:a8), tid:0, ssn:0, winSize:64
+// W (817) wifi:<ba-del>idx
+// W (817) wifi:hmac tx: ifx0 stop, discard
+static bool garbage(const struct record *s, const char *data)
+{
+        const char *body = data + s->body, *end = data + s->len;
+
+        if (s->len == 0)
+                return true;
+        if (contains(data, end, "@@"))
+                return true;
+        if (s->prio < 0)
+                return has_prefix(data, end, "wifi") && contains(data, end, "cb is null");
+        if (s->tag_len != 4 || memcmp(data + s->tag, "wifi", 4) != 0)
+                return false;
+        return has_prefix(body, end, "<ba-add>") ||
+                has_prefix(body, end, "<ba-del>") ||
+                (has_prefix(body, end, "hmac") && contains(body, end, "stop, discard"));
 }
 
 static TaskHandle_t syslog_task_handle = NULL;
 
+static void drop()
+{
+        xSemaphoreTake(lock, portMAX_DELAY);
+        dropped++;
+        xSemaphoreGive(lock);
+}
+
+// line buffer of the calling task, NULL if all are taken
+static struct writer *writer_get()
+{
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        struct writer *w = NULL;
+
+        // only the task itself claims and releases its buffer
+        for (int i = 0; i < WRITERS; i++)
+                if (writer[i].busy && writer[i].task == self)
+                        return &writer[i];
+        xSemaphoreTake(lock, portMAX_DELAY);
+        for (int i = 0; i < WRITERS && w == NULL; i++)
+                if (!writer[i].busy) {
+                        w = &writer[i];
+                        w->task = self;
+                        w->len = 0;
+                        __sync_synchronize();
+                        w->busy = true;
+                }
+        xSemaphoreGive(lock);
+        return w;
+}
+
+// called by the log hook once the line is complete, releases the line buffer
+static void line_publish(struct writer *w)
+{
+        struct record r = { .len = trim_color_escape_seq_and_newline(w->line, w->len) };
+
+        parse_header(&r, w->line);
+        if (!garbage(&r, w->line)) {
+                // records are never split by the end of the ring, so that they can be sent in place
+                unsigned size = (sizeof r + r.len + 3) & ~3;
+                xSemaphoreTake(lock, portMAX_DELAY);
+                unsigned pad = head % RING + size > RING ? RING - head % RING : 0;
+                if (head + pad + size - tail > RING) {
+                        dropped++;
+                } else {
+                        if (pad > 0)
+                                record_at(head)->size = 0;
+                        r.size = size;
+                        struct record *p = record_at(head + pad);
+                        *p = r;
+                        memcpy(p->data, w->line, r.len);
+                        __sync_synchronize(); // record must be visible before head moves
+                        head += pad + size;
+                        xTaskNotifyGive(syslog_task_handle);
+                }
+                xSemaphoreGive(lock);
+        }
+        __sync_synchronize();
+        w->busy = false;
+}
+
 #if defined(CONFIG_IDF_TARGET_ESP8266)
 static int syslog_putchar(int ch)
 {
 	if (xTaskGetCurrentTaskHandle() == syslog_task_handle)
 		return ch;
 
-        static char buf[SIZE], *wptr = buf;
-
-        if (wptr - buf < SIZE)
-                *wptr++ = ch;
-
-        if (ch == '\n') {
-                buffer_send(buf, wptr - buf);
-                wptr = buf;
+        struct writer *w = writer_get();
+        if (w == NULL) {
+                if (ch == '\n')
+                        drop();
+        } else {
+                if (w->len < SIZE)
+                        w->line[w->len++] = ch;
+                if (ch == '\n')
+                        line_publish(w);
         }
 
         if (old_putchar != NULL)
                 return old_putchar(ch);
         return ch;
 }
-#elif defined(CONFIG_IDF_TARGET_ESP32)
+#elif defined(CONFIG_IDF_TARGET_ESP32) || defined(CONFIG_IDF_TARGET_LINUX)
 static int syslog_vprintf(const char *fmt, va_list va)
 {
 	if (xTaskGetCurrentTaskHandle() == syslog_task_handle)
 		return 0;
 
-        static char buf[SIZE];
-        static int len;
-        int n = vsnprintf(buf + len, SIZE - len, fmt, va);
-        if (n <= 0)
-                return n;
-        len += n;
-        if (len >= SIZE)
-                len = SIZE;
-        if (len == SIZE || buf[len - 1] == '\n' || buf[len - 1] == '\r') {
-                buffer_send(buf, len);
-                len = 0;
+        struct writer *w = writer_get();
+        int n = 0;
+        if (w == NULL) {
+                drop(); // a call is a whole line as a rule
+        } else {
+                va_list copy;
+                va_copy(copy, va);
+                n = vsnprintf(w->line + w->len, SIZE - w->len, fmt, copy);
+                va_end(copy);
+                // a cut line ends where vsnprintf() left room for NUL
+                if (n > 0)
+                        w->len = n < SIZE - w->len ? w->len + n : SIZE - 1;
+                char last = w->len > 0 ? w->line[w->len - 1] : 0;
+                if (w->len == SIZE - 1 || last == '\n' || last == '\r')
+                        line_publish(w);
+                else if (w->len == 0)
+                        w->busy = false;
         }
 
         if (old_vprintf != NULL)
@@ -146,10 +299,69 @@ static int syslog_vprintf(const char *fmt, va_list va)
 #endif
 
 char syslog_last_err[64];
-static void syslog_task(void *arg)
+
+static void track_error(const struct record *s)
+{
+        const char *body = s->data + s->body;
+        int errlen = s->len - s->body;
+
+        if (s->prio < 0 || s->prio > 4)
+                return;
+        if (errlen >= sizeof syslog_last_err)
+                errlen = sizeof syslog_last_err - 1;
+        if (errlen > 10 && memcmp(body, "prev_err: ", 10) != 0) {
+                memcpy(syslog_last_err, body, errlen);
+                syslog_last_err[errlen] = 0;
+        }
+}
+
+/*
+  With CONFIG_SYSLOG_FRAMING_NEWLINE or CONFIG_SYSLOG_FRAMING_OCTET_COUNTED
+  all pending messages are packed into as few datagrams as possible, so
+  that the backlog accumulated before WiFi is up drains in a couple of
+  packets.
+ */
+#define MTU_PAYLOAD 1472 // 1500 - IP header (20) - UDP header (8)
+#define HEADER_SIZE 72
+#define BATCH 16                // messages per datagram at most
+
+// headers of the messages of the datagram being sent, [BATCH] is for "dropped" record
+static char header[BATCH + 1][HEADER_SIZE];
+
+// fill iov[0] with header and iov[1] with body, returns message length
+static int frame(struct iovec *iov, char *h, int prio, const char *tag, int tag_len, char level,
+                 uint32_t tick, const char *body, int body_len, bool first)
 {
-        char msg[SIZE+1], tag[32], header[64];
+        char tmp[HEADER_SIZE];
+        int n;
+
+        if (prio >= 0)
+                n = snprintf(tmp, sizeof tmp, "<%d> %.*s %c (%u) ",
+                             facility * 8 + prio, tag_len, tag, level, tick);
+        else
+                n = snprintf(tmp, sizeof tmp, "<%d> ", facility * 8 + 6);
+        if (n >= sizeof tmp)
+                n = sizeof tmp - 1;
+
+#if defined(CONFIG_SYSLOG_FRAMING_OCTET_COUNTED)
+        n = snprintf(h, HEADER_SIZE, "%d %s", n + body_len, tmp);
+#elif defined(CONFIG_SYSLOG_FRAMING_NEWLINE)
+        n = snprintf(h, HEADER_SIZE, "%s%s", first ? "" : "\n", tmp);
+#else
+        memcpy(h, tmp, n + 1);
+#endif
+        if (n >= HEADER_SIZE)
+                n = HEADER_SIZE - 1;
+
+        iov[0].iov_base = h;
+        iov[0].iov_len = n;
+        iov[1].iov_base = (char *)body;
+        iov[1].iov_len = body_len;
+        return n + body_len;
+}
 
+static void syslog_task(void *arg)
+{
         struct sockaddr_in addr = {
                 .sin_family = AF_INET,
                 .sin_addr = (struct in_addr){
@@ -157,57 +369,65 @@ static void syslog_task(void *arg)
                 },
                 .sin_port = htons(CONFIG_SYSLOG_PORT)
         };
-        struct iovec iov[2] = {
-                { .iov_base = header,
-                  .iov_len = 1 },
-        };
+        struct iovec iov[2 * (BATCH + 1)];
         struct msghdr msghdr = {
                 .msg_name = &addr,
                 .msg_namelen = sizeof addr,
                 .msg_iov = iov,
-                .msg_iovlen = 2
         };
+        unsigned discarded = 0, reported = 0;
+        char dropped_msg[32];
 
+        // until there is a socket keep the most recent messages: a line of
+        // any length must fit, past the end of the ring too
         while (sock < 0) {
-                if (xMessageBufferIsFull(msgbuf))
-                        xMessageBufferReceive(msgbuf, msg, sizeof msg - 1, portMAX_DELAY);
+                while (RING - (head - tail) < 2 * RECORD_MAX) {
+                        unsigned t = record_first(tail);
+                        tail = t + record_at(t)->size;
+                        discarded++;
+                }
                 vTaskDelay(100 / portTICK_PERIOD_MS);
         }
 
         while (1) {
-                size_t len = xMessageBufferReceive(msgbuf, msg, sizeof msg - 1, portMAX_DELAY);
-                assert(len != 0);
-
-                int header_len = 0;
-                unsigned tick;
-                int n = sscanf(msg, "%*[EWIDV] (%u) %15[^:]: %n", &tick, tag, &header_len);
-
-                if (n == 2) {
-                        int prio = decode_prio(*msg);
-                        iov[0].iov_len = snprintf(header, sizeof header,
-                                                  "<%d> %s %c (%u) ",
-                                                  facility * 8 + prio, tag, *msg, tick);
-                        if (prio <= 4) {
-                                int errlen = len - header_len;
-                                if (errlen >= sizeof syslog_last_err)
-                                        errlen = sizeof syslog_last_err - 1;
-                                char *err = msg + header_len;
-                                if (errlen > 10 && memcmp(err, "prev_err: ", 10) != 0) {
-                                        memcpy(syslog_last_err, msg + header_len, errlen);
-                                        syslog_last_err[errlen] = 0;
-                                }
-                        }
-                } else {
-                        iov[0].iov_len = snprintf(header, sizeof header, "<%d> ", facility * 8 + 6);
+                while (tail == head)
+                        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+                int niov = 0, size = 0;
+                unsigned lost = dropped + discarded - reported;
+                if (lost != 0) {
+                        int len = snprintf(dropped_msg, sizeof dropped_msg, "dropped %u messages", lost);
+                        size += frame(iov, header[BATCH], 4, TAG, strlen(TAG), 'W',
+                                      xTaskGetTickCount(), dropped_msg, len, true);
+                        niov += 2;
                 }
-                if (iov[0].iov_len >= sizeof header)
-                        iov[0].iov_len = sizeof header;
-
-                iov[1].iov_base = msg + header_len;
-                iov[1].iov_len = len - header_len;
 
+                unsigned end = tail, last = head;
+                int msgs = 0;
+                do {
+#if !defined(CONFIG_SYSLOG_FRAMING_NEWLINE) && !defined(CONFIG_SYSLOG_FRAMING_OCTET_COUNTED)
+                        if (niov > 0)
+                                break;
+#endif
+                        end = record_first(end);
+                        const struct record *s = record_at(end);
+                        int len = frame(&iov[niov], header[msgs], s->prio, s->data + s->tag, s->tag_len,
+                                        s->data[0], s->tick, s->data + s->body, s->len - s->body, niov == 0);
+                        if (niov > 0 && size + len > MTU_PAYLOAD)
+                                break;
+                        track_error(s);
+                        size += len;
+                        niov += 2;
+                        msgs++;
+                        end += s->size;
+                } while (end != last && msgs < BATCH);
+
+                msghdr.msg_iovlen = niov;
                 while (!wifi_connected() || sendmsg(sock, &msghdr, 0) == -1)
                         vTaskDelay(100 / portTICK_PERIOD_MS);
+
+                tail = end;
+                reported += lost;
         }
 }
 
@@ -220,20 +440,17 @@ void syslog_early_init()
 
         lock = xSemaphoreCreateMutex();
         if (lock == NULL) {
-                ESP_LOGE(TAG, "Unable to create semaphore");
+                ESP_LOGE(TAG, "Unable to create lock");
                 return;
         }
 
-        msgbuf = xMessageBufferCreate(4096);
-        if (msgbuf == NULL) {
-                ESP_LOGE(TAG, "Unable to create message buffer");
+        if (xTaskCreate(&syslog_task, "log", 3072, NULL, 5, &syslog_task_handle) != pdPASS) {
+                ESP_LOGE(TAG, "Unable to create task");
                 return;
         }
-
-        xTaskCreate(&syslog_task, "log", 3072, NULL, 5, &syslog_task_handle);
 #if defined(CONFIG_IDF_TARGET_ESP8266)
         old_putchar = esp_log_set_putchar(syslog_putchar);
-#elif defined(CONFIG_IDF_TARGET_ESP32)
+#elif defined(CONFIG_IDF_TARGET_ESP32) || defined(CONFIG_IDF_TARGET_LINUX)
         old_vprintf = esp_log_set_vprintf(syslog_vprintf);
 #endif
 
@@ -242,9 +459,9 @@ void syslog_early_init()
 
 void syslog_init()
 {
-        if (msgbuf == NULL) {
+        if (syslog_task_handle == NULL) {
                 syslog_early_init();
-                if (msgbuf == NULL)
+                if (syslog_task_handle == NULL)
                         return;
         }
 
@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+#include "graphite.h"
+#include "wake.h"
+
+static const char *TAG = "yaws-wake";
+
+static const struct {
+        const char *name;
+        uint16_t ma;            // current draw
+} phase_info[WAKE_PHASE_MAX] = {
+        [WAKE_BOOT] = {"wake.boot_ms", CONFIG_WAKE_CURRENT_BOOT},
+        [WAKE_INIT] = {"wake.init_ms", CONFIG_WAKE_CURRENT_INIT},
+        [WAKE_WIFI] = {"wake.wifi_ms", CONFIG_WAKE_CURRENT_WIFI},
+        [WAKE_OTA] = {"wake.ota_ms", CONFIG_WAKE_CURRENT_OTA},
+        [WAKE_SENSOR] = {"wake.sensor_ms", CONFIG_WAKE_CURRENT_SENSOR},
+        [WAKE_DISPLAY] = {"wake.display_ms", CONFIG_WAKE_CURRENT_DISPLAY},
+        [WAKE_SEND] = {"wake.send_ms", CONFIG_WAKE_CURRENT_SEND},
+        [WAKE_DISCONNECT] = {"wake.disconnect_ms", CONFIG_WAKE_CURRENT_DISCONNECT},
+};
+
+#define WAKE_MAGIC 0x77616b02      // bumped when the layout of saved changes
+
+static RTC_DATA_ATTR struct {
+        uint32_t magic;
+        uint16_t ms[WAKE_PHASE_MAX];    // previous wake, phases may overlap
+        uint16_t total;                 // previous wake, wall time
+        uint16_t wakes;                 // wakes since the last publish
+        uint32_t charge;                // previous wake, mA·ms
+        uint64_t charges;               // mA·ms of these wakes
+} saved;
+
+// [WAKE_PHASE_MAX] collects time of wake_run(), which is accounted to the jobs
+static uint32_t ms[WAKE_PHASE_MAX + 1];
+static enum wake_phase current = WAKE_BOOT;
+static int64_t phase_start;
+/*
+  mA·ms of this wake. Phases run one after another are charged at their
+  current draw. Jobs of wake_run() overlap, so its wall time is charged
+  at the base current once, and each job adds only what its phase draws
+  on top of that.
+ */
+static uint32_t charge;
+
+static uint32_t job_ma(enum wake_phase phase)
+{
+        return phase_info[phase].ma > CONFIG_WAKE_CURRENT_BASE ? phase_info[phase].ma - CONFIG_WAKE_CURRENT_BASE : 0;
+}
+
+// mA·ms to tenths of µAh
+static int32_t tenths_uah(uint64_t mams)
+{
+        mams = (mams + 180) / 360;
+        return mams > INT32_MAX ? INT32_MAX : mams;
+}
+
+void wake_phase(enum wake_phase phase)
+{
+        int64_t now = esp_timer_get_time();
+        uint32_t t = (now - phase_start) / 1000;
+        ms[current] += t;
+        charge += t * (current == WAKE_PHASE_MAX ? CONFIG_WAKE_CURRENT_BASE : phase_info[current].ma);
+        current = phase;
+        phase_start = now;
+}
+
+void wake_done(void)
+{
+        wake_phase(current);
+
+        if (saved.magic != WAKE_MAGIC) {
+                // RTC memory holds garbage after power-on
+                memset(&saved, 0, sizeof saved);
+                saved.magic = WAKE_MAGIC;
+        }
+        uint32_t total = esp_timer_get_time() / 1000;
+        for (int i = 0; i < WAKE_PHASE_MAX; i++)
+                saved.ms[i] = ms[i] > UINT16_MAX ? UINT16_MAX : ms[i];
+        saved.total = total > UINT16_MAX ? UINT16_MAX : total;
+        saved.charge = charge;
+        saved.charges += charge;
+        if (saved.wakes < UINT16_MAX)
+                saved.wakes++;
+
+        int32_t e = tenths_uah(charge);
+        ESP_LOGI(TAG, "awake %u ms, ~%d.%d uAh", total, e / 10, e % 10);
+}
+
+esp_err_t wake_publish(const char *prefix)
+{
+        esp_err_t err = ESP_OK;
+
+        if (saved.magic != WAKE_MAGIC || saved.wakes == 0)
+                return ESP_OK;
+
+        for (int i = 0; i < WAKE_PHASE_MAX && err == ESP_OK; i++)
+                if (saved.ms[i] != 0)
+                        err = graphite_batch_add_fixed(prefix, phase_info[i].name, saved.ms[i], 0, 0);
+        if (err == ESP_OK)
+                err = graphite_batch_add_fixed(prefix, "wake.total_ms", saved.total, 0, 0);
+        if (err == ESP_OK)
+                err = graphite_batch_add_fixed(prefix, "wake.energy_uah", tenths_uah(saved.charge), 1, 0);
+        // wakes in between were not published, average covers them all
+        if (err == ESP_OK)
+                err = graphite_batch_add_fixed(prefix, "wake.avg_energy_uah",
+                                               tenths_uah(saved.charges / saved.wakes), 1, 0);
+        if (err == ESP_OK) {
+                saved.wakes = 0;
+                saved.charges = 0;
+        }
+        return err;
+}
+
+#define WAKE_JOBS_MAX 24        // event group bits
+
+static EventGroupHandle_t jobs_done;
+
+static void job_task(void *arg)
+{
+        struct wake_job *job = arg;
+        int64_t start = esp_timer_get_time();
+
+        job->err = job->fn();
+        job->ms = (esp_timer_get_time() - start) / 1000;
+        xEventGroupSetBits(jobs_done, 1 << job->id);
+        vTaskDelete(NULL);
+}
+
+esp_err_t wake_run(struct wake_job *job, int n)
+{
+        const uint32_t all = (1 << n) - 1;
+        const enum wake_phase prev = current;
+        uint32_t started = 0, finished = 0, failed = 0;
+
+        if (n > WAKE_JOBS_MAX)
+                return ESP_ERR_INVALID_ARG;
+        if (jobs_done == NULL && (jobs_done = xEventGroupCreate()) == NULL)
+                return ESP_ERR_NO_MEM;
+        xEventGroupClearBits(jobs_done, all);
+        wake_phase(WAKE_PHASE_MAX);
+
+        while (finished != all) {
+                bool progress = false;
+                for (int i = 0; i < n; i++) {
+                        uint32_t bit = 1 << i;
+                        if ((started & bit) || (job[i].deps & finished) != job[i].deps)
+                                continue;
+                        started |= bit;
+                        progress = true;
+                        job[i].id = i;
+                        job[i].ms = 0;
+                        if (job[i].deps & failed) {
+                                job[i].err = ESP_ERR_INVALID_STATE;
+                        } else if (xTaskCreate(job_task, job[i].name, job[i].stack, &job[i],
+                                               uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+                                ESP_LOGE(TAG, "Unable to create %s task", job[i].name);
+                                job[i].err = ESP_ERR_NO_MEM;
+                        } else {
+                                continue;
+                        }
+                        // not started: done already, dependents may be ready now
+                        finished |= bit;
+                        failed |= bit;
+                        i = -1;
+                }
+
+                uint32_t running = started & ~finished;
+                if (running == 0) {
+                        if (!progress) {
+                                ESP_LOGE(TAG, "circular job dependencies");
+                                break;
+                        }
+                        continue;
+                }
+
+                uint32_t bits = xEventGroupWaitBits(jobs_done, running, pdTRUE, pdFALSE, portMAX_DELAY) & running;
+                finished |= bits;
+                for (int i = 0; i < n; i++) {
+                        if (!(bits & (1 << i)))
+                                continue;
+                        ms[job[i].phase] += job[i].ms;
+                        charge += job[i].ms * job_ma(job[i].phase);
+                        if (job[i].err != ESP_OK) {
+                                failed |= 1 << i;
+                                ESP_LOGW(TAG, "%s failed: %s", job[i].name, esp_err_to_name(job[i].err));
+                        }
+                }
+        }
+        wake_phase(prev);
+        return finished == all ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
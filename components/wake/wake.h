@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+
+/*
+  Time spent in each phase of a wake. Breakdown of the previous wake is
+  kept in RTC memory and published with the next batch of metrics as
+  <prefix>.wake.<phase>_ms, along with an energy estimate from
+  per-phase current draws configured in Kconfig.
+ */
+enum wake_phase {
+        WAKE_BOOT,              // reset to the first wake_phase() call
+        WAKE_INIT,              // NVS, netif, drivers
+        WAKE_WIFI,              // association and DHCP
+        WAKE_OTA,               // OTA check and update
+        WAKE_SENSOR,            // sensor power-up, conversion and read
+        WAKE_DISPLAY,           // picture download and panel refresh
+        WAKE_SEND,              // clock sync and metrics
+        WAKE_DISCONNECT,        // WiFi shutdown
+        WAKE_PHASE_MAX,
+};
+
+// current phase ends, the given one starts
+void wake_phase(enum wake_phase phase);
+// call right before deep sleep: saves breakdown of this wake
+void wake_done(void);
+// add breakdown of the previous wake to the Graphite batch
+esp_err_t wake_publish(const char *prefix);
+
+/*
+  Jobs of a wake run concurrently, each in its own task, as soon as the
+  jobs they depend on succeed. Jobs whose dependency failed are skipped
+  with ESP_ERR_INVALID_STATE. Time of each job is accounted to its phase,
+  so phases of overlapping jobs add up to more than the wall time; the
+  energy estimate counts the base current of overlapping jobs once.
+ */
+struct wake_job {
+        const char *name;
+        enum wake_phase phase;
+        esp_err_t (*fn)(void);
+        uint32_t deps;          // bit mask of indices of jobs in the same table
+        uint16_t stack;         // task stack size
+        esp_err_t err;          // result
+        uint32_t ms;            // time the job took
+        uint8_t id;
+};
+
+// run all jobs and return once they are done
+esp_err_t wake_run(struct wake_job *job, int n);
@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include "delta.h"
+
+enum {
+        STATE_HEADER,
+        STATE_OP,
+        STATE_ARG,
+        STATE_LITERAL,
+};
+
+void delta_init(struct delta *d, const struct delta_io *io)
+{
+        memset(d, 0, sizeof *d);
+        d->io = io;
+        d->state = STATE_HEADER;
+}
+
+static int emit(struct delta *d, const uint8_t *buf, uint32_t len)
+{
+        if (len > d->size - d->out)
+                return DELTA_ERR_SIZE;
+        if (d->io->write(d->io->ctx, buf, len) != 0)
+                return DELTA_ERR_IO;
+        for (uint32_t i = 0; i < len; i++)
+                d->window[(d->out + i) % DELTA_WINDOW] = buf[i];
+        d->out += len;
+        return DELTA_OK;
+}
+
+static int copy_old(struct delta *d, uint32_t offset, uint32_t len)
+{
+        uint8_t buf[256];
+        while (len > 0) {
+                uint32_t n = len < sizeof buf ? len : sizeof buf;
+                if (d->io->read_old(d->io->ctx, offset, buf, n) != 0)
+                        return DELTA_ERR_IO;
+                int err = emit(d, buf, n);
+                if (err != DELTA_OK)
+                        return err;
+                offset += n;
+                len -= n;
+        }
+        d->old_pos = offset;
+        return DELTA_OK;
+}
+
+static int copy_new(struct delta *d, uint32_t dist, uint32_t len)
+{
+        uint8_t buf[256];
+        if (dist == 0 || dist > DELTA_WINDOW || dist > d->out)
+                return DELTA_ERR_FORMAT;
+        while (len > 0) {
+                // source may overlap the output, copy at most dist bytes at a time
+                uint32_t n = len < sizeof buf ? len : sizeof buf;
+                if (n > dist)
+                        n = dist;
+                for (uint32_t i = 0; i < n; i++)
+                        buf[i] = d->window[(d->out - dist + i) % DELTA_WINDOW];
+                int err = emit(d, buf, n);
+                if (err != DELTA_OK)
+                        return err;
+                len -= n;
+        }
+        return DELTA_OK;
+}
+
+static int execute(struct delta *d)
+{
+        switch (d->op) {
+        case DELTA_OP_LITERAL:
+                d->literal = d->arg[0];
+                d->state = d->literal ? STATE_LITERAL : STATE_OP;
+                return DELTA_OK;
+        case DELTA_OP_COPY_OLD: {
+                int32_t off = (d->arg[0] >> 1) ^ -(int32_t)(d->arg[0] & 1);
+                d->state = STATE_OP;
+                return copy_old(d, d->old_pos + off, d->arg[1]);
+        }
+        case DELTA_OP_COPY_NEW:
+                d->state = STATE_OP;
+                return copy_new(d, d->arg[0], d->arg[1]);
+        }
+        return DELTA_ERR_FORMAT;
+}
+
+int delta_feed(struct delta *d, const uint8_t *data, uint32_t len)
+{
+        const uint8_t *end = data + len;
+        int err = DELTA_OK;
+
+        while (data < end && err == DELTA_OK) {
+                switch (d->state) {
+                case STATE_HEADER:
+                        d->header[d->out++] = *data++;
+                        if (d->out < DELTA_HEADER_SIZE)
+                                break;
+                        if (memcmp(d->header, DELTA_MAGIC, 4) != 0)
+                                return DELTA_ERR_FORMAT;
+                        d->size = d->header[4] | d->header[5] << 8 | d->header[6] << 16 | (uint32_t)d->header[7] << 24;
+                        d->out = 0;
+                        d->state = STATE_OP;
+                        break;
+                case STATE_OP:
+                        d->op = *data++;
+                        if (d->op > DELTA_OP_COPY_NEW)
+                                return DELTA_ERR_FORMAT;
+                        d->arg[0] = d->arg[1] = 0;
+                        d->narg = d->shift = 0;
+                        d->state = STATE_ARG;
+                        break;
+                case STATE_ARG: {
+                        uint8_t b = *data++;
+                        if (d->shift > 28)
+                                return DELTA_ERR_FORMAT;
+                        d->arg[d->narg] |= (uint32_t)(b & 0x7f) << d->shift;
+                        d->shift += 7;
+                        if (b & 0x80)
+                                break;
+                        d->shift = 0;
+                        if (++d->narg < (d->op == DELTA_OP_LITERAL ? 1 : 2))
+                                break;
+                        err = execute(d);
+                        break;
+                }
+                case STATE_LITERAL: {
+                        uint32_t n = end - data;
+                        if (n > d->literal)
+                                n = d->literal;
+                        err = emit(d, data, n);
+                        data += n;
+                        d->literal -= n;
+                        if (d->literal == 0)
+                                d->state = STATE_OP;
+                        break;
+                }
+                }
+        }
+        return err;
+}
+
+int delta_finish(struct delta *d)
+{
+        if (d->state == STATE_HEADER || d->state == STATE_ARG || d->state == STATE_LITERAL)
+                return DELTA_ERR_FORMAT;
+        return d->out == d->size ? DELTA_OK : DELTA_ERR_SIZE;
+}
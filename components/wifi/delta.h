@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+
+/*
+  Delta OTA patch format
+
+  Patch reconstructs new firmware image from the image in the running
+  partition. All numbers are little endian, varints are LEB128.
+
+    header:  "YDL1"  uint32 new image size  uint8[32] SHA-256 of new image
+    ops:     0x00 len                 literal: len bytes follow
+             0x01 off len             copy len bytes from the old image at
+                                      old position + off (off is zigzag
+                                      encoded, old position is the end of
+                                      the previous copy)
+             0x02 dist len            copy len bytes from the new image,
+                                      dist bytes back (dist <= DELTA_WINDOW)
+
+  Patches are built by tools/yaws-delta.c.
+ */
+
+#define DELTA_MAGIC "YDL1"
+#define DELTA_HEADER_SIZE 40
+#define DELTA_WINDOW 4096
+
+enum {
+        DELTA_OP_LITERAL,
+        DELTA_OP_COPY_OLD,
+        DELTA_OP_COPY_NEW,
+};
+
+enum {
+        DELTA_OK = 0,
+        DELTA_ERR_FORMAT = -1,  // malformed patch
+        DELTA_ERR_IO = -2,      // read_old or write callback failed
+        DELTA_ERR_SIZE = -3,    // patch produced more or less than declared size
+};
+
+struct delta_io {
+        // both return 0 on success
+        int (*read_old)(void *ctx, uint32_t offset, void *buf, uint32_t len);
+        int (*write)(void *ctx, const void *buf, uint32_t len);
+        void *ctx;
+};
+
+struct delta {
+        const struct delta_io *io;
+        uint8_t header[DELTA_HEADER_SIZE];
+        uint32_t size;          // new image size, valid after header is received
+        uint32_t out;           // bytes written so far
+        uint32_t old_pos;
+        uint32_t literal;       // bytes left in current literal
+        uint32_t arg[2], shift;
+        uint8_t state, op, narg;
+        uint8_t window[DELTA_WINDOW];
+};
+
+void delta_init(struct delta *d, const struct delta_io *io);
+// feed next chunk of the patch
+int delta_feed(struct delta *d, const uint8_t *data, uint32_t len);
+// check that the whole image was reconstructed
+int delta_finish(struct delta *d);
+// SHA-256 of the new image, from the patch header
+static inline const uint8_t *delta_sha256(const struct delta *d) { return d->header + 8; }
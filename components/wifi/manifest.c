@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "manifest.h"
+
+static const char *TAG = "yaws-wifi";
+
+void manifest_parse(char *text, const char *default_url, struct ota_manifest *m)
+{
+        char *save = NULL;
+
+        memset(m, 0, sizeof *m);
+        for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+                char *value = line + strcspn(line, " \t");
+                if (*value)
+                        *value++ = 0;
+                value += strspn(value, " \t");
+                value[strcspn(value, "\r")] = 0;
+
+                if (strcmp(line, "version") == 0) {
+                        strlcpy(m->version, value, sizeof m->version);
+                } else if (strcmp(line, "url") == 0) {
+                        strlcpy(m->url, value, sizeof m->url);
+                } else if (strcmp(line, "flags") == 0) {
+                        char *fsave = NULL;
+                        for (char *f = strtok_r(value, " ,", &fsave); f; f = strtok_r(NULL, " ,", &fsave)) {
+                                if (strcmp(f, "vdd_offset_calibration") == 0)
+                                        m->flags |= OTA_FLAG_VDD_OFFSET_CALIBRATION;
+                                else
+                                        ESP_LOGW(TAG, "unknown manifest flag %s", f);
+                        }
+                }
+        }
+        if (m->url[0] == 0)
+                strlcpy(m->url, default_url, sizeof m->url);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+/*
+  OTA manifest is a single request replacing .version,
+  .vdd_offset_calibration and friends. It is a text file with "key value"
+  lines:
+
+    version 1.2.3
+    url http://yaws.home.arpa/ota/sensor-mcp9808.bin
+    flags vdd_offset_calibration
+
+  Only version is required; url defaults to <project_name>.bin next to the
+  manifest.
+ */
+
+#define OTA_FLAG_VDD_OFFSET_CALIBRATION (1 << 0)
+
+struct ota_manifest {
+        char version[32];       // target version
+        char url[128];          // full image
+        uint32_t flags;         // OTA_FLAG_*
+};
+
+// parse manifest text (modified in place)
+void manifest_parse(char *text, const char *default_url, struct ota_manifest *m);
@@ -0,0 +1,459 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_https_ota.h"
+#include "mbedtls/sha256.h"
+
+#include "wifi.h"
+#include "delta.h"
+#include "manifest.h"
+
+/*
+  Firmware update from CONFIG_OTA_BASE: version negotiation (manifest,
+  or .version files of servers without one), delta patches and full
+  images. Needs nothing of the WiFi driver but macstr() and the BOOTP
+  file name, so it builds on the host too, see host/test_ota.c.
+ */
+
+static const char *ota_base = CONFIG_OTA_BASE;
+static const char *TAG = "yaws-wifi";
+
+static const char *ota_same_version = "same";
+static const char *ota_not_found = "not_found";
+static const char *ota_url(const char *base)
+{
+        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+        static char url[OTA_URL_LEN];
+        const char *result = NULL;
+
+        snprintf(url, sizeof url, "http://%s%s.version", base, app_desc->project_name);
+        ESP_LOGI(TAG, "OTA checking %s", url);
+        esp_http_client_config_t client_config = {
+                .url = url,
+                .method = HTTP_METHOD_GET,
+        };
+        esp_http_client_handle_t client = esp_http_client_init(&client_config);
+        if (client == NULL)
+                // esp_http_client_init will log error for us
+                return NULL;
+
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+                return NULL;
+        }
+
+        int content_length = esp_http_client_fetch_headers(client);
+        if (content_length < 0) {
+                ESP_LOGE(TAG, "HTTP client fetch headers failed");
+                goto out;
+        }
+
+        int status_code = esp_http_client_get_status_code(client);
+        if (status_code == 404) {
+                ESP_LOGI(TAG, "OTA version %s not found", url);
+                result = ota_not_found;
+                goto out;
+        }
+
+        if (status_code != 200) {
+                ESP_LOGE(TAG, "OTA version %s fetch failed: status code %d", url, status_code);
+                goto out;
+        }
+
+        char version[64] = {0,};
+        esp_http_client_read_response(client, version, sizeof version - 1);
+        for (char *p = version; *p; p++) {
+                if (isspace(*p)) {
+                        *p = 0;
+                        break;
+                }
+        }
+
+        if (strlen(version) == 0) {
+                ESP_LOGE(TAG, "empty remote version");
+                goto out;
+        }
+
+        ESP_LOGI(TAG, "OTA remote version: %s, local version: %s", version, app_desc->version);
+        if (strcmp(version, app_desc->version) == 0) {
+                result = ota_same_version;
+                goto out;
+        }
+
+        snprintf(url, sizeof url, "http://%s%s.bin", base, app_desc->project_name);
+        result = url;
+out:
+        esp_http_client_cleanup(client);
+        return result;
+}
+
+#define OTA_DELTA_BUF_SIZE 1024
+
+struct ota_delta {
+        const esp_partition_t *running;
+        esp_ota_handle_t handle;
+        mbedtls_sha256_context sha;
+};
+
+static int ota_delta_read_old(void *ctx, uint32_t offset, void *buf, uint32_t len)
+{
+        struct ota_delta *o = ctx;
+        if (offset > o->running->size || len > o->running->size - offset)
+                return -1;
+        return esp_partition_read(o->running, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int ota_delta_write(void *ctx, const void *buf, uint32_t len)
+{
+        struct ota_delta *o = ctx;
+        mbedtls_sha256_update_ret(&o->sha, buf, len);
+        return esp_ota_write(o->handle, buf, len) == ESP_OK ? 0 : -1;
+}
+
+// Fetch patch from the running version to the one at url (must end with
+// ".bin") and apply it. Returns ESP_ERR_NOT_FOUND if server has no patch.
+static esp_err_t ota_delta(esp_http_client_handle_t client, const char *url)
+{
+        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+        static char delta_url[OTA_URL_LEN];
+        size_t len = strlen(url);
+
+        if (len < 4 || strcmp(url + len - 4, ".bin") != 0)
+                return ESP_ERR_NOT_FOUND;
+        if (snprintf(delta_url, sizeof delta_url, "%.*s.%s.delta",
+                     (int)len - 4, url, app_desc->version) >= sizeof delta_url)
+                return ESP_ERR_NOT_FOUND;
+
+        ESP_LOGI(TAG, "OTA checking %s", delta_url);
+        esp_http_client_set_url(client, delta_url);
+        esp_http_client_delete_header(client, "If-None-Match");
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+                return err;
+        }
+
+        struct ota_delta o = { .running = esp_ota_get_running_partition() };
+        struct delta_io io = {
+                .read_old = ota_delta_read_old,
+                .write = ota_delta_write,
+                .ctx = &o,
+        };
+        const esp_partition_t *update = NULL;
+        struct delta *d = NULL;
+        char *buf = NULL;
+
+        if (esp_http_client_fetch_headers(client) < 0) {
+                ESP_LOGE(TAG, "HTTP client fetch headers failed");
+                err = ESP_FAIL;
+                goto out;
+        }
+
+        int status_code = esp_http_client_get_status_code(client);
+        if (status_code == 404) {
+                ESP_LOGI(TAG, "OTA delta %s not found", delta_url);
+                err = ESP_ERR_NOT_FOUND;
+                goto out;
+        }
+        if (status_code != 200) {
+                ESP_LOGE(TAG, "OTA delta %s fetch failed: status code %d", delta_url, status_code);
+                err = ESP_FAIL;
+                goto out;
+        }
+
+        update = esp_ota_get_next_update_partition(NULL);
+        d = malloc(sizeof *d);
+        buf = malloc(OTA_DELTA_BUF_SIZE);
+        if (update == NULL || d == NULL || buf == NULL) {
+                err = ESP_ERR_NO_MEM;
+                goto out;
+        }
+
+        err = esp_ota_begin(update, OTA_SIZE_UNKNOWN, &o.handle);
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+                update = NULL;
+                goto out;
+        }
+
+        mbedtls_sha256_init(&o.sha);
+        mbedtls_sha256_starts_ret(&o.sha, 0);
+        delta_init(d, &io);
+
+        int n, derr = DELTA_OK;
+        while ((n = esp_http_client_read(client, buf, OTA_DELTA_BUF_SIZE)) > 0) {
+                derr = delta_feed(d, (uint8_t *)buf, n);
+                if (derr != DELTA_OK)
+                        break;
+        }
+        if (n < 0)
+                derr = DELTA_ERR_IO;
+        if (derr == DELTA_OK)
+                derr = delta_finish(d);
+
+        uint8_t sha256[32];
+        mbedtls_sha256_finish_ret(&o.sha, sha256);
+        mbedtls_sha256_free(&o.sha);
+
+        err = esp_ota_end(o.handle);
+        if (derr != DELTA_OK) {
+                ESP_LOGE(TAG, "OTA delta apply failed: %d at %u", derr, d->out);
+                err = ESP_FAIL;
+                goto out;
+        }
+        if (memcmp(sha256, delta_sha256(d), sizeof sha256) != 0) {
+                ESP_LOGE(TAG, "OTA delta SHA-256 mismatch");
+                err = ESP_ERR_INVALID_CRC;
+                goto out;
+        }
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "esp_ota_end failed: %s", esp_err_to_name(err));
+                goto out;
+        }
+
+        err = esp_ota_set_boot_partition(update);
+        if (err == ESP_OK)
+                ESP_LOGI(TAG, "OTA delta applied: %u bytes", d->size);
+out:
+        free(buf);
+        free(d);
+        return err;
+}
+
+/*
+  ETag of a manifest matching the running version is kept in RTC memory,
+  so repeated checks are answered with 304 Not Modified.
+ */
+#define OTA_MANIFEST_MAGIC 0x6d616e31
+
+static RTC_DATA_ATTR struct {
+        uint32_t magic;
+        uint32_t flags;
+        char etag[32];
+} manifest_cache;
+
+static char manifest_etag[sizeof manifest_cache.etag];
+static bool manifest_fetched;
+static uint32_t manifest_flags;
+
+static esp_err_t manifest_event_handler(esp_http_client_event_t *ev)
+{
+        if (ev->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(ev->header_key, "ETag") == 0) {
+                if (strlen(ev->header_value) < sizeof manifest_etag)
+                        strcpy(manifest_etag, ev->header_value);
+        }
+        return ESP_OK;
+}
+
+// read and discard the rest of the response, so the connection can be reused
+static void drain(esp_http_client_handle_t client)
+{
+        char buf[64];
+        while (esp_http_client_read(client, buf, sizeof buf) > 0);
+}
+
+static esp_err_t manifest_fetch(esp_http_client_handle_t client, const char *base, struct ota_manifest *m)
+{
+        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+        static char url[OTA_URL_LEN];
+        char text[512];
+
+        snprintf(url, sizeof url, "http://%s%s.manifest", base, app_desc->project_name);
+        ESP_LOGI(TAG, "OTA checking %s", url);
+        esp_http_client_set_url(client, url);
+        if (manifest_cache.magic == OTA_MANIFEST_MAGIC)
+                esp_http_client_set_header(client, "If-None-Match", manifest_cache.etag);
+        manifest_etag[0] = 0;
+
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+                return err;
+        }
+
+        if (esp_http_client_fetch_headers(client) < 0) {
+                ESP_LOGE(TAG, "HTTP client fetch headers failed");
+                return ESP_FAIL;
+        }
+
+        int status_code = esp_http_client_get_status_code(client);
+        if (status_code == 304 && manifest_cache.magic == OTA_MANIFEST_MAGIC) {
+                drain(client);
+                ESP_LOGI(TAG, "OTA manifest not modified");
+                memset(m, 0, sizeof *m);
+                strlcpy(m->version, app_desc->version, sizeof m->version);
+                m->flags = manifest_cache.flags;
+                return ESP_OK;
+        }
+
+        if (status_code == 404) {
+                drain(client);
+                ESP_LOGI(TAG, "OTA manifest %s not found", url);
+                return ESP_ERR_NOT_FOUND;
+        }
+
+        if (status_code != 200) {
+                ESP_LOGE(TAG, "OTA manifest %s fetch failed: status code %d", url, status_code);
+                return ESP_FAIL;
+        }
+
+        int len = esp_http_client_read_response(client, text, sizeof text - 1);
+        if (len < 0)
+                return ESP_FAIL;
+        text[len] = 0;
+        drain(client);
+
+        char default_url[OTA_URL_LEN];
+        snprintf(default_url, sizeof default_url, "http://%s%s.bin", base, app_desc->project_name);
+        manifest_parse(text, default_url, m);
+        if (strlen(m->version) == 0) {
+                ESP_LOGE(TAG, "empty remote version");
+                return ESP_FAIL;
+        }
+
+        // Remember only manifests that need no update: a 304 then means
+        // there is nothing to do. Otherwise the manifest must be fetched
+        // again if the update fails.
+        if (strcmp(m->version, app_desc->version) == 0 && manifest_etag[0]) {
+                strcpy(manifest_cache.etag, manifest_etag);
+                manifest_cache.flags = m->flags;
+                manifest_cache.magic = OTA_MANIFEST_MAGIC;
+        } else {
+                manifest_cache.magic = 0;
+        }
+        return ESP_OK;
+}
+
+#ifndef CONFIG_PARTITION_TABLE_TWO_OTA
+# error CONFIG_PARTITION_TABLE_TWO_OTA is required for OTA support
+#endif
+
+esp_err_t ota(char *updated)
+{
+        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+        static struct ota_manifest m;
+        const char *url = NULL;
+
+        // one client for manifest and delta, so they share a kept-alive connection
+        esp_http_client_config_t client_config = {
+                .url = "http://localhost/",
+                .method = HTTP_METHOD_GET,
+                .event_handler = manifest_event_handler,
+        };
+        esp_http_client_handle_t client = esp_http_client_init(&client_config);
+        if (client == NULL)
+                // esp_http_client_init will log error for us
+                return ESP_FAIL;
+
+#ifdef BOOTP_OTA
+        if (memcmp(bootp, "http://", 7) == 0)
+                url = bootp;
+#endif
+        if (url == NULL) {
+                esp_err_t err = manifest_fetch(client, macstr(ota_base, "/"), &m);
+                if (err == ESP_ERR_NOT_FOUND)
+                        err = manifest_fetch(client, ota_base, &m);
+                if (err == ESP_OK) {
+                        manifest_fetched = true;
+                        manifest_flags = m.flags;
+                        ESP_LOGI(TAG, "OTA remote version: %s, local version: %s", m.version, app_desc->version);
+                        url = strcmp(m.version, app_desc->version) == 0 ? ota_same_version : m.url;
+                }
+        }
+
+        // server without manifest
+        if (url == NULL)
+                url = ota_url(macstr(ota_base, "/"));
+
+        if (url == NULL || url == ota_not_found)
+                url = ota_url(ota_base);
+
+        if (url == ota_same_version || url == ota_not_found || url == NULL) {
+                esp_http_client_cleanup(client);
+                if (url == ota_same_version)
+                        return ESP_OK;
+                return url == ota_not_found ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+        }
+
+        esp_err_t ret = ota_delta(client, url);
+        esp_http_client_cleanup(client);
+        if (ret == ESP_OK) {
+                if (updated != NULL)
+                        *updated = 1;
+                ESP_LOGI(TAG, "OTA completed successfully, rebooting");
+                return ret;
+        }
+
+        ESP_LOGI(TAG, "OTA %s", url);
+        ret = esp_https_ota(&(esp_http_client_config_t){.url = url, .method = HTTP_METHOD_GET});
+        switch (ret) {
+        case ESP_OK:
+                if (updated != NULL)
+                        *updated = 1;
+                ESP_LOGI(TAG, "OTA completed successfully, rebooting");
+                break;
+        case ESP_ERR_NOT_FOUND:
+                ESP_LOGI(TAG, "Firmware not found");
+                break;
+        default:
+                ESP_LOGE(TAG, "Firmware upgrade failed");
+                break;
+        }
+        return ret;
+}
+
+char vdd_offset_calibration_requested()
+{
+        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+        static char url[OTA_URL_LEN];
+        char result = 0;
+
+        if (manifest_fetched)
+                return (manifest_flags & OTA_FLAG_VDD_OFFSET_CALIBRATION) != 0;
+
+        snprintf(url, sizeof url, "http://%s%s.vdd_offset_calibration", macstr(ota_base, "/"), app_desc->project_name);
+        ESP_LOGI(TAG, "VDD offset calibration check %s", url);
+        esp_http_client_config_t client_config = {
+                .url = url,
+                .method = HTTP_METHOD_HEAD,
+        };
+        esp_http_client_handle_t client = esp_http_client_init(&client_config);
+        if (client == NULL)
+                // esp_http_client_init will log error for us
+                return 0;
+
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+                return 0;
+        }
+
+        int content_length = esp_http_client_fetch_headers(client);
+        if (content_length < 0) {
+                ESP_LOGE(TAG, "HTTP client fetch headers failed");
+                goto out;
+        }
+
+        int status_code = esp_http_client_get_status_code(client);
+        if (status_code == 404) {
+                ESP_LOGI(TAG, "OTA version %s not found", url);
+                goto out;
+        }
+
+        if (status_code != 200) {
+                ESP_LOGE(TAG, "OTA version %s fetch failed: status code %d", url, status_code);
+                goto out;
+        }
+
+        result = 1;
+out:
+        esp_http_client_cleanup(client);
+        return result;
+}
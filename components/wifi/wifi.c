@@ -1,4 +1,6 @@
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 
 /*
@@ -11,11 +13,14 @@
      Add `#define LWIP_DHCP_BOOTP_FILE 1' to components/lwip/port/esp8266/include/lwipopts.h
  */
 
+#include <time.h>
+
+#include "esp_attr.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
-#include "esp_ota_ops.h"
-#include "esp_https_ota.h"
+#include "esp_timer.h"
+#include "lwip/dns.h"
 
 #if defined(CONFIG_IDF_TARGET_ESP32) || defined(BOOTP_OTA)
 # include "esp_netif.h"
@@ -25,27 +30,19 @@ typedef struct netif esp_netif_t;
 # endif
 #endif
 
-#ifdef BOOTP_OTA
 #include "lwip/dhcp.h"
-#endif
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 
 #include "wifi.h"
 
-static const char *ota_base = CONFIG_OTA_BASE;
 static const char *TAG = "yaws-wifi";
 
 static EventGroupHandle_t status;
 ip4_addr_t ip_addr;
 uint8_t mac_addr[6];
 
-#ifdef DHCP_BOOT_FILE_LEN
-# define OTA_URL_LEN DHCP_BOOT_FILE_LEN
-#else
-# define OTA_URL_LEN 128U
-#endif
 #ifdef BOOTP_OTA
 char bootp[OTA_URL_LEN];
 #endif
@@ -57,6 +54,29 @@ static wifi_config_t wifi_config = {
         }
 };
 
+/*
+  Fast reconnect: AP and DHCP lease of the last successful connection are
+  kept in RTC memory. Next wifi_connect() skips the scan by pinning BSSID
+  and channel and skips DHCP by reusing the address until half of the lease
+  time passes. Lease expiry is tracked with time(), so static address is
+  only used if the system clock is set. If fast connect fails, cache is
+  dropped and full scan/DHCP is performed.
+ */
+#define FAST_MAGIC 0x77a51001
+#define EPOCH_2020 1577836800
+
+static RTC_DATA_ATTR struct {
+        uint32_t magic;
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint32_t ip, gw, netmask, dns;
+        uint32_t lease_expire;  // unix time, 0 if lease is unknown
+} fast;
+
+static bool fast_attempt;
+struct wifi_timing wifi_timing;
+static int64_t connect_start, connect_assoc;
+
 static const char *wifi_disconnect_reason(int r) {
         static char buf[20];
         switch (r) {
@@ -111,6 +131,47 @@ static void on_wifi_disconnect(void *arg, esp_event_base_t event_base,
         xEventGroupSetBits(status, BIT(2));
 }
 
+static void on_wifi_connected(void *arg, esp_event_base_t event_base,
+                              int32_t event_id, void *event_data)
+{
+        system_event_sta_connected_t *event = event_data;
+        connect_assoc = esp_timer_get_time();
+        memcpy(fast.bssid, event->bssid, sizeof fast.bssid);
+        fast.channel = event->channel;
+}
+
+static struct netif *sta_netif()
+{
+        void *nif = NULL;
+#if defined(CONFIG_IDF_TARGET_ESP32)
+        nif = esp_netif_get_netif_impl(netif);
+#else
+        tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, &nif);
+#endif
+        return nif;
+}
+
+static void fast_save(const ip_event_got_ip_t *event)
+{
+        struct netif *nif = sta_netif();
+        struct dhcp *dhcp = nif ? netif_dhcp_data(nif) : NULL;
+        time_t now = time(NULL);
+
+        if (dhcp != NULL && dhcp->state == DHCP_STATE_BOUND) {
+                // renew lease at T1 (half of the lease time), as DHCP client would do
+                fast.lease_expire = now > EPOCH_2020 ? now + dhcp->offered_t0_lease / 2 : 0;
+        } else if (!fast_attempt) {
+                fast.lease_expire = 0;
+        }
+
+        fast.ip = event->ip_info.ip.addr;
+        fast.gw = event->ip_info.gw.addr;
+        fast.netmask = event->ip_info.netmask.addr;
+        const ip_addr_t *dns = dns_getserver(0);
+        fast.dns = dns ? ip_addr_get_ip4_u32(dns) : 0;
+        fast.magic = FAST_MAGIC;
+}
+
 static void on_got_ip(void *arg, esp_event_base_t event_base,
                       int32_t event_id, void *event_data)
 {
@@ -119,6 +180,7 @@ static void on_got_ip(void *arg, esp_event_base_t event_base,
         if (event->esp_netif != netif)
                 return;
 #endif
+        fast_save(event);
         memcpy(&ip_addr, &event->ip_info.ip, sizeof(ip_addr));
         ESP_ERROR_CHECK(esp_wifi_get_mac(ESP_IF_WIFI_STA, mac_addr));
 
@@ -137,171 +199,44 @@ static void on_shutdown()
 }
 #endif
 
-static const char *ota_same_version = "same";
-static const char *ota_not_found = "not_found";
-static const char *ota_url(const char *base)
-{
-        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
-        static char url[OTA_URL_LEN];
-        const char *result = NULL;
-
-        snprintf(url, sizeof url, "http://%s%s.version", base, app_desc->project_name);
-        ESP_LOGI(TAG, "OTA checking %s", url);
-        esp_http_client_config_t client_config = {
-                .url = url,
-                .method = HTTP_METHOD_GET,
-        };
-        esp_http_client_handle_t client = esp_http_client_init(&client_config);
-        if (client == NULL)
-                // esp_http_client_init will log error for us
-                return NULL;
-
-        esp_err_t err = esp_http_client_open(client, 0);
-        if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-                return NULL;
-        }
-
-        int content_length = esp_http_client_fetch_headers(client);
-        if (content_length < 0) {
-                ESP_LOGE(TAG, "HTTP client fetch headers failed");
-                goto out;
-        }
-
-        int status_code = esp_http_client_get_status_code(client);
-        if (status_code == 404) {
-                ESP_LOGI(TAG, "OTA version %s not found", url);
-                result = ota_not_found;
-                goto out;
-        }
-
-        if (status_code != 200) {
-                ESP_LOGE(TAG, "OTA version %s fetch failed: status code %d", url, status_code);
-                goto out;
-        }
-
-        char version[64] = {0,};
-        esp_http_client_read_response(client, version, sizeof version - 1);
-        for (char *p = version; *p; p++) {
-                if (isspace(*p)) {
-                        *p = 0;
-                        break;
-                }
-        }
-
-        if (strlen(version) == 0) {
-                ESP_LOGE(TAG, "empty remote version");
-                goto out;
-        }
-
-        ESP_LOGI(TAG, "OTA remote version: %s, local version: %s", version, app_desc->version);
-        if (strcmp(version, app_desc->version) == 0) {
-                result = ota_same_version;
-                goto out;
-        }
-
-        snprintf(url, sizeof url, "http://%s%s.bin", base, app_desc->project_name);
-        result = url;
-out:
-        esp_http_client_cleanup(client);
-        return result;
-}
-
-#ifndef CONFIG_PARTITION_TABLE_TWO_OTA
-# error CONFIG_PARTITION_TABLE_TWO_OTA is required for OTA support
-#endif
-
-esp_err_t ota(char *updated)
+static bool fast_lease_valid()
 {
-        const char *url = NULL;
-
-#ifdef BOOTP_OTA
-        if (memcmp(bootp, "http://", 7) == 0)
-                url = bootp;
-#endif
-        if (url == NULL)
-                url = ota_url(macstr(ota_base, "/"));
-
-        if (url == NULL || url == ota_not_found)
-                url = ota_url(ota_base);
-
-        if (url == ota_same_version)
-                return ESP_OK;
-
-        if (url == ota_not_found)
-                return ESP_ERR_NOT_FOUND;
-
-        if (url == NULL)
-                return ESP_FAIL;
-
-        ESP_LOGI(TAG, "OTA %s", url);
-        esp_err_t ret = esp_https_ota(&(esp_http_client_config_t){.url = url, .method = HTTP_METHOD_GET});
-        switch (ret) {
-        case ESP_OK:
-                if (updated != NULL)
-                        *updated = 1;
-                ESP_LOGI(TAG, "OTA completed successfully, rebooting");
-                break;
-        case ESP_ERR_NOT_FOUND:
-                ESP_LOGI(TAG, "Firmware not found");
-                break;
-        default:
-                ESP_LOGE(TAG, "Firmware upgrade failed");
-                break;
-        }
-        return ret;
+        time_t now = time(NULL);
+        return fast.lease_expire != 0 && now > EPOCH_2020 && now < fast.lease_expire;
 }
 
-char vdd_offset_calibration_requested()
+static void set_static_ip()
 {
-        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
-        static char url[OTA_URL_LEN];
-        char result = 0;
-
-        snprintf(url, sizeof url, "http://%s%s.vdd_offset_calibration", macstr(ota_base, "/"), app_desc->project_name);
-        ESP_LOGI(TAG, "VDD offset calibration check %s", url);
-        esp_http_client_config_t client_config = {
-                .url = url,
-                .method = HTTP_METHOD_HEAD,
+#if defined(CONFIG_IDF_TARGET_ESP32)
+        esp_netif_ip_info_t info = {
+                .ip.addr = fast.ip,
+                .gw.addr = fast.gw,
+                .netmask.addr = fast.netmask,
         };
-        esp_http_client_handle_t client = esp_http_client_init(&client_config);
-        if (client == NULL)
-                // esp_http_client_init will log error for us
-                return 0;
-
-        esp_err_t err = esp_http_client_open(client, 0);
-        if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-                return 0;
-        }
-
-        int content_length = esp_http_client_fetch_headers(client);
-        if (content_length < 0) {
-                ESP_LOGE(TAG, "HTTP client fetch headers failed");
-                goto out;
-        }
-
-        int status_code = esp_http_client_get_status_code(client);
-        if (status_code == 404) {
-                ESP_LOGI(TAG, "OTA version %s not found", url);
-                goto out;
-        }
+        esp_netif_dhcpc_stop(netif);
+        esp_err_t err = esp_netif_set_ip_info(netif, &info);
+#else
+        tcpip_adapter_ip_info_t info = {
+                .ip.addr = fast.ip,
+                .gw.addr = fast.gw,
+                .netmask.addr = fast.netmask,
+        };
+        tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+        esp_err_t err = tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &info);
+#endif
+        if (err != ESP_OK)
+                ESP_LOGE(TAG, "set static ip: %s", esp_err_to_name(err));
 
-        if (status_code != 200) {
-                ESP_LOGE(TAG, "OTA version %s fetch failed: status code %d", url, status_code);
-                goto out;
+        if (fast.dns != 0) {
+                ip_addr_t dns;
+                ip_addr_set_ip4_u32(&dns, fast.dns);
+                dns_setserver(0, &dns);
         }
-
-        result = 1;
-out:
-        esp_http_client_cleanup(client);
-        return result;
 }
 
-esp_err_t wifi_connect(void)
+static esp_err_t wifi_connect_once(bool use_cache)
 {
-        if (status != NULL)
-                return ESP_ERR_INVALID_STATE;
+        int64_t start = esp_timer_get_time();
 #if defined(CONFIG_IDF_TARGET_ESP32)
         ESP_ERROR_CHECK(esp_register_shutdown_handler(&on_shutdown));
 #endif
@@ -315,9 +250,16 @@ esp_err_t wifi_connect(void)
         netif = esp_netif_create_default_wifi_sta();
 #endif
 
+        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &on_wifi_connected, NULL));
         ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect, NULL));
         ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip, NULL));
 
+        fast_attempt = use_cache;
+        wifi_config.sta.bssid_set = use_cache;
+        wifi_config.sta.channel = use_cache ? fast.channel : 0;
+        if (use_cache)
+                memcpy(wifi_config.sta.bssid, fast.bssid, sizeof fast.bssid);
+
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
         ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
         ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B));
@@ -326,14 +268,54 @@ esp_err_t wifi_connect(void)
 #if defined(CONFIG_IDF_TARGET_ESP8266) && defined(BOOTP_OTA)
         ESP_ERROR_CHECK(tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void **)&netif)); // must be called after esp_wifi_start()
 #endif
+        if (use_cache && fast_lease_valid())
+                set_static_ip();
+#if defined(CONFIG_IDF_TARGET_ESP8266)
+        else
+                tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA); // might be stopped by failed fast attempt
+#endif
+
+        int64_t started = esp_timer_get_time();
+        connect_assoc = 0;
         esp_err_t err = esp_wifi_connect();
         if (err != ESP_OK)
                 return err;
 
-        EventBits_t bits = xEventGroupWaitBits(status, BIT(1)|BIT(2), false, false, 10 * configTICK_RATE_HZ);
+        // pinned AP either answers right away or is gone
+        TickType_t timeout = (use_cache ? 3 : 10) * configTICK_RATE_HZ;
+        EventBits_t bits = xEventGroupWaitBits(status, BIT(1)|BIT(2), false, false, timeout);
         if ((bits & BIT(1)) == 0)
                 return ESP_ERR_WIFI_NOT_CONNECT;
 
+        int64_t now = esp_timer_get_time();
+        wifi_timing.init_ms = (started - start) / 1000;
+        wifi_timing.assoc_ms = (connect_assoc - started) / 1000;
+        wifi_timing.ip_ms = (now - connect_assoc) / 1000;
+        wifi_timing.fast = use_cache;
+        return ESP_OK;
+}
+
+esp_err_t wifi_connect(void)
+{
+        if (status != NULL)
+                return ESP_ERR_INVALID_STATE;
+
+        int64_t start = esp_timer_get_time();
+        bool use_cache = fast.magic == FAST_MAGIC;
+        esp_err_t err = wifi_connect_once(use_cache);
+        if (err != ESP_OK && use_cache) {
+                ESP_LOGI(TAG, "fast connect failed, falling back to full scan");
+                fast.magic = 0;
+                wifi_disconnect();
+                err = wifi_connect_once(false);
+        }
+        if (err != ESP_OK)
+                return err;
+
+        wifi_timing.total_ms = (esp_timer_get_time() - start) / 1000;
+        ESP_LOGI(TAG, "connected in %u ms%s: init %u ms, association %u ms, ip %u ms",
+                 wifi_timing.total_ms, wifi_timing.fast ? " (fast)" : "",
+                 wifi_timing.init_ms, wifi_timing.assoc_ms, wifi_timing.ip_ms);
         return ESP_OK;
 }
 
@@ -353,6 +335,7 @@ esp_err_t wifi_disconnect(void)
 #if defined(CONFIG_IDF_TARGET_ESP32)
         ESP_ERROR_CHECK(esp_unregister_shutdown_handler(&on_shutdown));
 #endif
+        ESP_ERROR_CHECK(esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &on_wifi_connected));
         ESP_ERROR_CHECK(esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect));
         ESP_ERROR_CHECK(esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip));
         esp_err_t err = esp_wifi_stop();
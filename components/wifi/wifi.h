@@ -1,12 +1,31 @@
 #pragma once
 
 #include "lwip/dhcp.h"
+
+#ifdef DHCP_BOOT_FILE_LEN
+# define OTA_URL_LEN DHCP_BOOT_FILE_LEN
+#else
+# define OTA_URL_LEN 128U
+#endif
+
 extern ip4_addr_t ip_addr;
 extern uint8_t mac_addr[6];
 extern char bootp[DHCP_BOOT_FILE_LEN];
+
+struct wifi_timing {
+        uint32_t init_ms;       // driver init and start
+        uint32_t assoc_ms;      // scan, authentication and association
+        uint32_t ip_ms;         // DHCP or cached address setup
+        uint32_t total_ms;      // including failed fast connect attempt, if any
+        bool fast;              // cached AP and address were used
+};
+// phases of the last successful wifi_connect()
+extern struct wifi_timing wifi_timing;
+
 esp_err_t wifi_connect(void);
 esp_err_t wifi_disconnect(void);
 int wifi_connected(void);
 char *macstr(const char *prefix, const char *suffix);
 esp_err_t ota(char *updated);
+// answered from the manifest fetched by ota(), if there was one
 char vdd_offset_calibration_requested();
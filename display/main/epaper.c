@@ -1,7 +1,11 @@
+#include <string.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include <esp32/rom/ets_sys.h>
+#include <esp32/rom/crc.h>
 
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
@@ -39,6 +43,9 @@ enum EPAPER_CMD {
         EPAPER_AUTO_MEASURE_VCOM = 0x80,
         EPAPER_READ_VCOM_VALUE = 0x81,
         EPAPER_VCM_DC_SETTING = 0x82,
+        EPAPER_PARTIAL_WINDOW = 0x90,
+        EPAPER_PARTIAL_IN = 0x91,
+        EPAPER_PARTIAL_OUT = 0x92,
 };
 
 typedef struct epaper_dev *epaper_handle_t; /*handle of epaper*/
@@ -51,12 +58,33 @@ static const char* TAG = "epaper";
 #define EPAPER_QUE_SIZE_DEFAULT 10
 #define EPAPER_WIDTH		800
 #define EPAPER_HEIGHT		480
+#define EPAPER_CHUNK            2048    // size of each of two DMA buffers
+#define EPAPER_BAND_ROWS        (EPAPER_HEIGHT / EPAPER_BANDS)
+#define EPAPER_BAND_SIZE        (EPAPER_WIDTH / 8 * EPAPER_BAND_ROWS)
+
+#ifndef CONFIG_DISPLAY_FULL_REFRESH_EVERY
+# define CONFIG_DISPLAY_FULL_REFRESH_EVERY 16
+#endif
 
 
 typedef struct epaper_dev {
     spi_device_handle_t bus;
     epaper_conf_t pin;
     SemaphoreHandle_t spi_mux;
+
+    // streaming: one buffer is filled while the other is sent by DMA
+    uint8_t *buf[2];
+    spi_transaction_t tx[2];
+    bool queued[2];
+    int cur, fill;
+
+    // partial update: only bands with changed CRC are sent and refreshed
+    struct epaper_state *state;
+    bool partial;
+    uint8_t *band;
+    int band_fill, nband;
+    uint32_t crc[EPAPER_BANDS];
+    int changed_first, changed_last;
 } epaper_dev_t;
 
 static void send_command(epaper_dev_t *dev, uint8_t command)
@@ -89,6 +117,33 @@ static void send_data(epaper_handle_t dev, const uint8_t *data, int length)
         }
 }
 
+// wait until DMA is done with buffer i
+static void stream_wait(epaper_handle_t dev, int i)
+{
+        spi_transaction_t *done;
+        if (!dev->queued[i])
+                return;
+        ESP_ERROR_CHECK(spi_device_get_trans_result(dev->bus, &done, portMAX_DELAY));
+        assert(done == &dev->tx[i]);
+        dev->queued[i] = false;
+}
+
+static void stream_queue(epaper_handle_t dev)
+{
+        int i = dev->cur;
+        if (dev->fill == 0)
+                return;
+        dev->tx[i] = (spi_transaction_t){
+                .length = dev->fill * 8,                    // length is in bits
+                .tx_buffer = dev->buf[i],
+        };
+        ESP_ERROR_CHECK(spi_device_queue_trans(dev->bus, &dev->tx[i], portMAX_DELAY));
+        dev->queued[i] = true;
+        dev->cur ^= 1;
+        dev->fill = 0;
+        stream_wait(dev, dev->cur);
+}
+
 static void send_byte(epaper_handle_t dev, const uint8_t data)
 {
         send_data(dev, &data, 1);
@@ -191,6 +246,9 @@ static void epaper_epd_init(epaper_handle_t dev)
 epaper_handle_t epaper_create(epaper_conf_t epconf)
 {
         epaper_dev_t* dev = calloc(1, sizeof *dev);
+        for (int i = 0; i < 2; i++)
+                dev->buf[i] = heap_caps_malloc(EPAPER_CHUNK, MALLOC_CAP_DMA);
+        dev->band = malloc(EPAPER_BAND_SIZE);
         dev->spi_mux = xSemaphoreCreateRecursiveMutex();
         dev->pin = epconf;
         epaper_gpio_init(&dev->pin);
@@ -205,15 +263,144 @@ esp_err_t epaper_delete(epaper_handle_t dev)
         spi_bus_remove_device(dev->bus);
         spi_bus_free(dev->pin.spi_host);
         vSemaphoreDelete(dev->spi_mux);
+        for (int i = 0; i < 2; i++)
+                heap_caps_free(dev->buf[i]);
+        free(dev->band);
         free(dev);
         return ESP_OK;
 }
 
-void epaper_display(epaper_handle_t dev, const uint8_t *data)
+static void stream_data(epaper_handle_t dev, const uint8_t *data, int length)
 {
+        while (length > 0) {
+                int n = EPAPER_CHUNK - dev->fill;
+                if (n > length)
+                        n = length;
+                memcpy(dev->buf[dev->cur] + dev->fill, data, n);
+                dev->fill += n;
+                data += n;
+                length -= n;
+                if (dev->fill == EPAPER_CHUNK)
+                        stream_queue(dev);
+        }
+}
+
+// all queued data must be sent before the next command
+static void stream_flush(epaper_handle_t dev)
+{
+        stream_queue(dev);
+        stream_wait(dev, 0);
+        stream_wait(dev, 1);
+}
+
+static void partial_window(epaper_handle_t dev, int first_band, int last_band)
+{
+        const uint16_t y0 = first_band * EPAPER_BAND_ROWS;
+        const uint16_t y1 = (last_band + 1) * EPAPER_BAND_ROWS - 1;
+        const uint16_t x1 = EPAPER_WIDTH - 1;   // low 3 bits of horizontal end must be set
+
+        send_command(dev, EPAPER_PARTIAL_WINDOW);
+        const uint8_t window[] = {0, 0, x1 >> 8, x1 & 0xff, y0 >> 8, y0 & 0xff, y1 >> 8, y1 & 0xff,
+                                  0x01};        // gates scan both inside and outside of the window
+        send_data(dev, window, sizeof window);
+}
+
+static void band_done(epaper_handle_t dev)
+{
+        int b = dev->nband++;
+
+        if (!dev->partial || dev->crc[b] == dev->state->crc[b])
+                return;
+
+        // window only covers this band: controller RAM keeps the rest of
+        // previous frame, so unchanged bands need not be sent
+        send_command(dev, EPAPER_PARTIAL_IN);
+        partial_window(dev, b, b);
         send_command(dev, EPAPER_DISPLAY_START_TRANSMISSION_2);
-        send_data(dev, data, EPAPER_WIDTH * EPAPER_HEIGHT / 8);
-        send_command(dev, EPAPER_DISPLAY_REFRESH);
+        gpio_set_level(dev->pin.dc_pin, 1);
+        stream_data(dev, dev->band, EPAPER_BAND_SIZE);
+        stream_flush(dev);
+        send_command(dev, EPAPER_PARTIAL_OUT);
+
+        if (dev->changed_first < 0)
+                dev->changed_first = b;
+        dev->changed_last = b;
+}
+
+void epaper_stream_begin(epaper_handle_t dev, struct epaper_state *state)
+{
+        xSemaphoreTakeRecursive(dev->spi_mux, portMAX_DELAY);
+        dev->state = state;
+        dev->partial = state != NULL && state->valid &&
+                state->partial < CONFIG_DISPLAY_FULL_REFRESH_EVERY - 1;
+        dev->nband = dev->band_fill = 0;
+        dev->changed_first = dev->changed_last = -1;
+        for (int i = 0; i < EPAPER_BANDS; i++)
+                dev->crc[i] = 0;
+        dev->cur = dev->fill = 0;
+        if (!dev->partial) {
+                send_command(dev, EPAPER_DISPLAY_START_TRANSMISSION_2);
+                gpio_set_level(dev->pin.dc_pin, 1);
+        }
+}
+
+void epaper_stream_write(epaper_handle_t dev, const uint8_t *data, int length)
+{
+        while (length > 0 && dev->nband < EPAPER_BANDS) {
+                int n = EPAPER_BAND_SIZE - dev->band_fill;
+                if (n > length)
+                        n = length;
+                dev->crc[dev->nband] = crc32_le(dev->crc[dev->nband], data, n);
+                if (dev->partial)
+                        memcpy(dev->band + dev->band_fill, data, n);
+                else
+                        stream_data(dev, data, n);
+                dev->band_fill += n;
+                data += n;
+                length -= n;
+                if (dev->band_fill == EPAPER_BAND_SIZE) {
+                        dev->band_fill = 0;
+                        band_done(dev);
+                }
+        }
+}
+
+void epaper_stream_end(epaper_handle_t dev, bool refresh)
+{
+        stream_flush(dev);
+        refresh = refresh && dev->nband == EPAPER_BANDS;
+
+        if (refresh && !dev->partial) {
+                send_command(dev, EPAPER_DISPLAY_REFRESH);
+        } else if (refresh && dev->changed_first >= 0) {
+                ESP_LOGI(TAG, "partial refresh of bands %d-%d", dev->changed_first, dev->changed_last);
+                send_command(dev, EPAPER_PARTIAL_IN);
+                partial_window(dev, dev->changed_first, dev->changed_last);
+                send_command(dev, EPAPER_DISPLAY_REFRESH);
+                send_command(dev, EPAPER_PARTIAL_OUT);
+        }
+
+        if (dev->state != NULL) {
+                if (refresh) {
+                        memcpy(dev->state->crc, dev->crc, sizeof dev->crc);
+                        dev->state->valid = true;
+                        if (!dev->partial)
+                                dev->state->partial = 0;
+                        else if (dev->changed_first >= 0)
+                                dev->state->partial++;
+                } else if (!dev->partial || dev->changed_first >= 0) {
+                        // controller RAM holds part of a frame that was never shown
+                        dev->state->valid = false;
+                }
+        }
+        xSemaphoreGiveRecursive(dev->spi_mux);
+}
+
+void epaper_display(epaper_handle_t dev, const uint8_t *data)
+{
+        epaper_stream_begin(dev, NULL);
+        epaper_stream_write(dev, data, EPAPER_WIDTH * EPAPER_HEIGHT / 8);
+        epaper_stream_end(dev, true);
 }
 
 void epaper_sleep(epaper_handle_t dev)
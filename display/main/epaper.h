@@ -19,4 +19,22 @@ void epaper_reset(epaper_handle_t dev);
 epaper_handle_t epaper_create(epaper_conf_t epconf);
 esp_err_t epaper_delete(epaper_handle_t dev);
 void epaper_display(epaper_handle_t dev, const uint8_t *data);
+#define EPAPER_BANDS 30     // of 16 rows each
+
+// What is on the panel, kept by the caller across deep sleep (zeroed state
+// means unknown). Bands with unchanged CRC are neither sent nor refreshed.
+struct epaper_state {
+        uint32_t crc[EPAPER_BANDS];
+        uint16_t partial;       // partial refreshes since the last full one
+        bool valid;
+};
+
+// Send a frame in pieces of any size: network reads overlap with DMA
+// transfer of the previous piece. Without refresh the panel keeps showing
+// the old picture, e.g. if download failed half way.
+// With state, only changed bands are refreshed, except for every
+// CONFIG_DISPLAY_FULL_REFRESH_EVERY-th update which clears ghosting.
+void epaper_stream_begin(epaper_handle_t dev, struct epaper_state *state);
+void epaper_stream_write(epaper_handle_t dev, const uint8_t *data, int length);
+void epaper_stream_end(epaper_handle_t dev, bool refresh);
 void epaper_sleep(epaper_handle_t dev);
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "frame.h"
+
+enum {
+        STATE_HEADER,
+        STATE_CONTROL,
+        STATE_LITERAL,
+        STATE_RUN,
+};
+
+uint32_t frame_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+        static const uint32_t table[16] = {
+                0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+                0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+        };
+
+        crc = ~crc;
+        while (len--) {
+                crc ^= *data++;
+                crc = (crc >> 4) ^ table[crc & 15];
+                crc = (crc >> 4) ^ table[crc & 15];
+        }
+        return ~crc;
+}
+
+void frame_init(struct frame_decoder *d, int width, int height,
+                void (*write)(void *ctx, const uint8_t *data, int len), void *ctx)
+{
+        memset(d, 0, sizeof *d);
+        d->write = write;
+        d->ctx = ctx;
+        d->size = width * height / 8;
+        d->header[4] = width & 0xff;
+        d->header[5] = width >> 8;
+        d->header[6] = height & 0xff;
+        d->header[7] = height >> 8;
+        d->state = STATE_HEADER;
+}
+
+static void flush(struct frame_decoder *d)
+{
+        if (d->fill == 0)
+                return;
+        d->crc = frame_crc32(d->crc, d->buf, d->fill);
+        d->write(d->ctx, d->buf, d->fill);
+        d->fill = 0;
+}
+
+static int put(struct frame_decoder *d, uint8_t c)
+{
+        if (d->out == d->size)
+                return FRAME_ERR_SIZE;
+        d->out++;
+        d->buf[d->fill++] = c;
+        if (d->fill == sizeof d->buf)
+                flush(d);
+        return FRAME_OK;
+}
+
+int frame_feed(struct frame_decoder *d, const uint8_t *data, int len)
+{
+        int err = FRAME_OK;
+
+        for (const uint8_t *end = data + len; data < end && err == FRAME_OK; data++) {
+                switch (d->state) {
+                case STATE_HEADER:
+                        // width and height were stored by frame_init, must match
+                        if (d->count >= 4 && d->count < 8 && d->header[d->count] != *data)
+                                return FRAME_ERR_FORMAT;
+                        d->header[d->count++] = *data;
+                        if (d->count < FRAME_HEADER_SIZE)
+                                break;
+                        if (!frame_is_compressed(d->header, FRAME_HEADER_SIZE) || d->header[8] != FRAME_PACKBITS)
+                                return FRAME_ERR_FORMAT;
+                        d->state = STATE_CONTROL;
+                        break;
+                case STATE_CONTROL:
+                        if (*data < 128) {
+                                d->count = *data + 1;
+                                d->state = STATE_LITERAL;
+                        } else if (*data > 128) {
+                                d->count = 257 - *data;
+                                d->state = STATE_RUN;
+                        }
+                        break;
+                case STATE_LITERAL:
+                        err = put(d, *data);
+                        if (--d->count == 0)
+                                d->state = STATE_CONTROL;
+                        break;
+                case STATE_RUN:
+                        for (; d->count > 0 && err == FRAME_OK; d->count--)
+                                err = put(d, *data);
+                        d->state = STATE_CONTROL;
+                        break;
+                }
+        }
+        return err;
+}
+
+int frame_finish(struct frame_decoder *d)
+{
+        flush(d);
+        if (d->state != STATE_CONTROL)
+                return d->state == STATE_HEADER ? FRAME_ERR_FORMAT : FRAME_ERR_SIZE;
+        if (d->out != d->size)
+                return FRAME_ERR_SIZE;
+        uint32_t crc = d->header[12] | d->header[13] << 8 | d->header[14] << 16 | (uint32_t)d->header[15] << 24;
+        return crc == d->crc ? FRAME_OK : FRAME_ERR_CRC;
+}
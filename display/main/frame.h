@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+
+/*
+  Compressed 1-bpp frame, as served instead of the raw bitmap:
+
+    header:  "YFR1"  uint16 width  uint16 height  uint8 encoding  uint8[3] 0
+             uint32 CRC-32 of the decoded bitmap         (little endian)
+    body:    PackBits: control byte n followed by
+               n = 0..127     n + 1 literal bytes
+               n = 129..255   one byte repeated 257 - n times
+               n = 128        no-op
+
+  Frames are built by tools/yaws-frame.c.
+ */
+
+#define FRAME_MAGIC "YFR1"
+#define FRAME_HEADER_SIZE 16
+#define FRAME_PACKBITS 1
+
+enum {
+        FRAME_OK = 0,
+        FRAME_ERR_FORMAT = -1,  // bad header or encoding
+        FRAME_ERR_SIZE = -2,    // decoded size differs from width * height / 8
+        FRAME_ERR_CRC = -3,
+};
+
+struct frame_decoder {
+        void (*write)(void *ctx, const uint8_t *data, int len);
+        void *ctx;
+        uint32_t size;          // expected bitmap size
+        uint32_t out;           // bytes decoded so far
+        uint32_t crc;
+        uint8_t header[FRAME_HEADER_SIZE];
+        uint8_t state, run_byte;
+        int count;              // header bytes received or bytes left in the current run
+        uint8_t buf[128];       // decoded bytes are passed to write in batches
+        int fill;
+};
+
+static inline int frame_is_compressed(const uint8_t *data, int len)
+{
+        return len >= 4 && data[0] == 'Y' && data[1] == 'F' && data[2] == 'R' && data[3] == '1';
+}
+
+uint32_t frame_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+// width and height are what the caller can display; other frames are rejected
+void frame_init(struct frame_decoder *d, int width, int height,
+                void (*write)(void *ctx, const uint8_t *data, int len), void *ctx);
+int frame_feed(struct frame_decoder *d, const uint8_t *data, int len);
+// flush decoded data and check size and CRC
+int frame_finish(struct frame_decoder *d);
@@ -20,6 +20,8 @@
 #include "graphite.h"
 #include "wifi.h"
 #include "epaper.h"
+#include "frame.h"
+#include "wake.h"
 
 static const char *TAG = "undefined";
 
@@ -93,29 +95,60 @@ static void vdd_offset_calibrate()
 	}
 }
 
+#define FRAME_WIDTH 800
+#define FRAME_HEIGHT 480
+#define FRAME_SIZE (FRAME_WIDTH * FRAME_HEIGHT / 8)
+
 char RTC_DATA_ATTR saved_etag[16] = {0};
+static RTC_DATA_ATTR struct epaper_state panel;
 
 static esp_err_t event_handler(esp_http_client_event_t *ev)
 {
         if (ev->event_id == HTTP_EVENT_ON_HEADER)
                 if (strcmp(ev->header_key, "ETag") == 0)
-                        strlcpy(saved_etag, ev->header_value, 16);
+                        strlcpy(ev->user_data, ev->header_value, sizeof saved_etag);
         return ESP_OK;
 }
 
-uint8_t *get(const char *url, unsigned *len)
+static epaper_handle_t epaper_open()
+{
+        epaper_conf_t epconf = {
+                .reset_pin = GPIO_NUM_26,
+                .dc_pin = GPIO_NUM_27,
+                .cs_pin = GPIO_NUM_15,
+                .busy_pin = GPIO_NUM_25,
+                .mosi_pin = GPIO_NUM_14,
+                .sck_pin = GPIO_NUM_13,
+
+                .clk_freq_hz = SPI_MASTER_FREQ_20M,
+                .spi_host = HSPI_HOST,
+        };
+
+        return epaper_create(epconf);
+}
+
+static void frame_write(void *ctx, const uint8_t *data, int len)
 {
-        uint8_t *buffer = NULL;
-        int content_length;
-        char *etag = NULL;
+        epaper_stream_write(ctx, data, len);
+}
+
+// Fetch the picture and stream it to the panel as it arrives: SPI DMA of
+// one piece overlaps with reading the next one, and no frame buffer is needed.
+static void display(const char *url)
+{
+        static uint8_t buf[1024];
+        char etag[sizeof saved_etag] = {0};
+        unsigned len = 0;
 
         esp_http_client_config_t config = {
                 .url = url,
                 .method = HTTP_METHOD_GET,
                 .event_handler = event_handler,
-                .user_data = &etag,
+                .user_data = etag,
         };
         esp_http_client_handle_t client = esp_http_client_init(&config);
+        if (client == NULL)
+                return;
 
         if (*saved_etag) {
                 ESP_LOGD(TAG, "ETag: %s", saved_etag);
@@ -127,12 +160,11 @@ uint8_t *get(const char *url, unsigned *len)
                 ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
                 goto out;
         }
-        content_length = esp_http_client_fetch_headers(client);
+        int content_length = esp_http_client_fetch_headers(client);
         if (content_length < 0) {
                 ESP_LOGE(TAG, "HTTP client fetch headers failed");
                 goto out;
         }
-        *len = content_length;
 
         int code = esp_http_client_get_status_code(client);
         if (code != HttpStatus_Ok) {
@@ -140,60 +172,122 @@ uint8_t *get(const char *url, unsigned *len)
                 goto out;
         }
 
-        if (content_length == 0)
+        // compressed frame is recognized by its header, anything else must be a raw bitmap
+        int n = esp_http_client_read(client, (char *)buf, sizeof buf);
+        bool compressed = n > 0 && frame_is_compressed(buf, n);
+        if (!compressed && content_length != FRAME_SIZE) {
+                ESP_LOGE(TAG, "Invalid bitmap size; got %d, want %d", content_length, FRAME_SIZE);
                 goto out;
+        }
 
-        buffer = malloc(content_length);
-        if (buffer == NULL) {
-                ESP_LOGE(TAG, "Failed to allocate picture buffer");
-                goto out;
+        static struct frame_decoder decoder;
+        int ferr = FRAME_OK;
+        epaper_handle_t ep = epaper_open();
+        epaper_stream_begin(ep, &panel);
+        if (compressed)
+                frame_init(&decoder, FRAME_WIDTH, FRAME_HEIGHT, frame_write, ep);
+        for (; n > 0; n = esp_http_client_read(client, (char *)buf, sizeof buf)) {
+                len += n;
+                if (compressed) {
+                        ferr = frame_feed(&decoder, buf, n);
+                        if (ferr != FRAME_OK)
+                                break;
+                } else {
+                        epaper_stream_write(ep, buf, n);
+                        if (len >= FRAME_SIZE)
+                                break;
+                }
         }
+        if (compressed && ferr == FRAME_OK)
+                ferr = frame_finish(&decoder);
+        bool ok = compressed ? ferr == FRAME_OK : len == FRAME_SIZE;
+        // incomplete frame is never shown: the panel keeps the old picture
+        epaper_stream_end(ep, ok);
+        epaper_delete(ep);
 
-        int data_read = esp_http_client_read_response(client, (char *)buffer, content_length);
-        if (data_read != content_length) {
-                ESP_LOGE(TAG, "Failed to read response");
-                free(buffer);
-                buffer = NULL;
+        if (!ok) {
+                if (compressed)
+                        ESP_LOGE(TAG, "Failed to decode frame: error %d after %u bytes", ferr, len);
+                else
+                        ESP_LOGE(TAG, "Failed to read response: got %u of %d bytes", len, FRAME_SIZE);
                 goto out;
         }
 
-        ESP_LOGI(TAG, "GET %s fetched %d bytes", url, *len);
-out:    esp_http_client_close(client);
-        return buffer;
+        // remember ETag only once the picture is on the panel
+        strlcpy(saved_etag, etag, sizeof saved_etag);
+        ESP_LOGI(TAG, "GET %s displayed %u bytes%s", url, len, compressed ? " (compressed)" : "");
+out:    esp_http_client_cleanup(client);
 }
 
+volatile int RTC_DATA_ATTR ota_disabled;
+volatile char RTC_DATA_ATTR last_err[32];
 
-void display(const uint8_t *data, unsigned size)
+// VDD is read on ADC1, which doesn't mind the radio, while WiFi associates
+static esp_err_t job_vdd()
 {
-        const unsigned ep_size = 800 * 480 / 8;
-        if (size != ep_size) {
-                ESP_LOGE(TAG, "Invalid bitmap size; got %d, want %d", size, ep_size);
-                return;
-        }
+        vdd_read();
+        return ESP_OK;
+}
 
-        epaper_conf_t epconf = {
-                .reset_pin = GPIO_NUM_26,
-                .dc_pin = GPIO_NUM_27,
-                .cs_pin = GPIO_NUM_15,
-                .busy_pin = GPIO_NUM_25,
-                .mosi_pin = GPIO_NUM_14,
-                .sck_pin = GPIO_NUM_13,
+static esp_err_t job_wifi()
+{
+        return wifi_connect();
+}
 
-                .clk_freq_hz = SPI_MASTER_FREQ_20M,
-                .spi_host = HSPI_HOST,
-        };
+// OTA source is checked only once after boot to save power.
+// If you want to force OTA: do a power cycle (reset is not enough).
+static esp_err_t job_ota()
+{
+        if (ota_disabled != 0x13131313) {
+                char updated = 0;
+                esp_err_t err = ota(&updated);
+                if (err == ESP_OK || err == ESP_ERR_NOT_FOUND)
+                        ota_disabled = 0x13131313;
+                if (updated) {
+                        vTaskDelay(100 / portTICK_PERIOD_MS);
+                        esp_restart();
+                }
 
-        epaper_handle_t ep;
-        ep = epaper_create(epconf);
-        epaper_display(ep, data);
-        epaper_delete(ep);
+                if (vdd_offset_calibration_requested())
+                        vdd_offset_calibrate();
+        }
+        return ESP_OK;
 }
 
-volatile int RTC_DATA_ATTR ota_disabled;
-volatile char RTC_DATA_ATTR last_err[32];
+static esp_err_t job_display()
+{
+        display("http://yaws.home.arpa/image.raw");
+        return ESP_OK;
+}
+
+static esp_err_t job_send()
+{
+        const char *prefix = macstr("yaws.sensor_", "");
+        const char *metric[] = {"voltage" , NULL};
+        const float value[] = {vdd};
+        esp_err_t err = wake_publish(prefix);
+        if (err == ESP_OK)
+                err = graphite_tx_publish(prefix);
+        ESP_LOGI(TAG, "voltage: %0.2fV", vdd);
+        if (err != ESP_OK)
+                return err;
+        return graphite(prefix, metric, value);
+}
+
+enum { JOB_VDD, JOB_WIFI, JOB_OTA, JOB_DISPLAY, JOB_SEND };
+
+// OTA must run _before_ any potentially buggy code
+static struct wake_job jobs[] = {
+        [JOB_VDD] = { "vdd", WAKE_INIT, job_vdd, 0, 2048 },
+        [JOB_WIFI] = { "wifi", WAKE_WIFI, job_wifi, 0, 3072 },
+        [JOB_OTA] = { "ota", WAKE_OTA, job_ota, BIT(JOB_WIFI) | BIT(JOB_VDD), 8192 },
+        [JOB_DISPLAY] = { "display", WAKE_DISPLAY, job_display, BIT(JOB_OTA), 4096 },
+        [JOB_SEND] = { "send", WAKE_SEND, job_send, BIT(JOB_DISPLAY) | BIT(JOB_VDD), 3072 },
+};
 
 void app_main(void)
 {
+        wake_phase(WAKE_INIT);
         const esp_app_desc_t *app_desc = esp_ota_get_app_description();
         TAG = app_desc->project_name;
         syslog_early_init();
@@ -204,49 +298,22 @@ void app_main(void)
         esp_log_level_set("yaws-wifi", ESP_LOG_INFO);
         esp_log_level_set("yaws-syslog", ESP_LOG_INFO);
         esp_log_level_set("yaws-graphite", ESP_LOG_INFO);
+        esp_log_level_set("yaws-wake", ESP_LOG_INFO);
 
         ESP_ERROR_CHECK(nvs_flash_init());
         ESP_ERROR_CHECK(esp_netif_init());
         ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-        vdd_read();
         syslog_init();
+        wake_run(jobs, sizeof jobs / sizeof jobs[0]);
 
-        // connect to WiFi before anything else. OTA must run _before_ any potentially buggy code
-        if (wifi_connect() != ESP_OK)
-                goto sleep;
-
-        // OTA source is checked only once after boot to save power.
-        // If you want to force OTA: do a power cycle (reset is not enough).
-        if (ota_disabled != 0x13131313) {
-                char updated = 0;
-                esp_err_t err = ota(&updated);
-                if (err == ESP_OK || err == ESP_ERR_NOT_FOUND)
-                        ota_disabled = 0x13131313;
-                if (updated) {
-                        vTaskDelay(100 / portTICK_PERIOD_MS);
-                        esp_restart();
-                }
-
-		if (vdd_offset_calibration_requested())
-			vdd_offset_calibrate();
-        }
-
-        unsigned size;
-        uint8_t *data = get("http://yaws.home.arpa/image.raw", &size);
-        if (data != NULL)
-                display(data, size);
-
-        const char *metric[] = {"voltage" , NULL};
-        const float value[] = {vdd};
-        graphite(macstr("yaws.sensor_", ""), metric, value);
-        ESP_LOGI(TAG, "voltage: %0.2fV", vdd);
-sleep:
         if (syslog_last_err[0])
                 memcpy((char *)last_err, syslog_last_err, sizeof(last_err));
 
+        wake_phase(WAKE_DISCONNECT);
         wifi_disconnect();
 
+        wake_done();
         unsigned sleep_duration = 15 * 60 * 1000000;
         esp_deep_sleep(sleep_duration - esp_log_timestamp() * 1000);
 }
@@ -0,0 +1,122 @@
+/*
+  ESP-NOW gateway: stays associated with the AP, receives metric frames
+  of sensors built with CONFIG_GRAPHITE_ESPNOW and re-emits them as
+  Graphite plaintext. This build must have CONFIG_GRAPHITE_ESPNOW and
+  CONFIG_GRAPHITE_BINARY off: frames carry no prefix, so the records of
+  every sensor would be sent as the gateway's own. Sensors must have
+  CONFIG_GRAPHITE_ESPNOW_CHANNEL set to the channel of the AP.
+ */
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "syslog.h"
+#include "graphite.h"
+#include "wifi.h"
+#include "espnow_frame.h"
+#include "espnow_gateway.h"
+#include "espnow_link.h"
+
+#if defined(CONFIG_GRAPHITE_ESPNOW) || defined(CONFIG_GRAPHITE_BINARY)
+#error "the gateway re-emits Graphite plaintext, turn off CONFIG_GRAPHITE_ESPNOW and CONFIG_GRAPHITE_BINARY"
+#endif
+
+static const char *TAG = "undefined";
+
+struct received {
+        uint8_t len;
+        uint8_t buf[ESPNOW_FRAME_MAX];
+};
+
+static QueueHandle_t received;
+static volatile uint32_t dropped;
+
+// called from the WiFi task: copy and return
+static void on_frame(const uint8_t *buf, int len)
+{
+        struct received r = { .len = len };
+
+        if (len <= 0 || len > ESPNOW_FRAME_MAX) {
+                dropped++;
+                return;
+        }
+        memcpy(r.buf, buf, len);
+        if (xQueueSend(received, &r, 0) != pdTRUE)
+                dropped++;
+}
+
+// one datagram per frame: sensors send seconds apart
+static esp_err_t emit(void *ctx, const char *prefix, const struct espnow_record *r)
+{
+        if (r == NULL)
+                return graphite_batch_flush();
+        return graphite_batch_add_fixed(prefix, r->metric, r->value, r->precision, r->ts);
+}
+
+void app_main(void)
+{
+        const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+        TAG = app_desc->project_name;
+        syslog_early_init();
+
+        esp_log_level_set("*", ESP_LOG_WARN);
+        esp_log_level_set("esp_https_ota", ESP_LOG_INFO);
+        esp_log_level_set(TAG, ESP_LOG_INFO);
+        esp_log_level_set("yaws-wifi", ESP_LOG_INFO);
+        esp_log_level_set("yaws-syslog", ESP_LOG_INFO);
+        esp_log_level_set("yaws-graphite", ESP_LOG_INFO);
+        esp_log_level_set("yaws-espnow", ESP_LOG_INFO);
+
+        ESP_ERROR_CHECK(nvs_flash_init());
+        ESP_ERROR_CHECK(esp_netif_init());
+        ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+        esp_err_t err = wifi_connect();
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "wifi_connect: %s", esp_err_to_name(err));
+                vTaskDelay(10000 / portTICK_PERIOD_MS);
+                esp_restart();
+        }
+        syslog_init();
+        ESP_LOGI(TAG, "version: %s", app_desc->version);
+
+        char updated = 0;
+        ota(&updated);
+        if (updated)
+                esp_restart();
+
+        received = xQueueCreate(16, sizeof(struct received));
+        ESP_ERROR_CHECK(espnow_link_listen(on_frame));
+
+        static struct espnow_gateway gateway;
+        static struct espnow_gateway_node nodes[ESPNOW_GATEWAY_NODES];
+        espnow_gateway_init(&gateway, nodes, ESPNOW_GATEWAY_NODES);
+        uint32_t reported = 0;
+        for (;;) {
+                struct received r;
+                if (xQueueReceive(received, &r, 60000 / portTICK_PERIOD_MS) == pdTRUE) {
+                        uint32_t now = xTaskGetTickCount() / configTICK_RATE_HZ;
+                        err = espnow_gateway_receive(&gateway, r.buf, r.len, now, emit, NULL);
+                        if (err != ESP_OK)
+                                ESP_LOGE(TAG, "frame of %d bytes: %s", r.len, esp_err_to_name(err));
+                }
+                if (!wifi_connected()) {
+                        ESP_LOGE(TAG, "WiFi is gone, restarting");
+                        esp_restart();
+                }
+                if (gateway.frames - reported >= 100) {
+                        reported = gateway.frames;
+                        ESP_LOGI(TAG, "frames: %u, duplicates: %u, malformed: %u, dropped: %u",
+                                 gateway.frames, gateway.duplicates, gateway.malformed, dropped);
+                }
+        }
+}
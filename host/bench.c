@@ -0,0 +1,183 @@
+/*
+  Per-call cost and heap allocations of component code paths, and I2C
+  transactions of sensor drivers on a mock bus.
+
+  cmake -S host -B build-host && cmake --build build-host && build-host/yaws-bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+#include "manifest.h"
+#include "delta.h"
+#include "frame.h"
+
+volatile unsigned long bench_allocs;
+volatile uintptr_t bench_sink;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+        __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+        return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+        __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+        return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+        __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+        return __real_realloc(p, size);
+}
+
+uint64_t bench_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void bench_report(const char *name, long iterations, uint64_t ns, unsigned long allocs)
+{
+        printf("%-44s %10.1f ns/call %8.2f allocs/call\n", name,
+               (double)ns / iterations, (double)allocs / iterations);
+}
+
+static void bench_manifest(void)
+{
+        static const char text[] =
+                "version 2024.05.01-3-gdeadbee\n"
+                "url http://yaws.home.arpa/ota/sensor-mcp9808.bin\n"
+                "flags vdd_offset_calibration\n";
+        char buf[sizeof text];
+        struct ota_manifest m;
+
+        BENCH("manifest_parse", 1000000, {
+                memcpy(buf, text, sizeof text);
+                manifest_parse(buf, "http://yaws.home.arpa/ota/x.bin", &m);
+                bench_sink += m.flags;
+        });
+}
+
+#define IMAGE_SIZE (1024 * 1024)
+static uint8_t *image;
+
+static int read_old(void *ctx, uint32_t offset, void *buf, uint32_t len)
+{
+        if (offset > IMAGE_SIZE || len > IMAGE_SIZE - offset)
+                return -1;
+        memcpy(buf, image + offset, len);
+        return 0;
+}
+
+static int write_new(void *ctx, const void *buf, uint32_t len)
+{
+        bench_sink += len;
+        return 0;
+}
+
+static void put_varint(uint8_t **p, uint32_t v)
+{
+        do {
+                *(*p)++ = (v & 0x7f) | (v >= 0x80 ? 0x80 : 0);
+                v >>= 7;
+        } while (v);
+}
+
+// patch of an image with a 4 byte change every 4 KiB: the usual shape
+// of a rebuild with shifted addresses
+static void bench_delta(void)
+{
+        static struct delta d;
+        const struct delta_io io = {.read_old = read_old, .write = write_new};
+        uint8_t *patch = malloc(IMAGE_SIZE / 4), *p = patch;
+
+        image = malloc(IMAGE_SIZE);
+        for (int i = 0; i < IMAGE_SIZE; i++)
+                image[i] = i * 2654435761u >> 24;
+
+        memcpy(p, DELTA_MAGIC, 4);
+        for (int i = 0; i < 4; i++)
+                p[4 + i] = IMAGE_SIZE >> (8 * i);
+        memset(p + 8, 0, 32);
+        p += DELTA_HEADER_SIZE;
+        for (int off = 0; off < IMAGE_SIZE; off += 4096) {
+                *p++ = DELTA_OP_COPY_OLD;
+                put_varint(&p, off == 0 ? 0 : 4 << 1);  // skip replaced bytes (zigzag)
+                put_varint(&p, 4092);
+                *p++ = DELTA_OP_LITERAL;
+                put_varint(&p, 4);
+                memcpy(p, "\x12\x34\x56\x78", 4);
+                p += 4;
+        }
+        long len = p - patch;
+
+        BENCH("delta apply 1 MiB (1 KiB reads)", 20, {
+                delta_init(&d, &io);
+                for (long o = 0; o < len; o += 1024)
+                        delta_feed(&d, patch + o, len - o < 1024 ? len - o : 1024);
+                bench_sink += delta_finish(&d);
+        });
+        free(patch);
+        free(image);
+}
+
+static void frame_sink(void *ctx, const uint8_t *data, int len)
+{
+        bench_sink += len;
+}
+
+static void bench_frame(void)
+{
+        static struct frame_decoder d;
+        static uint8_t packed[48000];
+        uint8_t *p = packed;
+
+        memcpy(p, FRAME_MAGIC, 4);
+        memset(p + 4, 0, FRAME_HEADER_SIZE - 4);
+        p[4] = 800 & 0xff;
+        p[5] = 800 >> 8;
+        p[6] = 480 & 0xff;
+        p[7] = 480 >> 8;
+        p[8] = FRAME_PACKBITS;
+        p += FRAME_HEADER_SIZE;
+        // rows of white with some text in the middle
+        for (int row = 0; row < 480; row++) {
+                *p++ = 257 - 40;
+                *p++ = 0xff;
+                *p++ = 19;
+                for (int i = 0; i < 20; i++)
+                        *p++ = row * 31 + i;
+                *p++ = 257 - 40;
+                *p++ = 0xff;
+        }
+        long len = p - packed;
+
+        BENCH("frame decode 800x480 (1 KiB reads)", 1000, {
+                frame_init(&d, 800, 480, frame_sink, NULL);
+                for (long o = 0; o < len; o += 1024)
+                        frame_feed(&d, packed + o, len - o < 1024 ? len - o : 1024);
+                bench_sink += frame_finish(&d);
+        });
+}
+
+int main(void)
+{
+        bench_graphite();
+        bench_syslog();
+        bench_manifest();
+        bench_delta();
+        bench_frame();
+        bench_adt7410();
+        bench_flashlog();
+        bench_ota();
+        return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+// calls to malloc, calloc and realloc since start
+extern volatile unsigned long bench_allocs;
+// keeps results alive, so the compiler can't drop the measured code
+extern volatile uintptr_t bench_sink;
+
+uint64_t bench_now(void);
+void bench_report(const char *name, long iterations, uint64_t ns, unsigned long allocs);
+
+#define BENCH(name, iterations, stmt) do {                                      \
+                unsigned long allocs_ = bench_allocs;                           \
+                uint64_t start_ = bench_now();                                  \
+                for (long i_ = 0; i_ < (iterations); i_++) {                    \
+                        stmt;                                                   \
+                }                                                               \
+                bench_report(name, iterations, bench_now() - start_,            \
+                             bench_allocs - allocs_);                           \
+        } while (0)
+
+void bench_graphite(void);
+void bench_syslog(void);
+void bench_adt7410(void);
+void bench_flashlog(void);
+void bench_ota(void);
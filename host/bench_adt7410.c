@@ -0,0 +1,55 @@
+#include <stdio.h>
+
+#include "adt7410.h"
+
+#include "bench.h"
+#include "i2c_mock.h"
+
+// conversion completes right away: RDY goes low on a configuration write
+static void adt7410_written(struct i2c_mock_device *d, uint8_t reg)
+{
+        if (reg == 0x03)
+                d->reg[0x02] &= ~0x80;
+}
+
+static struct i2c_mock_device adt7410 = {
+        .addr = ADT7410_I2C_ADDR_000,
+        .written = adt7410_written,
+};
+
+// the module is powered only for the measurement
+static void adt7410_power_on(void)
+{
+        memset(adt7410.reg, 0, sizeof adt7410.reg);
+        adt7410.reg[0x00] = 0x0c; // 24°C
+        adt7410.reg[0x02] = 0x80;
+        adt7410.reg[0x0b] = 0xcb;
+}
+
+static unsigned long adt7410_measure(adt7410_shadow_t *shadow)
+{
+        adt7410_t dev = {.shadow = shadow};
+        float t;
+        unsigned long start = i2c_mock_transactions;
+
+        adt7410_power_on();
+        if (shadow)
+                shadow->conf = 0;
+        adt7410_init_desc(&dev, ADT7410_I2C_ADDR_000, 0, 4, 5);
+        if (adt7410_init(&dev, ADT7410_1SPC, ADT7410_RES_13) != ESP_OK ||
+            adt7410_wait_ready(&dev, 100) != ESP_OK ||
+            adt7410_get_temperature(&dev, &t) != ESP_OK)
+                printf("adt7410 measurement failed\n");
+        return i2c_mock_transactions - start;
+}
+
+void bench_adt7410(void)
+{
+        adt7410_shadow_t shadow = {0};
+
+        i2c_mock_attach(&adt7410);
+        printf("%-44s %10lu transactions\n", "adt7410 wake without shadow", adt7410_measure(NULL));
+        printf("%-44s %10lu transactions\n", "adt7410 cold wake", adt7410_measure(&shadow));
+        printf("%-44s %10lu transactions\n", "adt7410 warm wake", adt7410_measure(&shadow));
+        i2c_mock_detach_all();
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "esp_log.h"
+#include "flashlog.h"
+#include "flash_mock.h"
+
+#define SIZE (1024 * 1024)      // the partition of sensor/partitions.csv
+
+struct record {
+        uint32_t ts;
+        int32_t value[4];
+        uint8_t mask;
+};
+
+static struct flashlog log_;
+static struct flashlog_index index_;
+
+static void stats_add(struct flash_mock_stats *sum, const struct flash_mock_stats *before)
+{
+        sum->reads += flash_mock_stats.reads - before->reads;
+        sum->writes += flash_mock_stats.writes - before->writes;
+        sum->erases += flash_mock_stats.erases - before->erases;
+        sum->read_bytes += flash_mock_stats.read_bytes - before->read_bytes;
+        sum->written_bytes += flash_mock_stats.written_bytes - before->written_bytes;
+}
+
+// estimated flash time on the device, per call
+static void report_flash(long calls, const struct flash_mock_stats *s)
+{
+        double us = s->writes * (double)FLASH_MOCK_PROGRAM_US + s->erases * (double)FLASH_MOCK_ERASE_US +
+                s->reads * (double)FLASH_MOCK_READ_US + s->read_bytes * FLASH_MOCK_READ_NS_PER_BYTE / 1000.0;
+        printf("%-44s %10.1f us/call %5.2f programs %6.4f erases %6.0f bytes read\n", "  on flash",
+               us / calls, (double)s->writes / calls, (double)s->erases / calls, (double)s->read_bytes / calls);
+}
+
+#define BENCH_FLASH(name, iterations, stmt) do {                                \
+                struct flash_mock_stats before_ = flash_mock_stats, sum_ = {0}; \
+                BENCH(name, iterations, stmt);                                  \
+                stats_add(&sum_, &before_);                                     \
+                report_flash(iterations, &sum_);                                \
+        } while (0)
+
+static void reopen(const esp_partition_t *part)
+{
+        flash_mock_power_on();
+        esp_partition_erase_range(part, 0, part->size);
+        index_.magic = 0;
+        flashlog_open(&log_, "samples", sizeof(struct record), &index_);
+}
+
+void bench_flashlog(void)
+{
+        const esp_partition_t *part = flash_mock_temp("samples", SIZE);
+        if (part == NULL)
+                return;
+        struct record r[32] = {0};
+        esp_log_level_set("*", ESP_LOG_ERROR); // recoveries and full log
+        const long records = SIZE / FLASHLOG_SECTOR * (FLASHLOG_SECTOR / 32 - 1);
+
+        // a sample per wake, or the RTC batch of 8 at once
+        reopen(part);
+        BENCH_FLASH("flashlog_append x1", records, {
+                r[0].ts = i_;
+                flashlog_append(&log_, r, 1);
+        });
+        reopen(part);
+        BENCH_FLASH("flashlog_append x8", records / 8, {
+                r[0].ts = i_;
+                flashlog_append(&log_, r, 8);
+        });
+
+        // drain of a full log, 32 records per read
+        struct flashlog_pos pos;
+        BENCH_FLASH("flashlog_read x32 (full log)", records / 32, {
+                if (i_ == 0)
+                        pos = index_.tail;
+                bench_sink += flashlog_read(&log_, &pos, r, 32);
+        });
+
+        // power cut in the middle of a page write, then recovery from flash
+        // alone; half the sectors hold records
+        long cuts = 100;
+        uint64_t ns = 0;
+        struct flash_mock_stats sum = {0};
+        for (long i = 0; i < cuts; i++) {
+                reopen(part);
+                for (long n = 0; n < records / 2 + i * 7; n += 8)
+                        flashlog_append(&log_, r, 8);
+                flash_mock_cut(100);
+                flashlog_append(&log_, r, 8);
+                flash_mock_power_on();
+
+                struct flash_mock_stats before = flash_mock_stats;
+                index_.magic = 0;
+                uint64_t start = bench_now();
+                flashlog_open(&log_, "samples", sizeof(struct record), &index_);
+                ns += bench_now() - start;
+                stats_add(&sum, &before);
+        }
+        bench_report("flashlog_open after power loss", cuts, ns, 0);
+        report_flash(cuts, &sum);
+        flash_mock_close(part);
+        esp_log_level_set("*", ESP_LOG_INFO);
+}
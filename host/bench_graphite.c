@@ -0,0 +1,34 @@
+// static functions are benchmarked directly
+#include "graphite.c"
+
+#include "bench.h"
+
+void bench_graphite(void)
+{
+        char buf[128], v[24];
+        const char *prefix = "yaws.sensor_84:cc:a8:ac:23:bd";
+
+        BENCH("graphite format", 1000000,
+              bench_sink += format(buf, sizeof buf, prefix, "temperature", "21.37", 1700000000 + i_));
+        BENCH("ftoa", 1000000,
+              bench_sink += ftoa(v, sizeof v, 101325.0f + i_ % 100, 0));
+        BENCH("fixtoa", 1000000,
+              bench_sink += fixtoa(v, sizeof v, 2137 + i_ % 7, 2));
+        BENCH("snprintf %.2f", 1000000,
+              bench_sink += snprintf(v, sizeof v, "%.2f", 21.37f + i_ % 7));
+        // a sample of four metrics per call, packet sent to CONFIG_GRAPHITE_ADDR when full
+        BENCH("graphite_batch_add x4", 100000, {
+                graphite_batch_add(prefix, "temperature", 21.37f, 2, 1700000000 + i_);
+                graphite_batch_add(prefix, "pressure", 101325.0f, 0, 1700000000 + i_);
+                graphite_batch_add(prefix, "humidity", 45.6f, 1, 1700000000 + i_);
+                graphite_batch_add(prefix, "voltage", 3.012f, 3, 1700000000 + i_);
+        });
+        graphite_batch_flush();
+        BENCH("graphite_batch_add_fixed x4", 100000, {
+                graphite_batch_add_fixed(prefix, "temperature", 2137, 2, 1700000000 + i_);
+                graphite_batch_add_fixed(prefix, "pressure", 101325, 0, 1700000000 + i_);
+                graphite_batch_add_fixed(prefix, "humidity", 456, 1, 1700000000 + i_);
+                graphite_batch_add_fixed(prefix, "voltage", 3012, 3, 1700000000 + i_);
+        });
+        graphite_batch_flush();
+}
@@ -0,0 +1,64 @@
+// manifest cache is reset directly, as power-on does
+#include "ota.c"
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "http_mock.h"
+#include "ota_mock.h"
+
+#define NODE "/ota/00:00:00:00:00:00/"
+
+// what a check costs the node on air
+static void report_http(long calls, const struct http_mock_stats *before)
+{
+        printf("%-44s %10.2f requests %5.2f connections %5.2f clients %6.0f bytes\n", "  over HTTP",
+               (double)(http_mock_stats.requests - before->requests) / calls,
+               (double)(http_mock_stats.connections - before->connections) / calls,
+               (double)(http_mock_stats.clients - before->clients) / calls,
+               (double)(http_mock_stats.bytes - before->bytes) / calls);
+}
+
+#define BENCH_HTTP(name, iterations, stmt) do {                                 \
+                struct http_mock_stats before_ = http_mock_stats;               \
+                BENCH(name, iterations, stmt);                                  \
+                report_http(iterations, &before_);                              \
+        } while (0)
+
+// a wake that finds the running version is the one to run
+static void wake(bool power_on)
+{
+        manifest_fetched = false;
+        if (power_on)
+                manifest_cache.magic = 0;
+        bench_sink += ota(NULL);
+}
+
+/*
+  Version negotiation against a local HTTP server, per wake, in the
+  usual cases: per node and global manifest, manifest cached by ETag,
+  and the .version files of servers without a manifest. Time is mostly
+  the loopback round trips, allocations are ota.c's and one per client.
+ */
+void bench_ota(void)
+{
+        static const char manifest[] = "version 1.0\nflags vdd_offset_calibration\n";
+
+        esp_log_level_set("*", ESP_LOG_ERROR);
+        strcpy(ota_mock_app.project_name, "sensor");
+        strcpy(ota_mock_app.version, "1.0");
+
+        http_mock_file("/ota/sensor.manifest", manifest, sizeof manifest - 1, "\"m1\"");
+        BENCH_HTTP("ota: global manifest", 2000, wake(true));
+        BENCH_HTTP("ota: global manifest, not modified", 2000, wake(false));
+        http_mock_file(NODE "sensor.manifest", manifest, sizeof manifest - 1, "\"m1\"");
+        BENCH_HTTP("ota: node manifest", 2000, wake(true));
+        BENCH_HTTP("ota: node manifest, not modified", 2000, wake(false));
+
+        http_mock_clear();
+        http_mock_file("/ota/sensor.version", "1.0\n", 4, NULL);
+        BENCH_HTTP("ota: .version files", 2000, wake(true));
+        BENCH_HTTP("vdd_offset_calibration_requested: HEAD", 2000,
+                   bench_sink += vdd_offset_calibration_requested());
+        http_mock_clear();
+}
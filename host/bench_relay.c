@@ -0,0 +1,127 @@
+/*
+  Load benchmark of yaws-relay: thousands of simulated nodes send their
+  batches as binary frames, a quarter of the frames twice as if an
+  acknowledgement was lost, and a fake carbon counts what comes out.
+
+  cmake -S host -B build-host && cmake --build build-host && build-host/yaws-bench-relay [NODES [BATCHES]]
+
+  Frames are paced by what carbon has received, so that the kernel
+  doesn't drop datagrams and the rate is that of the relay.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "lwip/sockets.h"
+#include "espnow_frame.h"
+#include "ftoa.h"
+#include "relay_child.h"
+
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static volatile unsigned long carbon_lines, carbon_bytes;
+
+static void *carbon(void *arg)
+{
+        int fd = accept(*(int *)arg, NULL, NULL);
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof buf)) > 0) {
+                unsigned long lines = 0;
+                for (ssize_t i = 0; i < n; i++)
+                        lines += buf[i] == '\n';
+                __atomic_add_fetch(&carbon_lines, lines, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&carbon_bytes, n, __ATOMIC_RELAXED);
+        }
+        return NULL;
+}
+
+static const struct {
+        const char *name;
+        int precision;
+} metric[] = {
+        {"temperature", 2}, {"pressure", 0}, {"humidity", 1}, {"voltage", 3},
+};
+
+// plaintext the node would have sent for a record, for comparison
+static int text_size(const uint8_t *mac, const char *name, int32_t value, int precision)
+{
+        char v[24], line[128];
+        fixtoa(v, sizeof v, value, precision);
+        return snprintf(line, sizeof line, "yaws.sensor_%02x:%02x:%02x:%02x:%02x:%02x.%s %s -1\n",
+                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], name, v);
+}
+
+int main(int argc, char **argv)
+{
+        int nodes = argc > 1 ? atoi(argv[1]) : 5000;
+        int batches = argc > 2 ? atoi(argv[2]) : 10;
+        int carbon_port, relay_port;
+
+        int carbon_fd = loopback_socket(SOCK_STREAM, true, &carbon_port);
+        pthread_t thread;
+        pthread_create(&thread, NULL, carbon, &carbon_fd);
+
+        pid_t relay = relay_child_start(YAWS_RELAY, carbon_port, &relay_port, NULL, NULL);
+
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in to = {
+                .sin_family = AF_INET,
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+                .sin_port = htons(relay_port),
+        };
+        static struct espnow_frame frame;
+        unsigned long datagrams = 0, bytes = 0, text = 0, records = 0;
+        srand(1);
+
+        uint64_t start = now_ns();
+        for (int b = 0; b < batches; b++) {
+                for (int n = 0; n < nodes; n++) {
+                        uint8_t mac[6] = {0x02, 0x00, 0x00, n >> 16, n >> 8, n};
+                        espnow_frame_init(&frame, mac, b);
+                        // a batch of four hourly samples
+                        for (int s = 0; s < 4; s++) {
+                                for (int m = 0; m < 4; m++) {
+                                        int32_t v = 2000 + rand() % 1000;
+                                        espnow_frame_add(&frame, metric[m].name, v, metric[m].precision,
+                                                         1700000000 + b * 14400 + s * 3600);
+                                        text += text_size(mac, metric[m].name, v, metric[m].precision);
+                                        records++;
+                                }
+                        }
+                        for (int copy = rand() % 4 ? 1 : 2; copy > 0; copy--) {
+                                sendto(fd, frame.buf, frame.len, 0, (struct sockaddr *)&to, sizeof to);
+                                datagrams++;
+                                bytes += frame.len;
+                        }
+                        while (records - carbon_lines > 20000)
+                                usleep(100);
+                }
+        }
+        for (int i = 0; i < 1000 && carbon_lines < records; i++)
+                usleep(1000);
+        uint64_t ns = now_ns() - start;
+
+        relay_child_stop(relay);
+        struct rusage ru;
+        getrusage(RUSAGE_CHILDREN, &ru);
+        double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+
+        printf("%d nodes x %d batches: %lu datagrams, %lu records in %.2f s\n",
+               nodes, batches, datagrams, records, ns / 1e9);
+        printf("relay: %.0f datagrams/s, %.0f lines/s, %.2f us CPU per datagram\n",
+               datagrams / (ns / 1e9), carbon_lines / (ns / 1e9), cpu * 1e6 / datagrams);
+        printf("nodes sent %lu bytes, %lu as plaintext (%.1fx), carbon got %lu lines, %lu bytes\n",
+               bytes, text, (double)text / bytes, carbon_lines, carbon_bytes);
+        if (carbon_lines != records)
+                printf("MISMATCH: %lu lines expected\n", records);
+        return carbon_lines != records;
+}
@@ -0,0 +1,40 @@
+// static functions are benchmarked directly
+#include "syslog.c"
+
+#include "bench.h"
+
+static int discard(const char *fmt, va_list va)
+{
+        return 0;
+}
+
+static const char colored[] = "\033[0;32mI (123456) yaws-sensor: temperature: 21.37°C\033[0m\n";
+
+void bench_syslog(void)
+{
+        static char data[SIZE];
+        struct record r, *s = &r;
+        struct iovec iov[2];
+        char h[HEADER_SIZE];
+
+        BENCH("syslog trim_color_escape_seq_and_newline", 1000000, {
+                memcpy(data, colored, sizeof colored - 1);
+                bench_sink += s->len = trim_color_escape_seq_and_newline(data, sizeof colored - 1);
+        });
+        BENCH("syslog parse_header + garbage", 1000000, {
+                parse_header(s, data);
+                bench_sink += garbage(s, data);
+        });
+        BENCH("syslog frame", 1000000,
+              bench_sink += frame(iov, h, s->prio, data + s->tag, s->tag_len, data[0],
+                                  s->tick, data + s->body, s->len - s->body, true));
+
+        // log hook on the producer side; syslog_task sends in the background
+        // and the ring drops lines it can't keep up with
+        vprintf_like_t console = esp_log_set_vprintf(discard);
+        syslog_init();
+        BENCH("syslog ESP_LOGI via hook", 100000,
+              ESP_LOGI("bench", "temperature: %d.%02d", 21, (int)(i_ % 100)));
+        esp_log_set_vprintf(console);
+        printf("%-44s %u dropped\n", "syslog ring", dropped);
+}
@@ -0,0 +1,22 @@
+#pragma once
+/*
+  Included by every host test: CHECK() counts a failed condition and
+  prints the first 20, check_done() reports the count as main()'s
+  result.
+ */
+#include <stdio.h>
+
+static int failed;
+
+#define CHECK(cond, ...) do {                           \
+                if (!(cond) && failed++ < 20) {         \
+                        printf(__VA_ARGS__);            \
+                        printf("\n");                   \
+                }                                       \
+        } while (0)
+
+static inline int check_done(void)
+{
+        printf("%d failed\n", failed);
+        return failed != 0;
+}
@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "flash_mock.h"
+
+#define SECTOR 4096
+#define PAGE 256
+#define PARTITIONS 4
+
+struct flash_mock_stats flash_mock_stats;
+
+static struct {
+        esp_partition_t part;
+        uint8_t *mem;
+} partition[PARTITIONS];
+
+static long cut = -1;           // bytes to program or erase before power goes off
+static bool off;
+
+const esp_partition_t *flash_mock_partition(const char *label, const char *path, size_t size)
+{
+        int i = 0;
+        while (i < PARTITIONS && partition[i].mem != NULL)
+                i++;
+        if (i == PARTITIONS || size % SECTOR != 0)
+                return NULL;
+
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+                perror(path);
+                return NULL;
+        }
+        off_t was = lseek(fd, 0, SEEK_END);
+        if (was < (off_t)size && ftruncate(fd, size) != 0) {
+                perror(path);
+                close(fd);
+                return NULL;
+        }
+        uint8_t *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) {
+                perror(path);
+                return NULL;
+        }
+        // new flash comes erased
+        if (was < (off_t)size)
+                memset(mem + was, 0xff, size - was);
+
+        partition[i].mem = mem;
+        partition[i].part = (esp_partition_t) {
+                .type = ESP_PARTITION_TYPE_DATA,
+                .subtype = ESP_PARTITION_SUBTYPE_ANY,
+                .size = size,
+        };
+        strlcpy(partition[i].part.label, label, sizeof partition[i].part.label);
+        return &partition[i].part;
+}
+
+const esp_partition_t *flash_mock_temp(const char *label, size_t size)
+{
+        char path[] = "/tmp/yaws-flash-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+                perror(path);
+                return NULL;
+        }
+        close(fd);
+        const esp_partition_t *p = flash_mock_partition(label, path, size);
+        unlink(path);
+        return p;
+}
+
+void flash_mock_close(const esp_partition_t *p)
+{
+        for (int i = 0; i < PARTITIONS; i++)
+                if (&partition[i].part == p) {
+                        munmap(partition[i].mem, p->size);
+                        partition[i].mem = NULL;
+                }
+}
+
+void flash_mock_cut(long bytes)
+{
+        cut = bytes;
+}
+
+void flash_mock_power_on(void)
+{
+        cut = -1;
+        off = false;
+}
+
+static uint8_t *mem(const esp_partition_t *p)
+{
+        for (int i = 0; i < PARTITIONS; i++)
+                if (&partition[i].part == p && partition[i].mem != NULL)
+                        return partition[i].mem;
+        return NULL;
+}
+
+// bytes of an operation of size done before power goes off
+static size_t powered(size_t size)
+{
+        if (cut < 0)
+                return size;
+        if ((long)size < cut) {
+                cut -= size;
+                return size;
+        }
+        size = cut;
+        off = true;
+        cut = -1;
+        return size;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+        for (int i = 0; i < PARTITIONS; i++)
+                if (partition[i].mem != NULL && partition[i].part.type == type &&
+                    (subtype == ESP_PARTITION_SUBTYPE_ANY || partition[i].part.subtype == subtype) &&
+                    (label == NULL || strcmp(partition[i].part.label, label) == 0))
+                        return &partition[i].part;
+        return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t src_offset, void *dst, size_t size)
+{
+        uint8_t *m = mem(p);
+        if (m == NULL || src_offset > p->size || size > p->size - src_offset)
+                return ESP_ERR_INVALID_ARG;
+        if (off)
+                return ESP_FAIL;
+        memcpy(dst, m + src_offset, size);
+        flash_mock_stats.reads++;
+        flash_mock_stats.read_bytes += size;
+        return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t dst_offset, const void *src, size_t size)
+{
+        uint8_t *m = mem(p);
+        if (m == NULL || dst_offset > p->size || size > p->size - dst_offset ||
+            dst_offset % 4 != 0 || size % 4 != 0)
+                return ESP_ERR_INVALID_ARG;
+        if (off)
+                return ESP_FAIL;
+        // a program operation per page touched
+        flash_mock_stats.writes += (dst_offset + size - 1) / PAGE - dst_offset / PAGE + 1;
+        flash_mock_stats.written_bytes += size;
+
+        size_t done = powered(size);
+        const uint8_t *s = src;
+        for (size_t i = 0; i < done; i++)
+                m[dst_offset + i] &= s[i];
+        return off ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t start_addr, size_t size)
+{
+        uint8_t *m = mem(p);
+        if (m == NULL || start_addr > p->size || size > p->size - start_addr ||
+            start_addr % SECTOR != 0 || size % SECTOR != 0)
+                return ESP_ERR_INVALID_ARG;
+        if (off)
+                return ESP_FAIL;
+        flash_mock_stats.erases += size / SECTOR;
+
+        memset(m + start_addr, 0xff, powered(size));
+        return off ? ESP_FAIL : ESP_OK;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include "esp_partition.h"
+
+/*
+  Mock NOR flash behind the esp_partition API. A partition is a file
+  mapped into memory, so an image outlives the process as flash outlives
+  power loss. As on the chip, programming only clears bits, in 4-byte
+  units, and erase sets whole 4 KiB sectors back to 0xff. Operations are
+  counted, so the flash cost of a code path is visible, and power can be
+  cut in the middle of one.
+ */
+struct flash_mock_stats {
+        unsigned long reads, writes, erases;
+        unsigned long read_bytes, written_bytes;
+};
+
+extern struct flash_mock_stats flash_mock_stats;
+
+// partition label backed by the file at path, created erased if it is missing
+const esp_partition_t *flash_mock_partition(const char *label, const char *path, size_t size);
+// partition on a temporary file that is gone when the process is
+const esp_partition_t *flash_mock_temp(const char *label, size_t size);
+void flash_mock_close(const esp_partition_t *partition);
+/*
+  Power goes off once bytes more bytes are programmed or erased: the
+  operation in progress stops there, it and all later ones fail until
+  flash_mock_power_on().
+ */
+void flash_mock_cut(long bytes);
+void flash_mock_power_on(void);
+
+/*
+  Program and erase times of a typical SPI NOR part (Winbond W25Q32, as
+  on ESP-12 modules), for estimates of time spent on the device.
+ */
+#define FLASH_MOCK_PROGRAM_US 400       // per write, up to a page
+#define FLASH_MOCK_ERASE_US 45000       // per sector
+#define FLASH_MOCK_READ_US 5            // per read: command, address, driver
+#define FLASH_MOCK_READ_NS_PER_BYTE 50  // 40 MHz DIO
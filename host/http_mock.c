@@ -0,0 +1,426 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <netinet/tcp.h>
+
+#include "lwip/sockets.h"
+#include "esp_http_client.h"
+#include "http_mock.h"
+
+#define FILES 16
+
+struct http_mock_stats http_mock_stats;
+
+static struct {
+        char path[128];
+        char *body;
+        int len;
+        char etag[40];
+} files[FILES];
+// held while a response is sent, so a file isn't freed under it
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t server_once = PTHREAD_ONCE_INIT;
+static struct sockaddr_in server_addr;
+static int server_fd = -1;
+
+static void count(unsigned long *counter, unsigned long n)
+{
+        __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+void http_mock_remove(const char *path)
+{
+        pthread_mutex_lock(&files_lock);
+        for (int i = 0; i < FILES; i++)
+                if (files[i].body != NULL && strcmp(files[i].path, path) == 0) {
+                        free(files[i].body);
+                        files[i].body = NULL;
+                }
+        pthread_mutex_unlock(&files_lock);
+}
+
+void http_mock_file(const char *path, const void *body, int len, const char *etag)
+{
+        http_mock_remove(path);
+        pthread_mutex_lock(&files_lock);
+        for (int i = 0; i < FILES; i++)
+                if (files[i].body == NULL) {
+                        // one more byte, so an empty file isn't a free slot
+                        files[i].body = malloc(len + 1);
+                        memcpy(files[i].body, body, len);
+                        files[i].len = len;
+                        strlcpy(files[i].path, path, sizeof files[i].path);
+                        strlcpy(files[i].etag, etag != NULL ? etag : "", sizeof files[i].etag);
+                        break;
+                }
+        pthread_mutex_unlock(&files_lock);
+}
+
+void http_mock_clear(void)
+{
+        pthread_mutex_lock(&files_lock);
+        for (int i = 0; i < FILES; i++) {
+                free(files[i].body);
+                files[i].body = NULL;
+        }
+        pthread_mutex_unlock(&files_lock);
+}
+
+static bool send_all(int fd, const void *buf, int len)
+{
+        for (const char *p = buf; len > 0; ) {
+                ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+                if (n <= 0)
+                        return false;
+                p += n;
+                len -= n;
+        }
+        return true;
+}
+
+// counted before it is sent, so it is by the time the client has it
+static bool respond(int fd, const char *head, int head_len, const void *body, int len)
+{
+        count(&http_mock_stats.bytes, head_len + len);
+        return send_all(fd, head, head_len) && send_all(fd, body, len);
+}
+
+// value of a request header, or "" if it isn't there
+static void header(const char *head, const char *key, char *value, int size)
+{
+        char name[40];
+        snprintf(name, sizeof name, "\r\n%s:", key);
+        const char *p = strcasestr(head, name);
+        value[0] = 0;
+        if (p == NULL)
+                return;
+        p += strlen(name);
+        p += strspn(p, " ");
+        snprintf(value, size, "%.*s", (int)strcspn(p, "\r"), p);
+}
+
+// one connection: requests are answered until the client closes it
+static void *serve(void *arg)
+{
+        int fd = (intptr_t)arg;
+        char req[2048];
+        int len = 0;
+
+        for (;;) {
+                char *end;
+                while ((end = memmem(req, len, "\r\n\r\n", 4)) == NULL) {
+                        ssize_t n = len < sizeof req - 1 ? recv(fd, req + len, sizeof req - 1 - len, 0) : 0;
+                        if (n <= 0)
+                                goto out;
+                        len += n;
+                }
+                end[2] = 0;
+                int head_len = end + 4 - req;
+
+                char method[8], path[256], etag[64], connection[16], head[256];
+                if (sscanf(req, "%7s %255s HTTP/1.1", method, path) != 2)
+                        goto out;
+                header(req, "If-None-Match", etag, sizeof etag);
+                header(req, "Connection", connection, sizeof connection);
+                bool body = strcmp(method, "HEAD") != 0;
+
+                pthread_mutex_lock(&files_lock);
+                int i = 0;
+                while (i < FILES && (files[i].body == NULL || strcmp(files[i].path, path) != 0))
+                        i++;
+                bool ok;
+                if (i == FILES) {
+                        static const char not_found[] = "not found\n";
+                        int n = snprintf(head, sizeof head, "HTTP/1.1 404 Not Found\r\nContent-Length: %d\r\n\r\n",
+                                         (int)sizeof not_found - 1);
+                        ok = respond(fd, head, n, not_found, body ? sizeof not_found - 1 : 0);
+                } else if (files[i].etag[0] && strcmp(files[i].etag, etag) == 0) {
+                        int n = snprintf(head, sizeof head, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n\r\n",
+                                         files[i].etag);
+                        count(&http_mock_stats.not_modified, 1);
+                        ok = respond(fd, head, n, NULL, 0);
+                } else {
+                        int n = snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n", files[i].len);
+                        if (files[i].etag[0])
+                                n += snprintf(head + n, sizeof head - n, "ETag: %s\r\n", files[i].etag);
+                        n += snprintf(head + n, sizeof head - n, "\r\n");
+                        ok = respond(fd, head, n, files[i].body, body ? files[i].len : 0);
+                }
+                pthread_mutex_unlock(&files_lock);
+                if (!ok || strcasecmp(connection, "close") == 0)
+                        goto out;
+
+                len -= head_len;
+                memmove(req, req + head_len, len);
+        }
+out:
+        close(fd);
+        return NULL;
+}
+
+static void *server(void *arg)
+{
+        for (;;) {
+                int fd = accept(server_fd, NULL, NULL);
+                if (fd < 0)
+                        continue;
+                // head and body go out at once, not a delayed ACK apart
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+                pthread_t thread;
+                if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) != 0) {
+                        close(fd);
+                        continue;
+                }
+                pthread_detach(thread);
+        }
+        return NULL;
+}
+
+static void server_start(void)
+{
+        socklen_t len = sizeof server_addr;
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_fd < 0 || bind(server_fd, (struct sockaddr *)&server_addr, sizeof server_addr) != 0 ||
+            getsockname(server_fd, (struct sockaddr *)&server_addr, &len) != 0 || listen(server_fd, 16) != 0) {
+                perror("http_mock");
+                abort();
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, server, NULL) != 0)
+                abort();
+        pthread_detach(thread);
+}
+
+/*
+  The client. A response is read through buf; left is the number of
+  body bytes not read yet, -1 until the headers are fetched.
+ */
+#define HEADERS 4
+
+struct esp_http_client {
+        char host[64], path[256];
+        esp_http_client_method_t method;
+        http_event_handle_cb event_handler;
+        void *user_data;
+        struct {
+                char key[32], value[64];
+        } header[HEADERS];
+        int fd;
+        int status;
+        int content_length;
+        int left;
+        bool close;             // server won't take another request
+        char buf[1024];
+        int buf_pos, buf_len;
+};
+
+static void disconnect(esp_http_client_handle_t c)
+{
+        if (c->fd >= 0)
+                close(c->fd);
+        c->fd = -1;
+        c->left = 0;
+        c->buf_pos = c->buf_len = 0;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t c, const char *url)
+{
+        if (strncmp(url, "http://", 7) != 0)
+                return ESP_ERR_INVALID_ARG;
+        url += 7;
+        int host_len = strcspn(url, "/");
+        if (host_len == 0 || host_len >= sizeof c->host || strlen(url + host_len) >= sizeof c->path)
+                return ESP_ERR_INVALID_ARG;
+        if (strncmp(c->host, url, host_len) != 0 || c->host[host_len] != 0)
+                disconnect(c);
+        snprintf(c->host, sizeof c->host, "%.*s", host_len, url);
+        strcpy(c->path, url[host_len] ? url + host_len : "/");
+        return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+        pthread_once(&server_once, server_start);
+        count(&http_mock_stats.clients, 1);
+        esp_http_client_handle_t c = calloc(1, sizeof *c);
+        if (c == NULL)
+                return NULL;
+        c->fd = -1;
+        c->method = config->method;
+        c->event_handler = config->event_handler;
+        c->user_data = config->user_data;
+        if (esp_http_client_set_url(c, config->url) != ESP_OK) {
+                free(c);
+                return NULL;
+        }
+        return c;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c, const char *key, const char *value)
+{
+        esp_http_client_delete_header(c, key);
+        for (int i = 0; i < HEADERS; i++)
+                if (c->header[i].key[0] == 0) {
+                        if (strlen(key) >= sizeof c->header[i].key || strlen(value) >= sizeof c->header[i].value)
+                                return ESP_ERR_INVALID_ARG;
+                        strcpy(c->header[i].key, key);
+                        strcpy(c->header[i].value, value);
+                        return ESP_OK;
+                }
+        return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t c, const char *key)
+{
+        for (int i = 0; i < HEADERS; i++)
+                if (strcasecmp(c->header[i].key, key) == 0)
+                        c->header[i].key[0] = 0;
+        return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len)
+{
+        static const char *method[] = {"GET", "POST", "HEAD"};
+        char req[512];
+        int len = snprintf(req, sizeof req, "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n",
+                           method[c->method], c->path, c->host);
+        for (int i = 0; i < HEADERS; i++)
+                if (c->header[i].key[0])
+                        len += snprintf(req + len, sizeof req - len, "%s: %s\r\n", c->header[i].key, c->header[i].value);
+        len += snprintf(req + len, sizeof req - len, "\r\n");
+
+        // a response not read to its end is still on the connection
+        if (c->left != 0 || c->close)
+                disconnect(c);
+        if (c->fd < 0) {
+                c->fd = socket(AF_INET, SOCK_STREAM, 0);
+                if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&server_addr, sizeof server_addr) != 0) {
+                        disconnect(c);
+                        return ESP_FAIL;
+                }
+                count(&http_mock_stats.connections, 1);
+        }
+        if (send(c->fd, req, len, MSG_NOSIGNAL) != len) {
+                disconnect(c);
+                return ESP_FAIL;
+        }
+        count(&http_mock_stats.requests, 1);
+        c->left = -1;
+        c->close = false;
+        c->status = 0;
+        return ESP_OK;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t c)
+{
+        char *end;
+
+        if (c->fd < 0 || c->left != -1)
+                return -1;
+        while ((end = memmem(c->buf, c->buf_len, "\r\n\r\n", 4)) == NULL) {
+                ssize_t n = c->buf_len < sizeof c->buf ? recv(c->fd, c->buf + c->buf_len, sizeof c->buf - c->buf_len, 0) : 0;
+                if (n <= 0) {
+                        disconnect(c);
+                        return -1;
+                }
+                c->buf_len += n;
+        }
+        *end = 0;
+        if (sscanf(c->buf, "HTTP/1.1 %d", &c->status) != 1) {
+                disconnect(c);
+                return -1;
+        }
+        c->content_length = 0;
+        char *nl = strchr(c->buf, '\n'), *save;
+        for (char *line = nl != NULL ? strtok_r(nl + 1, "\r\n", &save) : NULL; line != NULL;
+             line = strtok_r(NULL, "\r\n", &save)) {
+                char *colon = strchr(line, ':');
+                if (colon == NULL)
+                        continue;
+                *colon = 0;
+                char *value = colon + 1 + strspn(colon + 1, " ");
+                if (strcasecmp(line, "Content-Length") == 0)
+                        c->content_length = atoi(value);
+                if (strcasecmp(line, "Connection") == 0 && strcasecmp(value, "close") == 0)
+                        c->close = true;
+                if (c->event_handler != NULL) {
+                        esp_http_client_event_t ev = {
+                                .event_id = HTTP_EVENT_ON_HEADER,
+                                .client = c,
+                                .user_data = c->user_data,
+                                .header_key = line,
+                                .header_value = value,
+                        };
+                        c->event_handler(&ev);
+                }
+        }
+        c->buf_pos = end + 4 - c->buf;
+        c->left = c->method == HTTP_METHOD_HEAD || c->status == 304 ? 0 : c->content_length;
+        return c->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c)
+{
+        return c->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t c, char *buffer, int len)
+{
+        int n = 0;
+
+        if (c->left < 0)
+                return -1;
+        while (n < len && c->left > 0) {
+                int want = len - n < c->left ? len - n : c->left;
+                if (c->buf_pos == c->buf_len) {
+                        // large reads skip the buffer
+                        char *to = want >= sizeof c->buf ? buffer + n : c->buf;
+                        ssize_t got = recv(c->fd, to, to == c->buf ? sizeof c->buf : want, 0);
+                        if (got <= 0) {
+                                disconnect(c);
+                                return n > 0 ? n : -1;
+                        }
+                        if (to != c->buf) {
+                                n += got;
+                                c->left -= got;
+                                continue;
+                        }
+                        c->buf_pos = 0;
+                        c->buf_len = got;
+                }
+                int copy = c->buf_len - c->buf_pos < want ? c->buf_len - c->buf_pos : want;
+                memcpy(buffer + n, c->buf + c->buf_pos, copy);
+                c->buf_pos += copy;
+                c->left -= copy;
+                n += copy;
+        }
+        if (c->left == 0) {
+                // next response starts with an empty buffer
+                c->buf_pos = c->buf_len = 0;
+        }
+        return n;
+}
+
+int esp_http_client_read_response(esp_http_client_handle_t c, char *buffer, int len)
+{
+        return esp_http_client_read(c, buffer, len);
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c)
+{
+        disconnect(c);
+        return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c)
+{
+        if (c == NULL)
+                return ESP_FAIL;
+        disconnect(c);
+        free(c);
+        return ESP_OK;
+}
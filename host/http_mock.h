@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+  Local HTTP/1.1 server behind the esp_http_client API of
+  include/esp_http_client.h. Clients connect to it whatever host the URL
+  names, as if DNS pointed there, and keep connections alive as the IDF
+  client does: a response read to its end leaves the connection open for
+  the next request, one that isn't forces a new connection. Files are
+  served from a table; paths not in it are 404, and a request whose
+  If-None-Match is the ETag of a file gets 304 Not Modified.
+ */
+struct http_mock_stats {
+        unsigned long clients;          // esp_http_client_init() calls
+        unsigned long connections;
+        unsigned long requests;
+        unsigned long not_modified;     // 304 responses
+        unsigned long bytes;            // sent by the server, headers included
+};
+extern struct http_mock_stats http_mock_stats;
+
+// path is absolute, e.g. "/ota/sensor.manifest"; etag may be NULL
+void http_mock_file(const char *path, const void *body, int len, const char *etag);
+void http_mock_remove(const char *path);
+void http_mock_clear(void);
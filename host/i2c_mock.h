@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+
+/*
+  Mock I2C bus: each address is a 256 byte register file with auto
+  increment. Transactions are counted, so the cost of a driver code path
+  is visible without hardware.
+ */
+struct i2c_mock_device {
+        uint8_t addr;
+        uint8_t reg[256];
+        // called after a register write, e.g. to emulate conversion start
+        void (*written)(struct i2c_mock_device *dev, uint8_t reg);
+};
+
+extern unsigned long i2c_mock_transactions;
+
+// attach a device to the bus, at most 4
+void i2c_mock_attach(struct i2c_mock_device *dev);
+void i2c_mock_detach_all(void);
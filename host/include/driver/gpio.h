@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+  GPIO of the mock SPI bus in spi_mock.c: outputs keep the level last
+  set, inputs read what a test put into spi_mock_gpio[].
+ */
+typedef int gpio_num_t;
+
+#define BIT64(n) (1ull << (n))
+
+typedef enum {
+        GPIO_MODE_INPUT = 1,
+        GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+typedef enum {
+        GPIO_PULLUP_DISABLE,
+        GPIO_PULLUP_ENABLE,
+} gpio_pullup_t;
+
+typedef struct {
+        uint64_t pin_bit_mask;
+        gpio_mode_t mode;
+        gpio_pullup_t pull_up_en;
+} gpio_config_t;
+
+esp_err_t gpio_config(const gpio_config_t *cfg);
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
+int gpio_get_level(gpio_num_t gpio);
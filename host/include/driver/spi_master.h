@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/*
+  Subset of the ESP-IDF SPI master driver backed by the mock bus in
+  spi_mock.c. Transmit only, one device per bus.
+ */
+typedef int spi_host_device_t;
+typedef struct spi_mock_device *spi_device_handle_t;
+
+#define SPI_DEVICE_3WIRE        (1 << 2)
+#define SPI_DEVICE_HALFDUPLEX   (1 << 4)
+
+typedef struct {
+        int mosi_io_num;
+        int miso_io_num;
+        int sclk_io_num;
+        int quadwp_io_num;
+        int quadhd_io_num;
+} spi_bus_config_t;
+
+typedef struct {
+        uint8_t mode;
+        uint16_t cs_ena_pretrans;
+        uint8_t cs_ena_posttrans;
+        int clock_speed_hz;
+        int spics_io_num;
+        uint32_t flags;
+        int queue_size;
+} spi_device_interface_config_t;
+
+typedef struct {
+        uint32_t flags;
+        size_t length;                  // bits
+        const void *tx_buffer;
+        void *rx_buffer;
+} spi_transaction_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma_chan);
+esp_err_t spi_bus_free(spi_host_device_t host);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg,
+                             spi_device_handle_t *handle);
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle);
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans);
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans, TickType_t wait);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans, TickType_t wait);
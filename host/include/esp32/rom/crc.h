@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+
+// CRC-32 of the ROM, same as zlib's crc32(): bits reflected, inverted on input and output
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+        crc = ~crc;
+        while (len--) {
+                crc ^= *buf++;
+                for (int i = 0; i < 8; i++)
+                        crc = crc >> 1 ^ (0xedb88320 & -(crc & 1));
+        }
+        return ~crc;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+
+// mock hardware has no timing
+static inline void ets_delay_us(uint32_t us)
+{
+}
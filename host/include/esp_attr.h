@@ -0,0 +1,3 @@
+#pragma once
+// no RTC memory on host: state is kept for the life of the process
+#define RTC_DATA_ATTR
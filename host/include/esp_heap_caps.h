@@ -0,0 +1,15 @@
+#pragma once
+#include <stdlib.h>
+
+// host memory is all DMA capable
+#define MALLOC_CAP_DMA (1 << 3)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+        return malloc(size);
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+        free(ptr);
+}
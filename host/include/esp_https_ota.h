@@ -0,0 +1,6 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+// full image from config->url into the next update partition, see ota_mock.h
+esp_err_t esp_https_ota(const esp_http_client_config_t *config);
@@ -0,0 +1,5 @@
+#pragma once
+
+// host build is neither of the targets esp-idf-lib drivers know
+#define HELPER_TARGET_IS_ESP32          0
+#define HELPER_TARGET_IS_ESP8266        0
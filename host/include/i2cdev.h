@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+  Subset of esp-idf-lib i2cdev backed by the mock bus in i2c_mock.c.
+ */
+typedef int i2c_port_t;
+typedef int gpio_num_t;
+
+typedef struct {
+        int sda_io_num;
+        int scl_io_num;
+} i2c_config_t;
+
+typedef struct {
+        i2c_port_t port;
+        i2c_config_t cfg;
+        uint8_t addr;
+} i2c_dev_t;
+
+esp_err_t i2c_dev_create_mutex(i2c_dev_t *dev);
+esp_err_t i2c_dev_delete_mutex(i2c_dev_t *dev);
+esp_err_t i2c_dev_read_reg(const i2c_dev_t *dev, uint8_t reg, void *data, size_t size);
+esp_err_t i2c_dev_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *data, size_t size);
+
+// single bus, no concurrent users
+#define I2C_DEV_TAKE_MUTEX(dev) do {} while (0)
+#define I2C_DEV_GIVE_MUTEX(dev) do {} while (0)
+#define I2C_DEV_CHECK(dev, X) do {                                      \
+                esp_err_t ___ = X;                                      \
+                if (___ != ESP_OK)                                      \
+                        return ___;                                     \
+        } while (0)
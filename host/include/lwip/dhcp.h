@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+#define DHCP_BOOT_FILE_LEN 128U
+
+typedef struct {
+        uint32_t addr;
+} ip4_addr_t;
@@ -0,0 +1,7 @@
+#pragma once
+// lwip socket API is BSD compatible
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
@@ -0,0 +1,96 @@
+/*
+  UDP stand-in for the ESP-NOW air link (see espnow_link.h): frames are
+  datagrams to 127.0.0.1, port YAWS_LINK_PORT. A frame is "acknowledged"
+  once sendto() takes it. A listener without YAWS_LINK_PORT binds any
+  free port, senders in the same process send there.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "lwip/sockets.h"
+#include "esp_log.h"
+#include "espnow_frame.h"
+#include "espnow_link.h"
+
+static const char *TAG = "yaws-espnow";
+
+// locally administered, as a real one would come from efuse
+static const uint8_t host_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+static int tx = -1, rx = -1;
+static struct sockaddr_in peer;
+static void (*listener)(const uint8_t *buf, int len);
+
+static void peer_init()
+{
+        const char *port = getenv("YAWS_LINK_PORT");
+        if (peer.sin_family != 0)
+                return;
+        peer.sin_family = AF_INET;
+        peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        peer.sin_port = htons(port != NULL ? atoi(port) : 0);
+}
+
+esp_err_t espnow_link_open(uint8_t *mac)
+{
+        peer_init();
+        if (tx < 0 && (tx = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+                ESP_LOGE(TAG, "socket: %s", strerror(errno));
+                return ESP_FAIL;
+        }
+        memcpy(mac, host_mac, 6);
+        return ESP_OK;
+}
+
+esp_err_t espnow_link_send(const void *buf, int len)
+{
+        if (tx < 0 || peer.sin_port == 0)
+                return ESP_ERR_INVALID_STATE;
+        if (len > ESPNOW_FRAME_MAX)
+                return ESP_ERR_INVALID_SIZE;
+        if (sendto(tx, buf, len, 0, (struct sockaddr *)&peer, sizeof peer) != len)
+                return ESP_FAIL;
+        return ESP_OK;
+}
+
+static void *listen_task(void *arg)
+{
+        uint8_t buf[ESPNOW_FRAME_MAX + 1];
+        for (;;) {
+                int n = recv(rx, buf, sizeof buf, 0);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return NULL;
+                // ESP-NOW drops what doesn't fit into a frame
+                if (n <= ESPNOW_FRAME_MAX)
+                        listener(buf, n);
+        }
+}
+
+esp_err_t espnow_link_listen(void (*fn)(const uint8_t *buf, int len))
+{
+        socklen_t len = sizeof peer;
+        pthread_t thread;
+
+        peer_init();
+        listener = fn;
+        rx = socket(AF_INET, SOCK_DGRAM, 0);
+        if (rx < 0 || bind(rx, (struct sockaddr *)&peer, sizeof peer) != 0 ||
+            getsockname(rx, (struct sockaddr *)&peer, &len) != 0) {
+                ESP_LOGE(TAG, "listen: %s", strerror(errno));
+                return ESP_FAIL;
+        }
+        if (pthread_create(&thread, NULL, listen_task, NULL) != 0)
+                return ESP_FAIL;
+        pthread_detach(thread);
+        ESP_LOGI(TAG, "listening on 127.0.0.1:%d", ntohs(peer.sin_port));
+        return ESP_OK;
+}
+
+void espnow_link_close(void)
+{
+        if (tx >= 0)
+                close(tx);
+        tx = -1;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "esp_ota_ops.h"
+
+/*
+  Running image and the update partition behind the esp_ota_* API, on
+  partitions of flash_mock.h. esp_https_ota() downloads with the client
+  of http_mock.h. Updates are written in pieces of any size, as the IDF
+  takes them, though flash_mock.h is written by words. The partition an update set to boot from is
+  ota_mock_boot, NULL until then.
+ */
+extern esp_app_desc_t ota_mock_app;
+extern const esp_partition_t *ota_mock_boot;
+
+void ota_mock_init(const esp_partition_t *running, const esp_partition_t *next);
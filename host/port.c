@@ -0,0 +1,252 @@
+/*
+  Minimal FreeRTOS, ESP-IDF and wifi component API on top of POSIX, enough
+  to run components on Linux unchanged.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "wifi.h"
+
+struct host_task {
+        pthread_t thread;
+        TaskFunction_t fn;
+        void *arg;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        uint32_t notify;
+};
+
+static __thread struct host_task *current;
+
+static void *task_main(void *arg)
+{
+        struct host_task *t = arg;
+        current = t;
+        t->fn(t->arg);
+        return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                       UBaseType_t prio, TaskHandle_t *handle)
+{
+        struct host_task *t = calloc(1, sizeof *t);
+        if (t == NULL)
+                return pdFAIL;
+        t->fn = fn;
+        t->arg = arg;
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->cond, NULL);
+        if (handle != NULL)
+                *handle = t;
+        if (pthread_create(&t->thread, NULL, task_main, t) != 0) {
+                free(t);
+                if (handle != NULL)
+                        *handle = NULL;
+                return pdFAIL;
+        }
+        pthread_detach(t->thread);
+        return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+        if (task == NULL || task == current)
+                pthread_exit(NULL);
+        pthread_cancel(task->thread);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+        return current;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+        usleep(ticks * 1000 * portTICK_PERIOD_MS);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+        pthread_mutex_lock(&task->lock);
+        task->notify++;
+        pthread_cond_signal(&task->cond);
+        pthread_mutex_unlock(&task->lock);
+        return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+        struct host_task *t = current;
+        uint32_t n;
+
+        pthread_mutex_lock(&t->lock);
+        if (wait == portMAX_DELAY) {
+                while (t->notify == 0)
+                        pthread_cond_wait(&t->cond, &t->lock);
+        } else if (t->notify == 0 && wait > 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += wait / 1000;
+                ts.tv_nsec += (wait % 1000) * 1000000;
+                if (ts.tv_nsec >= 1000000000) {
+                        ts.tv_sec++;
+                        ts.tv_nsec -= 1000000000;
+                }
+                while (t->notify == 0 && pthread_cond_timedwait(&t->cond, &t->lock, &ts) == 0)
+                        ;
+        }
+        n = t->notify;
+        if (clear)
+                t->notify = 0;
+        else if (n > 0)
+                t->notify--;
+        pthread_mutex_unlock(&t->lock);
+        return n;
+}
+
+struct host_mutex {
+        pthread_mutex_t m;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+        struct host_mutex *sem = malloc(sizeof *sem);
+        if (sem != NULL)
+                pthread_mutex_init(&sem->m, NULL);
+        return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+        struct host_mutex *sem = malloc(sizeof *sem);
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        if (sem != NULL)
+                pthread_mutex_init(&sem->m, &attr);
+        pthread_mutexattr_destroy(&attr);
+        return sem;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+        pthread_mutex_destroy(&sem->m);
+        free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+        if (wait == portMAX_DELAY)
+                return pthread_mutex_lock(&sem->m) == 0 ? pdTRUE : pdFALSE;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += wait / 1000;
+        ts.tv_nsec += (wait % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+        }
+        return pthread_mutex_timedlock(&sem->m, &ts) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+        return pthread_mutex_unlock(&sem->m) == 0 ? pdTRUE : pdFALSE;
+}
+
+/* logging */
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+static vprintf_like_t log_vprintf = vprintf;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+        // levels are global on host
+        if (strcmp(tag, "*") == 0)
+                log_level = level;
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+        vprintf_like_t old = log_vprintf;
+        log_vprintf = func;
+        return old;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+        return xTaskGetTickCount();
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+        va_list va;
+        if (level > log_level)
+                return;
+        va_start(va, format);
+        log_vprintf(format, va);
+        va_end(va);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+        switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        default: return "UNKNOWN ERROR";
+        }
+}
+
+void esp_error_check_failed(esp_err_t err, const char *file, int line, const char *expr)
+{
+        fprintf(stderr, "%s:%d: %s failed: %s\n", file, line, expr, esp_err_to_name(err));
+        abort();
+}
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+        size_t len = strlen(src);
+        if (size > 0) {
+                size_t n = len < size - 1 ? len : size - 1;
+                memcpy(dst, src, n);
+                dst[n] = 0;
+        }
+        return len;
+}
+#endif
+
+/* wifi component: network of the host is always up */
+
+int wifi_connected()
+{
+        return 1;
+}
+
+char *macstr(const char *prefix, const char *suffix)
+{
+        static char buf[64];
+        snprintf(buf, sizeof buf, "%s00:00:00:00:00:00%s", prefix, suffix);
+        return buf;
+}
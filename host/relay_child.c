@@ -0,0 +1,46 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "lwip/sockets.h"
+#include "relay_child.h"
+
+int loopback_socket(int type, bool listening, int *port)
+{
+        struct sockaddr_in a = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+        socklen_t len = sizeof a;
+        int fd = socket(AF_INET, type, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&a, sizeof a) != 0 ||
+            getsockname(fd, (struct sockaddr *)&a, &len) != 0 || (listening && listen(fd, 1) != 0)) {
+                perror("loopback_socket");
+                exit(1);
+        }
+        *port = ntohs(a.sin_port);
+        return fd;
+}
+
+pid_t relay_child_start(const char *path, int carbon_port, int *port, const char *opt, const char *arg)
+{
+        char listen_arg[16], carbon_arg[32];
+
+        // the port is free again by the time the relay binds it, most likely
+        close(loopback_socket(SOCK_DGRAM, false, port));
+        snprintf(listen_arg, sizeof listen_arg, "%d", *port);
+        snprintf(carbon_arg, sizeof carbon_arg, "127.0.0.1:%d", carbon_port);
+        pid_t relay = fork();
+        if (relay == 0) {
+                execl(path, "yaws-relay", "-l", listen_arg, "-c", carbon_arg, opt, arg, NULL);
+                perror(path);
+                _exit(1);
+        }
+        usleep(200000);
+        return relay;
+}
+
+void relay_child_stop(pid_t relay)
+{
+        kill(relay, SIGTERM);
+        waitpid(relay, NULL, 0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+  yaws-relay run as a child process, for tests and benchmarks that look
+  at what it passes on to a fake carbon. Sockets are on 127.0.0.1, on
+  ports the kernel picks.
+ */
+
+// exits if the socket can't be had; a stream socket refuses connections until listen()
+int loopback_socket(int type, bool listening, int *port);
+// relay listening on a free UDP port, returned in *port; opt and arg may be NULL
+pid_t relay_child_start(const char *path, int carbon_port, int *port, const char *opt, const char *arg);
+void relay_child_stop(pid_t relay);
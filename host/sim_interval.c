@@ -0,0 +1,155 @@
+/*
+  Replay temperature traces through the adaptive sleep interval (see
+  sensor/main/interval.h) and report wakes per day against the error of
+  the signal reconstructed from the samples by linear interpolation, the
+  way Graphite draws it.
+
+  build-host/yaws-sim-interval [TRACE...]
+
+  A trace is a text file of "<unix time> <°C>" lines, e.g. exported from
+  Graphite with format=csv and commas replaced by spaces. Without
+  arguments a synthetic week is replayed: daily swing, heating steps and
+  sensor noise.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "interval.h"
+
+struct trace {
+        long n;
+        uint32_t *ts;   // s since the first point
+        int32_t *v;     // 0.01 °C
+};
+
+static void push(struct trace *t, uint32_t ts, int32_t v)
+{
+        if ((t->n & (t->n + 1)) == 0 || t->n == 0) {
+                t->ts = realloc(t->ts, (2 * t->n + 2) * sizeof *t->ts);
+                t->v = realloc(t->v, (2 * t->n + 2) * sizeof *t->v);
+        }
+        t->ts[t->n] = ts;
+        t->v[t->n] = v;
+        t->n++;
+}
+
+static struct trace load(const char *path)
+{
+        struct trace t = {0};
+        double ts, v, start = -1;
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+                perror(path);
+                exit(1);
+        }
+        while (fscanf(f, "%lf %lf", &ts, &v) == 2) {
+                if (start < 0)
+                        start = ts;
+                push(&t, ts - start, lround(v * 100));
+        }
+        fclose(f);
+        return t;
+}
+
+// a minute resolution week of an indoor sensor
+static struct trace synthetic(void)
+{
+        struct trace t = {0};
+        srand(1);
+        for (uint32_t ts = 0; ts < 7 * 86400; ts += 60) {
+                double day = fmod(ts, 86400) / 86400;
+                double c = 20 + 2 * sin(2 * M_PI * (day - 0.35));
+                // heating on in the morning, ramps up within half an hour
+                double since = day - 0.27;
+                if (since > 0 && day < 0.9)
+                        c += 3 * (1 - exp(-since * 86400 / 600));
+                c += (rand() % 7 - 3) * 0.01;
+                // ADT7410 13-bit resolution
+                push(&t, ts, lround(round(c * 16) / 16 * 100));
+        }
+        return t;
+}
+
+static int32_t at(const struct trace *t, long *i, uint32_t ts)
+{
+        while (*i + 1 < t->n && t->ts[*i + 1] <= ts)
+                (*i)++;
+        return t->v[*i];
+}
+
+static void run(const char *name, const struct trace *t, const struct interval_config *c, int32_t vdd)
+{
+        struct interval s = {0};
+        uint32_t *wts = malloc(t->n * sizeof *wts);
+        int32_t *wv = malloc(t->n * sizeof *wv);
+        long wakes = 0, i = 0;
+        uint32_t end = t->ts[t->n - 1];
+
+        for (uint32_t ts = 0; ts <= end && wakes < t->n; ) {
+                int32_t v = at(t, &i, ts);
+                wts[wakes] = ts;
+                wv[wakes++] = v;
+                ts += interval_next(&s, c, true, v, ts, vdd);
+        }
+
+        // linear interpolation between samples against every trace point
+        double sum = 0, max = 0;
+        long w = 0, points = 0;
+        for (long k = 0; k < t->n; k++) {
+                uint32_t ts = t->ts[k];
+                while (w + 1 < wakes && wts[w + 1] <= ts)
+                        w++;
+                if (w + 1 >= wakes)
+                        break;
+                double r = wv[w] + (double)(wv[w + 1] - wv[w]) * (ts - wts[w]) / (wts[w + 1] - wts[w]);
+                double e = fabs(r - t->v[k]) / 100;
+                sum += e * e;
+                if (e > max)
+                        max = e;
+                points++;
+        }
+        printf("%-28s %9.0f %8.3f %8.3f\n", name, wakes * 86400.0 / (end + 1),
+               points ? sqrt(sum / points) : 0, max);
+        free(wts);
+        free(wv);
+}
+
+static void replay(const char *title, const struct trace *t)
+{
+        char name[64];
+        printf("%s: %ld points, %.1f days\n", title, t->n, t->ts[t->n - 1] / 86400.0);
+        printf("%-28s %9s %8s %8s\n", "", "wakes/day", "rms °C", "max °C");
+
+        // the interval before adaptive scheduling
+        for (int s = 60; s <= 600; s *= 2) {
+                struct interval_config fixed = {s, s, 1, 3700, 3300};
+                snprintf(name, sizeof name, "fixed %d s", s);
+                run(name, t, &fixed, 3700);
+        }
+        for (int delta = 5; delta <= 40; delta *= 2) {
+                struct interval_config c = {60, 600, delta, 3700, 3300};
+                snprintf(name, sizeof name, "adaptive %.2f °C", delta / 100.0);
+                run(name, t, &c, 3700);
+        }
+        struct interval_config c = {60, 600, 10, 3700, 3300};
+        run("adaptive 0.10 °C, 3.5 V", t, &c, 3500);
+        run("adaptive 0.10 °C, cutoff", t, &c, 3300);
+}
+
+int main(int argc, char **argv)
+{
+        if (argc == 1) {
+                struct trace t = synthetic();
+                replay("synthetic week", &t);
+        }
+        for (int i = 1; i < argc; i++) {
+                struct trace t = load(argv[i]);
+                if (t.n < 2) {
+                        fprintf(stderr, "%s: too short\n", argv[i]);
+                        return 1;
+                }
+                replay(argv[i], &t);
+        }
+        return 0;
+}
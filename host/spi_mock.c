@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "spi_mock.h"
+
+#define QUEUE 16
+
+uint16_t spi_mock_wire[SPI_MOCK_WIRE];
+long spi_mock_wire_len;
+struct spi_mock_stats spi_mock_stats;
+uint8_t spi_mock_gpio[64];
+int spi_mock_dc_pin = -1;
+
+struct spi_mock_device {
+        int queue_size;
+        spi_transaction_t *queue[QUEUE];
+        int head, count;
+};
+
+static void error(const char *what)
+{
+        if (spi_mock_stats.errors++ < 10)
+                fprintf(stderr, "spi_mock: %s\n", what);
+}
+
+void spi_mock_reset(void)
+{
+        spi_mock_wire_len = 0;
+        spi_mock_stats = (struct spi_mock_stats){0};
+}
+
+esp_err_t gpio_config(const gpio_config_t *cfg)
+{
+        return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+        if (gpio < 0 || gpio >= sizeof spi_mock_gpio)
+                return ESP_ERR_INVALID_ARG;
+        spi_mock_gpio[gpio] = level != 0;
+        return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+        return gpio >= 0 && gpio < sizeof spi_mock_gpio ? spi_mock_gpio[gpio] : 0;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma_chan)
+{
+        return ESP_OK;
+}
+
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+        return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg,
+                             spi_device_handle_t *handle)
+{
+        struct spi_mock_device *dev = calloc(1, sizeof *dev);
+        if (dev == NULL)
+                return ESP_ERR_NO_MEM;
+        dev->queue_size = cfg->queue_size < QUEUE ? cfg->queue_size : QUEUE;
+        *handle = dev;
+        return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t dev)
+{
+        if (dev->count != 0)
+                error("device removed with transactions in flight");
+        free(dev);
+        return ESP_OK;
+}
+
+// the transfer itself
+static void wire(const spi_transaction_t *t)
+{
+        const uint8_t *p = t->tx_buffer;
+        uint16_t dc = spi_mock_dc_pin >= 0 && spi_mock_gpio[spi_mock_dc_pin] ? SPI_MOCK_DATA : 0;
+        if (t->length % 8 != 0)
+                error("length is not whole bytes");
+        for (size_t i = 0; i < t->length / 8 && spi_mock_wire_len < SPI_MOCK_WIRE; i++)
+                spi_mock_wire[spi_mock_wire_len++] = dc | p[i];
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t dev, spi_transaction_t *t, TickType_t wait)
+{
+        if (dev->count == dev->queue_size) {
+                // a real queue would block forever: nothing else takes results
+                error("queue is full");
+                return ESP_ERR_TIMEOUT;
+        }
+        dev->queue[(dev->head + dev->count++) % QUEUE] = t;
+        spi_mock_stats.transactions++;
+        if (dev->count > spi_mock_stats.queued_max)
+                spi_mock_stats.queued_max = dev->count;
+        return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t dev, spi_transaction_t **t, TickType_t wait)
+{
+        if (dev->count == 0) {
+                error("no transaction to wait for");
+                return ESP_ERR_TIMEOUT;
+        }
+        *t = dev->queue[dev->head];
+        dev->head = (dev->head + 1) % QUEUE;
+        dev->count--;
+        wire(*t);
+        return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t dev, spi_transaction_t *t)
+{
+        // the driver returns the oldest queued transaction instead
+        if (dev->count != 0)
+                error("transmit with transactions in flight");
+        spi_mock_stats.transactions++;
+        wire(t);
+        return ESP_OK;
+}
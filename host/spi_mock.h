@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+/*
+  Mock SPI bus with a panel at its end. Bytes that reach the panel are
+  appended to spi_mock_wire[], each with the level of the D/C pin in bit
+  8: a command byte has it clear. A queued transaction is read when its
+  result is taken, as DMA reads the buffer until the transfer is done,
+  so a buffer reused too early shows up as wrong bytes, and so does D/C
+  changed under a transfer. Misuse of the driver API is counted in
+  spi_mock_errors.
+ */
+#define SPI_MOCK_WIRE (1 << 20)
+#define SPI_MOCK_DATA 0x100
+
+extern uint16_t spi_mock_wire[SPI_MOCK_WIRE];
+extern long spi_mock_wire_len;
+
+struct spi_mock_stats {
+        unsigned long transactions;     // transmitted and queued
+        unsigned long queued_max;       // most transactions in flight at once
+        unsigned long errors;
+};
+extern struct spi_mock_stats spi_mock_stats;
+
+// level of a GPIO: set by the driver for outputs, by the test for inputs
+extern uint8_t spi_mock_gpio[64];
+// pin whose level goes into bit 8 of the wire
+extern int spi_mock_dc_pin;
+
+void spi_mock_reset(void);
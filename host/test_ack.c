@@ -0,0 +1,272 @@
+/*
+  Acknowledged delivery over a lossy link: a node keeps its samples in a
+  ring as the sensor does in RTC memory, sends them in binary frames to
+  yaws-relay, which drops a share of the frames and of the
+  acknowledgements (-d), and every sample must reach the fake carbon.
+  The same goes for frames the relay has no room for while carbon is
+  down.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+// packet_send() is pointed at the relay through the socket address of graphite.c
+#include "graphite.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "relay_child.h"
+
+uint8_t mac_addr[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+#define PREFIX "yaws.sensor_02:00:00:00:00:01"
+#define LOSS "30"
+#define SAMPLES 8               // as in sensor/main/main.c
+#define WAKES 100
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char lines[1 << 20];
+static int lines_len;
+
+static void *carbon(void *arg)
+{
+        int fd = accept(*(int *)arg, NULL, NULL);
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof buf)) > 0) {
+                pthread_mutex_lock(&lock);
+                if (lines_len + n < sizeof lines) {
+                        memcpy(lines + lines_len, buf, n);
+                        lines_len += n;
+                }
+                pthread_mutex_unlock(&lock);
+        }
+        return NULL;
+}
+
+static int relay_port;
+
+// a new wake: new socket, as after deep sleep
+static void wake(void)
+{
+        graphite_close();
+        CHECK(graphite_init() == ESP_OK, "graphite_init");
+        addr.sin_port = htons(relay_port);
+}
+
+struct sample {
+        uint32_t ts;
+        int32_t value[4];
+};
+
+static const struct {
+        const char *name;
+        int precision;
+} metric[] = {
+        {"temperature", 2}, {"pressure", 0}, {"humidity", 1}, {"voltage", 3},
+};
+
+static struct sample ring[SAMPLES];
+static int head, count;
+
+// batch_flush() of the sensor
+static esp_err_t flush(void)
+{
+        esp_err_t err = graphite_tx_publish(PREFIX);
+        int sent = 0;
+        for (int i = 0; i < count && err == ESP_OK; i++) {
+                const struct sample *s = &ring[(head + i) % SAMPLES];
+                uint32_t datagrams = graphite_batch_sent();
+                for (int m = 0; m < 4 && err == ESP_OK; m++)
+                        err = graphite_batch_add_fixed(PREFIX, metric[m].name, s->value[m], metric[m].precision, s->ts);
+                if (graphite_batch_sent() != datagrams)
+                        sent = i;
+        }
+        if (err == ESP_OK)
+                err = graphite_batch_flush();
+        if (err == ESP_OK) {
+                head = count = 0;
+        } else {
+                head = (head + sent) % SAMPLES;
+                count -= sent;
+        }
+        return err;
+}
+
+static char expected[WAKES][4][96];
+static bool overwritten[WAKES];
+static uint32_t epoch;
+
+// sample of wake w into the ring, the oldest one is overwritten if it is full
+static int measure(int w)
+{
+        struct sample s = { .ts = epoch + w * 60 };
+        int lost = 0;
+
+        for (int m = 0; m < 4; m++) {
+                char v[24];
+                s.value[m] = 1000 * m + w;
+                fixtoa(v, sizeof v, s.value[m], metric[m].precision);
+                snprintf(expected[w][m], sizeof expected[w][m], PREFIX ".%s %s %u\n",
+                         metric[m].name, v, s.ts);
+        }
+        if (count == SAMPLES) {
+                overwritten[(ring[head].ts - epoch) / 60] = true;
+                head = (head + 1) % SAMPLES;
+                count--;
+                lost++;
+        }
+        ring[(head + count++) % SAMPLES] = s;
+        return lost;
+}
+
+// lines of samples not overwritten that carbon hasn't got
+static int missing(int wakes)
+{
+        int missing = 0;
+        for (int i = 0; i < 1000; i++) {
+                usleep(1000);
+                pthread_mutex_lock(&lock);
+                lines[lines_len] = 0;
+                missing = 0;
+                for (int w = 0; w < wakes; w++)
+                        for (int m = 0; m < 4; m++)
+                                missing += !overwritten[w] && strstr(lines, expected[w][m]) == NULL;
+                pthread_mutex_unlock(&lock);
+                if (missing == 0)
+                        break;
+        }
+        return missing;
+}
+
+static void test_lossy(void)
+{
+        int ok = 0, lost = 0, lines_n = 0;
+
+        epoch = 1700000000;
+        for (int w = 0; w < WAKES; w++) {
+                lost += measure(w);
+                wake();
+                ok += flush() == ESP_OK;
+        }
+        // until the ring is empty, as the sensor would on later wakes
+        for (int w = 0; w < 20 && count > 0; w++) {
+                wake();
+                ok += flush() == ESP_OK;
+        }
+        graphite_close();
+        CHECK(count == 0, "%d samples never acknowledged", count);
+
+        int n = missing(WAKES);
+        CHECK(n == 0, "%d lines missing in carbon", n);
+        // the counters of test_no_relay() got through, and are reset; a
+        // frame whose acknowledgements were all lost may carry them twice
+        pthread_mutex_lock(&lock);
+        CHECK(strstr(lines, PREFIX ".tx.fail 5 ") != NULL, "tx counters of a failed batch lost");
+        pthread_mutex_unlock(&lock);
+        CHECK(graphite_tx.fail == 0 && graphite_tx.noack == 0, "tx: %u fail, %u noack not reset", graphite_tx.fail,
+              graphite_tx.noack);
+        for (int i = 0; i < lines_len; i++)
+                lines_n += lines[i] == '\n';
+        printf("lossy link: %d of %d flushes acknowledged, %d samples overwritten, %d lines in carbon\n",
+               ok, WAKES, lost, lines_n);
+        CHECK(ok < WAKES, "no flush failed at " LOSS "%% loss");
+}
+
+/*
+  Carbon is down and the relay has room for a few frames: a frame that
+  doesn't fit is not acknowledged, and its retransmission must not be
+  taken for a duplicate, or the node lets go of samples carbon never
+  gets.
+ */
+#define FULL_WAKES 40           // with carbon down
+
+static void test_full(void)
+{
+        int carbon_port, ok = 0, lost = 0;
+        int fd = loopback_socket(SOCK_STREAM, false, &carbon_port);
+        pid_t relay = relay_child_start(YAWS_RELAY, carbon_port, &relay_port, "-b", "4096");
+        pthread_t thread;
+
+        epoch = 1800000000;
+        head = count = 0;
+        memset(overwritten, 0, sizeof overwritten);
+        int w;
+        for (w = 0; w < WAKES && (w < FULL_WAKES || count > 0); w++) {
+                if (w == FULL_WAKES) {
+                        CHECK(ok < FULL_WAKES, "relay has room for all samples");
+                        listen(fd, 1);
+                        pthread_create(&thread, NULL, carbon, &fd);
+                }
+                // the relay reconnects with backoff
+                if (w >= FULL_WAKES)
+                        usleep(100000);
+                lost += measure(w);
+                wake();
+                ok += flush() == ESP_OK;
+        }
+        graphite_close();
+        CHECK(count == 0, "%d samples never acknowledged", count);
+        int n = missing(w);
+        CHECK(n == 0, "%d lines missing in carbon", n);
+        printf("relay full: %d of %d flushes acknowledged, %d samples overwritten\n", ok, w, lost);
+        relay_child_stop(relay);
+        pthread_join(thread, NULL);
+        close(fd);
+}
+
+// nobody answers: the batch fails, within the bounded wait
+static void test_no_relay(int port)
+{
+        int fd = loopback_socket(SOCK_DGRAM, false, &relay_port);
+        TickType_t start = xTaskGetTickCount();
+
+        wake();
+        head = 0;
+        count = 1;
+        ring[0] = (struct sample) { .ts = 1700000000 };
+        graphite_tx = (struct graphite_tx) { .magic = TX_MAGIC, .fail = 5 };
+        esp_err_t err = flush();
+        TickType_t ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+        CHECK(err == ESP_ERR_TIMEOUT && count == 1, "flush without acknowledgement: %s", esp_err_to_name(err));
+        // counters of a batch not delivered are kept for the next one
+        CHECK(graphite_tx.noack == 1 && graphite_tx.retry == 0 && graphite_tx.fail == 5 &&
+              graphite_tx.success == CONFIG_GRAPHITE_ACK_RETRIES + 1,
+              "tx: %u success, %u retry, %u fail, %u noack", graphite_tx.success, graphite_tx.retry,
+              graphite_tx.fail, graphite_tx.noack);
+        CHECK(ms >= CONFIG_GRAPHITE_ACK_TIMEOUT * (CONFIG_GRAPHITE_ACK_RETRIES + 1) &&
+              ms < CONFIG_GRAPHITE_ACK_TIMEOUT * (CONFIG_GRAPHITE_ACK_RETRIES + 1) + 100,
+              "waited %u ms for acknowledgement", (unsigned)ms);
+
+        // an acknowledgement of another frame is not taken for this one
+        uint8_t buf[ESPNOW_FRAME_MAX], ack[ESPNOW_FRAME_ACK_LEN];
+        struct sockaddr_in from;
+        socklen_t len = sizeof from;
+        int n = recvfrom(fd, buf, sizeof buf, MSG_DONTWAIT, (struct sockaddr *)&from, &len);
+        CHECK(n > ESPNOW_FRAME_HEADER, "frame not sent");
+        buf[7]++;
+        espnow_frame_ack(ack, buf);
+        sendto(fd, ack, sizeof ack, 0, (struct sockaddr *)&from, len);
+        CHECK(ack_wait(frame_seq - 1) == ESP_ERR_TIMEOUT, "acknowledgement of another frame is accepted");
+        graphite_close();
+        close(fd);
+        relay_port = port;
+}
+
+int main(void)
+{
+        int carbon_port;
+        int carbon_fd = loopback_socket(SOCK_STREAM, true, &carbon_port);
+        pthread_t thread;
+        pthread_create(&thread, NULL, carbon, &carbon_fd);
+
+        pid_t relay = relay_child_start(YAWS_RELAY, carbon_port, &relay_port, "-d", LOSS);
+        test_no_relay(relay_port);
+        test_lossy();
+        relay_child_stop(relay);
+
+        test_full();
+        return check_done();
+}
@@ -0,0 +1,203 @@
+/*
+  Sensor wakes against the RTC sample batch: samples taken on wakes
+  without WiFi must come out of a later flush once, in order, stamped
+  with the unix time they were taken at, within a second. Node time is
+  simulated: esp_log_timestamp() is time since the wake started and
+  deep sleep only moves the true clock. Covers a flush before the clock
+  was ever set (-1), batches every CONFIG_SENSOR_BATCH_WAKES wakes, and
+  a long time offline with samples spilled to the flash store. The dead
+  band drops values within its threshold until the heartbeat is due,
+  and wakes that queue nothing don't connect.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+// RTC memory is looked at directly
+#include "batch.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "flash_mock.h"
+#include "check.h"
+
+#define START 1700000000000ll   // true unix time of power-on, ms
+
+static int64_t now_ms = START;  // true unix time
+static uint32_t wake_ms;        // since the current wake started
+
+uint32_t __wrap_esp_log_timestamp(void)
+{
+        return wake_ms;
+}
+
+// samples as they were taken, values are unique
+#define MAX_SAMPLES 1024
+
+static struct {
+        int32_t value;
+        uint32_t ts;            // true unix time, s
+        bool arrived;
+} taken[MAX_SAMPLES];
+static int taken_n, arrived;
+static bool offline, sntp_ok;
+
+/*
+  Plaintext lines of a datagram, checked against taken[]. Samples left
+  in flash by a partial drain come after newer ones from RTC memory, so
+  the order is not checked.
+ */
+ssize_t __wrap_sendto(int fd, const void *buf, size_t len, int flags, const void *to, socklen_t tolen)
+{
+        const char *p = buf, *end = p + len;
+        while (p < end) {
+                const char *nl = memchr(p, '\n', end - p);
+                char line[128], v[16], *dot;
+                long ts;
+                int i = taken_n;
+                snprintf(line, sizeof line, "%.*s", (int)(nl - p), p);
+                p = nl + 1;
+                if (sscanf(line, "yaws.sensor_600194123456.temperature %15s %ld", v, &ts) == 2 &&
+                    (dot = strchr(v, '.')) != NULL && strlen(dot) == 3) {
+                        // precision 2: value is the digits without the point
+                        memmove(dot, dot + 1, 3);
+                        for (i = 0; i < taken_n && taken[i].value != atoi(v); i++)
+                                ;
+                }
+                CHECK(i < taken_n && !taken[i].arrived, "unexpected line: %s", line);
+                if (i == taken_n || taken[i].arrived)
+                        continue;
+                // unknown until the clock is set, stamped with the right time from then on
+                if (batch.epoch == 0)
+                        CHECK(ts == -1, "sample %d: %s, clock was never set", i, line);
+                else
+                        CHECK(ts >= taken[i].ts - 1 && ts <= taken[i].ts + 1,
+                              "sample %d: %s, taken at %u", i, line, taken[i].ts);
+                taken[i].arrived = true;
+                arrived++;
+        }
+        return len;
+}
+
+static int flushes;
+
+/*
+  One wake as app_main() does it: the sensor is read while WiFi
+  associates, and if a flush is due and WiFi is up, the clock is set by
+  SNTP and the batch is sent. Temperature changes by more than the dead
+  band every time, so that every wake queues a sample.
+ */
+static void wake(bool first)
+{
+        uint32_t awake_ms = 900 + taken_n * 37 % 800, sleep_s = 60 + taken_n * 13 % 240;
+
+        wake_ms = 120; // boot
+        batch_init();
+        batch_store_open();
+        bool flush = first || batch_flush_due();
+
+        wake_ms += 250;
+        struct sample s = { .ts = batch_uptime() };
+        int32_t value = 2000 + (taken_n % 2 ? -taken_n : taken_n) * 10;
+        sample_set(&s, METRIC_TEMPERATURE, value);
+        batch_deadband(&s);
+        CHECK(s.mask != 0, "sample %d in the dead band", taken_n);
+        batch_add(&s);
+        taken[taken_n].value = value;
+        taken[taken_n].ts = (now_ms + wake_ms) / 1000;
+        taken_n++;
+
+        wake_ms += 600; // association
+        if (flush && !offline) {
+                if (sntp_ok)
+                        batch_clock_set((now_ms + wake_ms) / 1000);
+                CHECK(batch_flush("yaws.sensor_600194123456") == ESP_OK, "flush failed");
+                flushes++;
+        }
+        if (flush)
+                batch_flush_done();
+
+        wake_ms = awake_ms;
+        batch_sleep(sleep_s);
+        now_ms += awake_ms + sleep_s * 1000ll;
+}
+
+#define T (1 << METRIC_TEMPERATURE)
+#define P (1 << METRIC_PRESSURE)
+
+static uint8_t deadband(uint32_t ts, int32_t temperature, int32_t pressure)
+{
+        struct sample s = { .ts = ts };
+        sample_set(&s, METRIC_TEMPERATURE, temperature);
+        sample_set(&s, METRIC_PRESSURE, pressure);
+        batch_deadband(&s);
+        return s.mask;
+}
+
+static void test_deadband(void)
+{
+        const int32_t t = 2000, p = 101325;
+
+        batch.magic = 0; // power-on
+        batch_init();
+        CHECK(deadband(100, t, p) == (T | P), "first values dropped");
+        CHECK(deadband(160, t + CONFIG_SENSOR_DEADBAND_TEMPERATURE, p - CONFIG_SENSOR_DEADBAND_PRESSURE) == 0,
+              "values within the dead band kept");
+        CHECK(deadband(220, t - CONFIG_SENSOR_DEADBAND_TEMPERATURE - 1, p) == T,
+              "value just past the dead band dropped");
+        // the band is around the value reported last, not the first one
+        CHECK(deadband(280, t - 1, p) == 0, "dead band not moved to the value reported");
+
+        // wakes as app_main() does them: a sample with nothing left is not
+        // queued, and nothing queued is no reason to connect
+        CHECK(batch.count == 0 && flashlog_empty(&store), "batch not empty");
+        for (int i = 0; i < 2 * CONFIG_SENSOR_BATCH_WAKES; i++) {
+                batch_init();
+                uint8_t mask = deadband(300 + 60 * i, t - 1, p + 1);
+                CHECK(mask == 0 && !batch_flush_due(), "wake %d: mask %x, flush due with nothing to send", i, mask);
+        }
+
+        // pressure was last reported at 100
+        CHECK(deadband(100 + CONFIG_SENSOR_HEARTBEAT - 1, t - 1, p) == 0, "heartbeat sent early");
+        CHECK(deadband(100 + CONFIG_SENSOR_HEARTBEAT, t - 1, p) == P, "no heartbeat");
+        CHECK(deadband(100 + CONFIG_SENSOR_HEARTBEAT + 60, t - 1, p) == 0, "heartbeat does not restart");
+
+        // while a sample that is queued is sent in time
+        struct sample s = { .ts = 100 + CONFIG_SENSOR_HEARTBEAT + 120 };
+        sample_set(&s, METRIC_TEMPERATURE, t + 100);
+        batch_deadband(&s);
+        batch_add(&s);
+        CHECK(batch_flush_due(), "no flush with a sample queued");
+}
+
+int main(void)
+{
+        const esp_partition_t *part = flash_mock_temp("samples", 8 * FLASHLOG_SECTOR);
+        if (part == NULL)
+                return 1;
+
+        esp_log_level_set("*", ESP_LOG_WARN);
+
+        // first wake after power-on flushes for the OTA check, SNTP fails
+        wake(true);
+        CHECK(arrived == 1, "first sample not sent");
+        sntp_ok = true;
+        for (int i = 0; i < 40; i++)
+                wake(false);
+        printf("online: %d samples taken, %d sent in %d flushes\n", taken_n, arrived, flushes);
+
+        // RTC memory overflows into flash
+        offline = true;
+        for (int i = 0; i < 120; i++)
+                wake(false);
+        int before = arrived;
+        offline = false;
+        flushes = 0;
+        for (int i = 0; i < 200 && (flushes < 2 || !flashlog_empty(&store)); i++)
+                wake(false);
+        printf("offline: %d samples taken, %d sent in %d flushes\n", taken_n, arrived - before, flushes);
+        CHECK(arrived + batch.count == taken_n, "%d samples taken, %d sent, %d queued", taken_n, arrived, batch.count);
+
+        test_deadband();
+        return check_done();
+}
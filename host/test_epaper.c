@@ -0,0 +1,264 @@
+/*
+  Streamed e-paper update against the buffered one it replaced: with the
+  picture written in pieces of any size, as HTTP reads return them, the
+  SPI byte stream must be the one the buffered path sent, a command, the
+  frame in one go and the refresh command, with at most two transfers
+  in flight. Partial updates are checked on a model of the controller
+  that replays the stream: after each update the panel must show the
+  picture, whichever bands were sent.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "epaper.h"
+#include "spi_mock.h"
+#include "check.h"
+
+#define WIDTH 800
+#define HEIGHT 480
+#define ROW (WIDTH / 8)
+#define FRAME (ROW * HEIGHT)
+#define BAND (FRAME / EPAPER_BANDS)
+#define FULL_REFRESH_EVERY 16   // default of CONFIG_DISPLAY_FULL_REFRESH_EVERY
+
+#define START_TRANSMISSION_2 0x13
+#define REFRESH 0x12
+#define PARTIAL_WINDOW 0x90
+#define PARTIAL_IN 0x91
+#define PARTIAL_OUT 0x92
+
+static const epaper_conf_t conf = {
+        .reset_pin = 1, .dc_pin = 2, .cs_pin = 3, .busy_pin = 4, .mosi_pin = 5, .sck_pin = 6,
+        .clk_freq_hz = 20000000,
+};
+
+static epaper_handle_t dev;
+static uint8_t a[FRAME], b[FRAME];
+
+// picture arrives in reads of size(i) bytes
+static void stream(const uint8_t *frame, int length, int (*size)(int), struct epaper_state *state, bool refresh)
+{
+        epaper_stream_begin(dev, state);
+        for (int i = 0, off = 0; off < length; i++) {
+                int n = size(i);
+                if (n > length - off)
+                        n = length - off;
+                epaper_stream_write(dev, frame + off, n);
+                off += n;
+        }
+        epaper_stream_end(dev, refresh);
+}
+
+static int piece;
+static int fixed(int i)
+{
+        return piece;
+}
+
+// TCP segments and short reads
+static int tcp(int i)
+{
+        return rand() % 1460 + 1;
+}
+
+static uint16_t expected[SPI_MOCK_WIRE];
+static long expected_len;
+
+// what the buffered path sent: the command and the frame, refresh after a complete download
+static void buffered(const uint8_t *frame, int length, bool refresh)
+{
+        expected_len = 0;
+        expected[expected_len++] = START_TRANSMISSION_2;
+        for (int i = 0; i < length; i++)
+                expected[expected_len++] = SPI_MOCK_DATA | frame[i];
+        if (refresh)
+                expected[expected_len++] = REFRESH;
+}
+
+static void check_wire(const char *what)
+{
+        long i = 0;
+        while (i < expected_len && i < spi_mock_wire_len && spi_mock_wire[i] == expected[i])
+                i++;
+        CHECK(i == expected_len && i == spi_mock_wire_len, "%s: %ld bytes sent, %ld expected, first difference at %ld",
+              what, spi_mock_wire_len, expected_len, i);
+        CHECK(spi_mock_stats.queued_max <= 2, "%s: %lu transfers in flight", what, spi_mock_stats.queued_max);
+        CHECK(spi_mock_stats.errors == 0, "%s: %lu SPI driver errors", what, spi_mock_stats.errors);
+}
+
+static void test_full(void)
+{
+        const int sizes[] = {1, 7, 100, 1024, 1436, 1600, 2047, 2048, 2049, 3280, FRAME};
+        char what[64];
+
+        for (int i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+                piece = sizes[i];
+                spi_mock_reset();
+                stream(a, FRAME, fixed, NULL, true);
+                buffered(a, FRAME, true);
+                snprintf(what, sizeof what, "pieces of %d bytes", piece);
+                check_wire(what);
+        }
+        for (int i = 0; i < 20; i++) {
+                spi_mock_reset();
+                stream(b, FRAME, tcp, NULL, true);
+                buffered(b, FRAME, true);
+                check_wire("TCP reads");
+        }
+
+        spi_mock_reset();
+        epaper_display(dev, a);
+        buffered(a, FRAME, true);
+        check_wire("epaper_display");
+
+        // download stops half way: the panel keeps the old picture
+        piece = 1024;
+        spi_mock_reset();
+        stream(a, FRAME / 2 + 5, fixed, NULL, false);
+        buffered(a, FRAME / 2 + 5, false);
+        check_wire("broken download");
+}
+
+/*
+  Controller: RAM the frame is written into, panel what a refresh shows.
+  Partial mode limits both to the window, which must span the width.
+ */
+static uint8_t ram[FRAME], panel[FRAME];
+static bool partial;
+static int y0, y1 = HEIGHT - 1;
+static int full_refreshes, partial_refreshes;
+static long frame_bytes;
+
+static void controller(void)
+{
+        int cmd = -1, arg = 0;
+        uint8_t window[9];
+        long ptr = 0, end = 0;
+
+        for (long i = 0; i < spi_mock_wire_len; i++) {
+                uint16_t w = spi_mock_wire[i];
+                if (!(w & SPI_MOCK_DATA)) {
+                        cmd = w;
+                        arg = 0;
+                        if (cmd == PARTIAL_IN) {
+                                partial = true;
+                        } else if (cmd == PARTIAL_OUT) {
+                                partial = false;
+                        } else if (cmd == START_TRANSMISSION_2) {
+                                ptr = partial ? y0 * ROW : 0;
+                                end = partial ? (y1 + 1) * ROW : FRAME;
+                        } else if (cmd == REFRESH && partial) {
+                                memcpy(panel + y0 * ROW, ram + y0 * ROW, (y1 + 1 - y0) * ROW);
+                                partial_refreshes++;
+                        } else if (cmd == REFRESH) {
+                                memcpy(panel, ram, FRAME);
+                                full_refreshes++;
+                        }
+                        continue;
+                }
+                if (cmd == PARTIAL_WINDOW && arg < sizeof window && (window[arg] = w) && arg == 8) {
+                        CHECK(window[0] == 0 && window[1] == 0 && (window[2] << 8 | window[3]) == WIDTH - 1,
+                              "window is not full width");
+                        y0 = window[4] << 8 | window[5];
+                        y1 = window[6] << 8 | window[7];
+                        CHECK(y0 <= y1 && y1 < HEIGHT, "window rows %d-%d", y0, y1);
+                } else if (cmd == START_TRANSMISSION_2) {
+                        CHECK(ptr < end, "frame data past the window");
+                        if (ptr < end)
+                                ram[ptr++] = w;
+                        frame_bytes++;
+                }
+                arg++;
+        }
+        spi_mock_reset();
+}
+
+static void change_bands(uint8_t *frame, int n)
+{
+        for (int i = 0; i < n; i++) {
+                uint8_t *band = frame + rand() % EPAPER_BANDS * BAND;
+                band[rand() % BAND] ^= 1 << rand() % 8;
+        }
+}
+
+static void update(const char *what, struct epaper_state *state, const uint8_t *frame, int length, bool refresh)
+{
+        int full = full_refreshes, part = partial_refreshes;
+        uint8_t shown[FRAME];
+        memcpy(shown, panel, FRAME);
+
+        frame_bytes = 0;
+        stream(frame, length, tcp, state, refresh);
+        CHECK(spi_mock_stats.queued_max <= 2, "%s: %lu transfers in flight", what, spi_mock_stats.queued_max);
+        CHECK(spi_mock_stats.errors == 0, "%s: %lu SPI driver errors", what, spi_mock_stats.errors);
+        controller();
+        if (refresh)
+                CHECK(memcmp(panel, frame, FRAME) == 0, "%s: panel doesn't show the picture", what);
+        else
+                CHECK(memcmp(panel, shown, FRAME) == 0, "%s: panel changed", what);
+        CHECK(full_refreshes - full + partial_refreshes - part <= 1, "%s: more than one refresh", what);
+}
+
+static void test_partial(void)
+{
+        struct epaper_state state = {0};
+        int sent = 0;
+
+        update("first", &state, a, FRAME, true);
+        CHECK(full_refreshes == 1 && frame_bytes == FRAME, "first: not a full update");
+        memcpy(b, a, FRAME);
+
+        // every FULL_REFRESH_EVERY-th update that changes the picture is a full one
+        for (int i = 1, partials = 0; i <= 3 * FULL_REFRESH_EVERY; i++) {
+                int full = full_refreshes, part = partial_refreshes, changes = i % 5;
+                change_bands(b, changes);
+                update("update", &state, b, FRAME, true);
+                if (partials == FULL_REFRESH_EVERY - 1) {
+                        CHECK(full_refreshes == full + 1, "update %d: no full refresh to clear ghosting", i);
+                        partials = 0;
+                } else {
+                        CHECK(full_refreshes == full, "update %d: full refresh", i);
+                        CHECK(partial_refreshes == part + (changes != 0), "update %d: %d partial refreshes",
+                              i, partial_refreshes - part);
+                        CHECK(frame_bytes <= changes * BAND, "update %d: %ld bytes sent for %d changes",
+                              i, frame_bytes, changes);
+                        partials += changes != 0;
+                }
+                sent += frame_bytes;
+        }
+        printf("partial: %d updates, %d bytes of frames sent, %d full refreshes, %d partial\n",
+               3 * FULL_REFRESH_EVERY, sent, full_refreshes, partial_refreshes);
+
+        // broken download of a changed picture: RAM no longer matches, next update is full
+        memcpy(a, b, FRAME);
+        change_bands(a, 30);
+        update("broken", &state, a, FRAME - BAND, false);
+        int full = full_refreshes;
+        update("after broken", &state, b, FRAME, true);
+        CHECK(full_refreshes == full + 1, "no full refresh after a broken partial update");
+}
+
+int main(void)
+{
+        esp_log_level_set("*", ESP_LOG_WARN);
+        spi_mock_gpio[conf.busy_pin] = 1; // idle
+        spi_mock_dc_pin = conf.dc_pin;
+        dev = epaper_create(conf);
+        controller();
+
+        srand(1);
+        for (int i = 0; i < FRAME; i++) {
+                a[i] = rand();
+                b[i] = rand();
+        }
+        test_full();
+        // the last full update showed a
+        controller();
+        test_partial();
+        epaper_delete(dev);
+
+        return check_done();
+}
@@ -0,0 +1,281 @@
+/*
+  ESP-NOW transport end to end: metrics added through the batch API are
+  encoded into frames, carried by the UDP stand-in of the air link,
+  deduplicated and expanded by the gateway, and must come out as the
+  Graphite plaintext the UDP transport would have sent.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+// frame of the transport is looked at directly
+#include "graphite.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "espnow_gateway.h"
+#include "check.h"
+
+static char long_name[256];
+static const char *names[] = {
+        "temperature", "pressure", "humidity", "voltage", "wake.total_ms", "wake.avg_energy_uah",
+        "x", "custom.metric", "wake.ota_ms.not_in_table",
+        long_name,
+};
+#define NAMES (sizeof names / sizeof names[0])
+
+static struct espnow_record sent[ESPNOW_FRAME_MAX];
+static int sent_n, parsed_n;
+
+static esp_err_t compare(void *ctx, const struct espnow_record *r)
+{
+        const struct espnow_record *s = &sent[parsed_n++];
+        CHECK(strcmp(r->metric, s->metric) == 0 && r->value == s->value &&
+              r->precision == s->precision && r->ts == s->ts,
+              "record %d: %s %d/%d @%u, sent %s %d/%d @%u", parsed_n - 1,
+              r->metric, r->value, r->precision, r->ts, s->metric, s->value, s->precision, s->ts);
+        return ESP_OK;
+}
+
+static void check_frame(const struct espnow_frame *f, uint16_t seq)
+{
+        uint8_t mac[6];
+        uint16_t s;
+
+        parsed_n = 0;
+        CHECK(espnow_frame_parse(f->buf, f->len, mac, &s, compare, NULL) == ESP_OK, "frame doesn't parse");
+        CHECK(parsed_n == sent_n, "%d records parsed, %d sent", parsed_n, sent_n);
+        CHECK(s == seq && memcmp(mac, "\x02\0\0\0\0\x01", 6) == 0, "header differs");
+
+        // a cut frame is either malformed or ends at a record boundary
+        for (int len = 0; len < f->len; len++) {
+                parsed_n = 0;
+                esp_err_t err = espnow_frame_parse(f->buf, len, NULL, NULL, NULL, NULL);
+                CHECK(err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE, "cut at %d: %s", len, esp_err_to_name(err));
+        }
+}
+
+static void test_codec(void)
+{
+        static struct espnow_frame f;
+        const uint8_t mac[6] = {0x02, 0, 0, 0, 0, 0x01};
+        const int32_t edge[] = {0, 1, -1, 63, 64, -64, -65, INT32_MAX, INT32_MIN};
+        uint16_t seq = 0xfffe;
+        int frames = 0;
+
+        // longest name a frame takes
+        memset(long_name, 'a', ESPNOW_FRAME_MAX - ESPNOW_FRAME_HEADER - 2 - 1 - 4 - 5);
+        srand(1);
+        espnow_frame_init(&f, mac, seq);
+        sent_n = 0;
+        for (int i = 0; i < 100000; i++) {
+                struct espnow_record r = {
+                        .metric = names[rand() % NAMES],
+                        .value = rand() % 4 ? (int32_t)(rand() * 2654435761u) >> (rand() % 32) : edge[rand() % 9],
+                        .precision = rand() % (FTOA_MAX_PRECISION + 1),
+                        .ts = rand() % 3 ? 1700000000 + i / 4 : 0,
+                };
+                esp_err_t err = espnow_frame_add(&f, r.metric, r.value, r.precision, r.ts);
+                if (err == ESP_ERR_INVALID_SIZE) {
+                        CHECK(!espnow_frame_empty(&f), "record doesn't fit into an empty frame");
+                        check_frame(&f, seq);
+                        frames++;
+                        espnow_frame_init(&f, mac, ++seq);
+                        sent_n = 0;
+                        err = espnow_frame_add(&f, r.metric, r.value, r.precision, r.ts);
+                }
+                CHECK(err == ESP_OK, "add %s: %s", r.metric, esp_err_to_name(err));
+                sent[sent_n++] = r;
+        }
+        check_frame(&f, seq);
+
+        CHECK(espnow_frame_add(&f, "p", 0, FTOA_MAX_PRECISION + 1, 0) == ESP_ERR_INVALID_ARG, "precision is not checked");
+        char name[257];
+        memset(name, 'a', 256);
+        name[256] = 0;
+        CHECK(espnow_frame_add(&f, name, 0, 0, 0) == ESP_ERR_INVALID_ARG, "name length is not checked");
+
+        // garbage must be rejected without reading past the end
+        uint8_t junk[ESPNOW_FRAME_MAX];
+        int ok = 0;
+        for (int i = 0; i < 100000; i++) {
+                int len = ESPNOW_FRAME_HEADER + rand() % (sizeof junk - ESPNOW_FRAME_HEADER + 1);
+                for (int j = 0; j < len; j++)
+                        junk[j] = rand();
+                junk[0] = ESPNOW_FRAME_VERSION;
+                ok += espnow_frame_parse(junk, len, NULL, NULL, NULL, NULL) == ESP_OK;
+        }
+        printf("codec: %d frames, %d of 100000 random frames parse\n", frames + 1, ok);
+}
+
+static esp_err_t count(void *ctx, const char *prefix, const struct espnow_record *r)
+{
+        if (r != NULL)
+                (*(int *)ctx)++;
+        return ESP_OK;
+}
+
+static esp_err_t full(void *ctx, const char *prefix, const struct espnow_record *r)
+{
+        return ESP_ERR_NO_MEM;
+}
+
+// records are batched, the send at the end of the frame fails
+static esp_err_t unsent(void *ctx, const char *prefix, const struct espnow_record *r)
+{
+        return r == NULL ? ESP_FAIL : ESP_OK;
+}
+
+static void test_dedupe(void)
+{
+        static struct espnow_gateway g;
+        static struct espnow_gateway_node nodes[ESPNOW_GATEWAY_NODES];
+        static struct espnow_frame f;
+        uint8_t mac[6] = {0x02, 0, 0, 0, 0, 0};
+        int records = 0;
+
+        espnow_gateway_init(&g, nodes, ESPNOW_GATEWAY_NODES);
+        espnow_frame_init(&f, mac, 7);
+        espnow_frame_add(&f, "temperature", 2137, 2, 0);
+        espnow_gateway_receive(&g, f.buf, f.len, 1000, count, &records);
+        espnow_gateway_receive(&g, f.buf, f.len, 1001, count, &records);
+        CHECK(records == 1 && g.duplicates == 1, "retransmission is not dropped");
+        espnow_gateway_receive(&g, f.buf, f.len, 1000 + ESPNOW_GATEWAY_DEDUPE, count, &records);
+        CHECK(records == 2, "sequence number is not forgotten");
+
+        // a frame that couldn't be passed on is taken again
+        espnow_frame_init(&f, mac, 8);
+        espnow_frame_add(&f, "temperature", 2137, 2, 0);
+        CHECK(espnow_gateway_receive(&g, f.buf, f.len, 1100, full, NULL) == ESP_ERR_NO_MEM, "error is lost");
+        espnow_gateway_receive(&g, f.buf, f.len, 1100, count, &records);
+        CHECK(records == 3 && g.duplicates == 1, "retransmission of a frame not passed on is dropped");
+        espnow_frame_init(&f, mac, 9);
+        espnow_frame_add(&f, "temperature", 2137, 2, 0);
+        CHECK(espnow_gateway_receive(&g, f.buf, f.len, 1200, unsent, NULL) == ESP_FAIL, "error of the send is lost");
+        espnow_gateway_receive(&g, f.buf, f.len, 1200, count, &records);
+        CHECK(records == 4 && g.duplicates == 1, "retransmission of a frame not sent is dropped");
+
+        // more sensors than slots: the ones silent for the longest time are forgotten
+        for (int i = 1; i <= ESPNOW_GATEWAY_NODES + 1; i++) {
+                mac[5] = i;
+                espnow_frame_init(&f, mac, 7);
+                espnow_frame_add(&f, "temperature", 2137, 2, 0);
+                espnow_gateway_receive(&g, f.buf, f.len, 2000 + i, count, &records);
+        }
+        CHECK(records == 4 + ESPNOW_GATEWAY_NODES + 1, "new sensor is dropped");
+        mac[5] = ESPNOW_GATEWAY_NODES + 1;
+        espnow_frame_init(&f, mac, 7);
+        espnow_frame_add(&f, "temperature", 2137, 2, 0);
+        espnow_gateway_receive(&g, f.buf, f.len, 2050, count, &records);
+        CHECK(g.duplicates == 2, "recent sensor is forgotten");
+
+        f.buf[0] = ESPNOW_FRAME_VERSION + 1;
+        CHECK(espnow_gateway_receive(&g, f.buf, f.len, 2100, count, &records) == ESP_ERR_INVALID_RESPONSE &&
+              g.malformed == 1, "unknown version is accepted");
+}
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct espnow_gateway gateway;
+static struct espnow_gateway_node gateway_nodes[ESPNOW_GATEWAY_NODES];
+static char out[65536];
+static int out_len, air_frames, air_bytes;
+
+// plaintext line, as the UDP transport writes it
+static int format(char *buf, int size, const char *prefix, const char *metric, const char *v, uint32_t ts)
+{
+        if (ts == 0)
+                return snprintf(buf, size, "%s.%s %s -1\n", prefix, metric, v);
+        return snprintf(buf, size, "%s.%s %s %u\n", prefix, metric, v, ts);
+}
+
+static esp_err_t expand(void *ctx, const char *prefix, const struct espnow_record *r)
+{
+        char v[24];
+        if (r == NULL)
+                return ESP_OK;
+        fixtoa(v, sizeof v, r->value, r->precision);
+        out_len += format(out + out_len, sizeof out - out_len, prefix, r->metric, v, r->ts);
+        return ESP_OK;
+}
+
+static void on_frame(const uint8_t *buf, int len)
+{
+        pthread_mutex_lock(&lock);
+        air_frames++;
+        air_bytes += len;
+        espnow_gateway_receive(&gateway, buf, len, xTaskGetTickCount() / 1000, expand, NULL);
+        pthread_mutex_unlock(&lock);
+}
+
+static char expected[65536];
+static int expected_len;
+
+static void expect(const char *metric, int32_t value, int precision, uint32_t ts)
+{
+        char v[24];
+        fixtoa(v, sizeof v, value, precision);
+        expected_len += format(expected + expected_len, sizeof expected - expected_len,
+                               "yaws.sensor_02:00:00:00:00:01", metric, v, ts);
+}
+
+static void add(const char *metric, int32_t value, int precision, uint32_t ts)
+{
+        esp_err_t err = graphite_batch_add_fixed("yaws.sensor_ignored", metric, value, precision, ts);
+        CHECK(err == ESP_OK, "graphite_batch_add_fixed: %s", esp_err_to_name(err));
+        expect(metric, value, precision, ts);
+}
+
+static void test_end_to_end(void)
+{
+        espnow_gateway_init(&gateway, gateway_nodes, ESPNOW_GATEWAY_NODES);
+        CHECK(espnow_link_listen(on_frame) == ESP_OK, "listen failed");
+
+        // a day of batches: wake breakdown, then samples
+        for (int b = 0; b < 24; b++) {
+                add("wake.sensor_ms", 40 + b, 0, 0);
+                add("wake.total_ms", 310 + b, 0, 0);
+                CHECK(graphite_batch_add("p", "wake.energy_uah", 12.34f, 1, 0) == ESP_OK, "graphite_batch_add");
+                expect("wake.energy_uah", 123, 1, 0);
+                // half way: to even, the digits ftoa() gives over UDP
+                CHECK(graphite_batch_add("p", "wake.avg_current_ma", -0.125f, 2, 0) == ESP_OK, "graphite_batch_add");
+                expect("wake.avg_current_ma", -12, 2, 0);
+                for (int i = 0; i < 6; i++) {
+                        uint32_t ts = 1700000000 + b * 3600 + i * 600;
+                        add("temperature", -150 + b * 37 + i, 2, ts);
+                        add("pressure", 101325 - b * 13, 0, ts);
+                        add("humidity", 456 + i, 1, ts);
+                        add("voltage", 3012 - b, 3, ts);
+                }
+                add("custom.metric", INT32_MIN, 6, 0);
+                CHECK(graphite_batch_flush() == ESP_OK, "graphite_batch_flush");
+        }
+        // the last frame again, as if its acknowledgement was lost
+        CHECK(espnow_link_send(frame.buf, frame.len) == ESP_OK, "resend failed");
+
+        int done = 0;
+        for (int i = 0; i < 2000 && !done; i++) {
+                usleep(1000);
+                pthread_mutex_lock(&lock);
+                done = gateway.duplicates > 0;
+                pthread_mutex_unlock(&lock);
+        }
+        graphite_close();
+
+        pthread_mutex_lock(&lock);
+        CHECK(done && gateway.duplicates == 1 && gateway.malformed == 0, "%u duplicates, %u malformed",
+              gateway.duplicates, gateway.malformed);
+        CHECK(out_len == expected_len && memcmp(out, expected, out_len) == 0,
+              "gateway output differs:\n%.*s\nexpected:\n%.*s", out_len, out, expected_len, expected);
+        printf("end to end: %d frames, %d bytes on air, %d bytes of plaintext\n",
+               air_frames, air_bytes, out_len);
+        pthread_mutex_unlock(&lock);
+}
+
+int main(void)
+{
+        test_codec();
+        test_dedupe();
+        test_end_to_end();
+        return check_done();
+}
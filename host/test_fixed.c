@@ -0,0 +1,92 @@
+/*
+  Fixed-point measurement path against the float one it replaces: both
+  must print the same digits for every value a sensor can produce.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+#include <math.h>
+#include <stdio.h>
+
+#include "adt7410.h"
+#include "ftoa.h"
+#include "fixed.h"
+
+#include "i2c_mock.h"
+#include "check.h"
+
+static int float_off;
+
+/*
+  Fixed value must print as the float path does. Where it doesn't, the
+  float path has rounded the value itself (e.g. Q24.8 pressure is wider
+  than float mantissa), and fixed value must be the exact one, given in
+  units of 10^-precision, rounded half to even.
+ */
+static void check(const char *what, long input, float f, double exact, int32_t fixed, int precision)
+{
+        char a[24], b[24], e[24];
+        ftoa(a, sizeof a, f, precision);
+        fixtoa(b, sizeof b, fixed, precision);
+        if (strcmp(a, b) == 0)
+                return;
+        fixtoa(e, sizeof e, rint(exact), precision);
+        if (strcmp(e, b) == 0) {
+                float_off++;
+                return;
+        }
+        if (failed++ < 10)
+                printf("%s %ld: float %s, exact %s, fixed %s\n", what, input, a, e, b);
+}
+
+static struct i2c_mock_device adt7410_bus = {.addr = ADT7410_I2C_ADDR_000};
+
+static void test_adt7410(adt7410_resolution_t res)
+{
+        adt7410_t dev = {.res = res};
+        adt7410_init_desc(&dev, ADT7410_I2C_ADDR_000, 0, 4, 5);
+        for (long raw = 0; raw < 0x10000; raw++) {
+                float f;
+                int16_t t;
+                adt7410_bus.reg[0x00] = raw >> 8;
+                adt7410_bus.reg[0x01] = raw;
+                adt7410_get_temperature(&dev, &f);
+                adt7410_get_temperature_fixed(&dev, &t);
+                check("adt7410", raw, f, f * 100.0, t, 2);
+        }
+}
+
+int main(void)
+{
+        i2c_mock_attach(&adt7410_bus);
+        test_adt7410(ADT7410_RES_16);
+        test_adt7410(ADT7410_RES_13);
+
+        // bmp280_read_float() divides the fixed point results
+        for (int32_t t = -4000; t <= 8500; t++)
+                check("bme280 temperature", t, (float)t / 100, t, t, 2);
+        for (uint32_t p = 30000 * 256; p <= 110000 * 256; p++)
+                check("bme280 pressure", p, (float)p / 256, p / 256.0, fixed_pressure_pa(p), 0);
+        for (uint32_t h = 0; h <= 100 * 1024; h++)
+                check("bme280 humidity", h, (float)h / 1024, h * 10 / 1024.0, fixed_humidity_deci(h), 1);
+
+        // same as mcp9808_get_temperature()
+        for (long ta = 0; ta < 0x2000; ta++) {
+                float f = (ta & 0x0fff) / 16.0f;
+                if (ta & 0x1000)
+                        f -= 256;
+                check("mcp9808", ta, f, f * 100.0, fixed_mcp9808_centi(ta), 2);
+        }
+
+        // 10-bit TOUT ADC in mV, default and a calibrated divider
+        const float offsets[] = {5, 4.873};
+        for (int i = 0; i < 2; i++) {
+                int32_t k = offsets[i] * 1000 + 0.5f;
+                for (long adc = 0; adc < 1024; adc++)
+                        check("vdd", adc, (float)adc / 1000 * offsets[i], adc * k / 1000.0,
+                              fixed_div(adc * k, 1000), 3);
+        }
+
+        printf("%s: %d mismatches, %d values rounded wrong by the float path\n",
+               failed ? "FAIL" : "ok", failed, float_off);
+        return check_done();
+}
@@ -0,0 +1,201 @@
+/*
+  Flash sample log on a file-backed mock flash: records come back in
+  order across wrap-around, and after power is cut at any byte of a
+  sequence of appends and drains, recovery from flash alone loses no
+  record that was written, returns none twice but the ones consumed from
+  the tail sector, and appends go on after it.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "flashlog.h"
+#include "flash_mock.h"
+#include "check.h"
+
+#define SECTORS 8
+
+struct record {
+        uint32_t n;
+        uint8_t payload[20];
+};
+
+static const esp_partition_t *part;
+static struct flashlog log_;
+static struct flashlog_index index_; // RTC memory
+
+static struct record make(uint32_t n)
+{
+        struct record r = { .n = n };
+        for (int i = 0; i < sizeof r.payload; i++)
+                r.payload[i] = n * 31 + i;
+        return r;
+}
+
+static esp_err_t append(uint32_t from, int n)
+{
+        struct record r[16];
+        for (int i = 0; i < n; i++)
+                r[i] = make(from + i);
+        return flashlog_append(&log_, r, n);
+}
+
+// power-on: RTC memory is gone, unless it was a reset
+static void reboot(bool reset)
+{
+        flash_mock_power_on();
+        if (!reset)
+                index_.magic = 0;
+        CHECK(flashlog_open(&log_, "samples", sizeof(struct record), &index_) == ESP_OK, "open failed");
+}
+
+static void wipe(void)
+{
+        flash_mock_power_on();
+        esp_partition_erase_range(part, 0, part->size);
+        reboot(false);
+}
+
+static uint32_t got[SECTORS * 128];
+
+// all records from the tail
+static int read_all(void)
+{
+        struct flashlog_pos pos = index_.tail;
+        struct record r[32];
+        int n = 0, k;
+        while ((k = flashlog_read(&log_, &pos, r, 32)) > 0)
+                for (int i = 0; i < k; i++) {
+                        struct record want = make(r[i].n);
+                        CHECK(memcmp(&r[i], &want, sizeof want) == 0, "record %u is corrupt", r[i].n);
+                        got[n++] = r[i].n;
+                }
+        CHECK(k == 0, "read failed");
+        return n;
+}
+
+static void test_wrap(void)
+{
+        wipe();
+        CHECK(flashlog_empty(&log_), "blank log is not empty");
+        for (uint32_t n = 0; n < 5000; n += 10)
+                CHECK(append(n, 10) == ESP_OK, "append %u failed", n);
+        int n = read_all();
+        CHECK(n > (SECTORS - 2) * (log_.slots - 1) && n <= SECTORS * (log_.slots - 1), "%d records kept", n);
+        for (int i = 0; i < n; i++)
+                CHECK(got[i] == 5000 - n + i, "record %d is %u", i, got[i]);
+        CHECK(index_.dropped == 5000 - n, "%u dropped, %d kept", index_.dropped, n);
+
+        // the index kept in RTC memory and the one recovered from flash agree
+        struct flashlog_index rtc = index_;
+        reboot(false);
+        CHECK(memcmp(&rtc.head, &index_.head, sizeof rtc.head) == 0 && memcmp(&rtc.tail, &index_.tail, sizeof rtc.tail) == 0,
+              "recovered index differs: head %u/%u tail %u/%u, was head %u/%u tail %u/%u",
+              index_.head.sector, index_.head.slot, index_.tail.sector, index_.tail.slot,
+              rtc.head.sector, rtc.head.slot, rtc.tail.sector, rtc.tail.slot);
+
+        // drained to the end, across power loss too
+        struct flashlog_pos pos = index_.tail;
+        struct record r[32];
+        while (flashlog_read(&log_, &pos, r, 32) > 0)
+                ;
+        CHECK(flashlog_consume(&log_, pos) == ESP_OK && flashlog_empty(&log_), "not empty after drain");
+        reboot(false);
+        n = read_all();
+        CHECK(n < log_.slots, "%d records back after drain", n);
+}
+
+/*
+  Appends and drains until power goes off; the state of the caller is
+  what it knows about records: those before consumed are gone, those
+  up to acked are written, those up to attempted may be.
+ */
+static uint32_t consumed, acked, attempted;
+
+static void scenario(uint32_t start)
+{
+        consumed = acked = attempted = start;
+        for (int round = 0; round < 4; round++) {
+                for (int i = 0; i < 15; i++) {
+                        attempted += 10;
+                        if (append(acked, 10) != ESP_OK)
+                                return;
+                        acked += 10;
+                }
+                struct flashlog_pos pos = index_.tail;
+                struct record r[100];
+                int n = flashlog_read(&log_, &pos, r, 100);
+                if (n <= 0)
+                        return;
+                // delivered: it's up to the log now whether they come back
+                consumed = r[n - 1].n + 1;
+                if (flashlog_consume(&log_, pos) != ESP_OK)
+                        return;
+        }
+}
+
+static void test_power_loss(uint32_t prefill, bool reset)
+{
+        int cuts = 0, reread_max = 0;
+
+        for (long cut = 0;; cut += 53) {
+                wipe();
+                for (uint32_t n = 0; n < prefill; n += 10)
+                        append(n, 10);
+                if (prefill > 0) {
+                        // the caller has drained everything before
+                        struct flashlog_pos pos = index_.tail;
+                        struct record r[32];
+                        while (flashlog_read(&log_, &pos, r, 32) > 0)
+                                ;
+                        flashlog_consume(&log_, pos);
+                }
+                flash_mock_cut(cut);
+                scenario(prefill);
+                flash_mock_cut(-1);
+                if (attempted == prefill + 600 && acked == attempted && consumed > prefill + 300)
+                        break; // the cut is past the end of the scenario
+                cuts++;
+
+                reboot(reset);
+                int n = read_all(), reread = 0;
+                for (int i = 0; i < n; i++) {
+                        CHECK(i == 0 || got[i] > got[i - 1], "cut at %ld: %u after %u", cut, got[i], got[i - 1]);
+                        CHECK(got[i] < attempted, "cut at %ld: %u was never written", cut, got[i]);
+                        reread += got[i] < consumed;
+                }
+                for (uint32_t r = consumed, i = reread; r < acked; r++, i++)
+                        CHECK(i < n && got[i] == r, "cut at %ld: %u is lost", cut, r);
+                CHECK(reread < 2 * log_.slots, "cut at %ld: %d consumed records are back", cut, reread);
+                if (reread > reread_max)
+                        reread_max = reread;
+
+                // and the log goes on
+                CHECK(append(100000, 16) == ESP_OK, "cut at %ld: append after recovery failed", cut);
+                n = read_all();
+                for (int i = 0; i < 16; i++)
+                        CHECK(n >= 16 && got[n - 16 + i] == 100000 + i, "cut at %ld: record appended after recovery is lost", cut);
+                if (failed > 20)
+                        break;
+        }
+        printf("%s with %u records before: %d cuts, up to %d consumed records read again\n",
+               reset ? "reset" : "power loss", prefill, cuts, reread_max);
+}
+
+int main(void)
+{
+        part = flash_mock_temp("samples", SECTORS * FLASHLOG_SECTOR);
+        if (part == NULL)
+                return 1;
+
+        esp_log_level_set("*", ESP_LOG_ERROR); // recoveries and full log
+        test_wrap();
+        test_power_loss(0, false);
+        test_power_loss(1500, false); // wrapped around
+        // RTC memory survives a reset, while the write in progress is cut
+        test_power_loss(0, true);
+        test_power_loss(1500, true);
+        return check_done();
+}
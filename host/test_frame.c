@@ -0,0 +1,246 @@
+/*
+  Compressed display frames through the decoder of the display: PackBits
+  bodies of runs, literals, no-ops and the 128-byte limits of both,
+  fed in pieces of any size as HTTP reads return them, must give the
+  bitmap back; frames of another size, with a bad CRC or cut short must
+  be rejected. With a path, the picture is written there instead, for
+  the check of tools/yaws-frame.c.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "check.h"
+
+#define WIDTH 800
+#define HEIGHT 480
+#define SIZE (WIDTH * HEIGHT / 8)
+
+// frame under construction and the bitmap it must decode to
+static uint8_t frame[FRAME_HEADER_SIZE + 2 * SIZE];
+static uint8_t bitmap[SIZE + 128];
+static int frame_len, bitmap_len, width, height;
+
+static void begin(int w, int h)
+{
+        width = w;
+        height = h;
+        memset(frame, 0, FRAME_HEADER_SIZE);
+        memcpy(frame, FRAME_MAGIC, 4);
+        frame[4] = w & 0xff;
+        frame[5] = w >> 8;
+        frame[6] = h & 0xff;
+        frame[7] = h >> 8;
+        frame[8] = FRAME_PACKBITS;
+        frame_len = FRAME_HEADER_SIZE;
+        bitmap_len = 0;
+}
+
+static void literal(const uint8_t *data, int n)
+{
+        frame[frame_len++] = n - 1;
+        memcpy(frame + frame_len, data, n);
+        memcpy(bitmap + bitmap_len, data, n);
+        frame_len += n;
+        bitmap_len += n;
+}
+
+static void run(uint8_t c, int n)
+{
+        frame[frame_len++] = 257 - n;
+        frame[frame_len++] = c;
+        memset(bitmap + bitmap_len, c, n);
+        bitmap_len += n;
+}
+
+// the rest of the bitmap in runs of c
+static void fill(uint8_t c)
+{
+        while (SIZE - bitmap_len >= 2)
+                run(c, SIZE - bitmap_len < 128 ? SIZE - bitmap_len : 128);
+        if (bitmap_len < SIZE)
+                literal(&c, 1);
+}
+
+static void end(void)
+{
+        uint32_t crc = frame_crc32(0, bitmap, bitmap_len);
+        for (int i = 0; i < 4; i++)
+                frame[12 + i] = crc >> (8 * i);
+}
+
+static uint8_t out[SIZE + 1];
+static int out_len;
+
+static void write_out(void *ctx, const uint8_t *data, int len)
+{
+        if (out_len + len <= sizeof out)
+                memcpy(out + out_len, data, len);
+        out_len += len;
+}
+
+// frame_len bytes of the frame in pieces of chunk bytes, the last one shorter
+static int decode(int w, int h, int len, int chunk)
+{
+        static struct frame_decoder d;
+        int err = FRAME_OK;
+
+        out_len = 0;
+        frame_init(&d, w, h, write_out, NULL);
+        for (int i = 0; i < len && err == FRAME_OK; i += chunk)
+                err = frame_feed(&d, frame + i, len - i < chunk ? len - i : chunk);
+        return err == FRAME_OK ? frame_finish(&d) : err;
+}
+
+static void round_trip(const char *what)
+{
+        static const int chunks[] = { 1, 2, 3, 127, 128, 129, 1460, sizeof frame };
+
+        end();
+        for (int i = 0; i < sizeof chunks / sizeof chunks[0]; i++) {
+                int err = decode(width, height, frame_len, chunks[i]);
+                CHECK(err == FRAME_OK && out_len == bitmap_len && memcmp(out, bitmap, bitmap_len) == 0,
+                      "%s in pieces of %d: error %d, %d of %d bytes", what, chunks[i], err, out_len, bitmap_len);
+        }
+}
+
+static void fill_random(uint8_t *p, int n)
+{
+        for (int i = 0; i < n; i++)
+                p[i] = rand();
+}
+
+static void test_round_trip(void)
+{
+        uint8_t data[128];
+
+        // 16 x 64 bitmap, 128 bytes: every limit on its own
+        begin(16, 64);
+        run(0xff, 128);
+        round_trip("one run of 128");
+        begin(16, 64);
+        fill_random(data, 128);
+        literal(data, 128);
+        round_trip("one literal of 128");
+        begin(16, 64);
+        for (int i = 0; i < 64; i++)
+                run(i, 2);
+        round_trip("runs of 2");
+        begin(16, 64);
+        for (int i = 0; i < 128; i++)
+                literal(data + i, 1);
+        round_trip("literals of 1");
+
+        // literal and run limits next to each other, with no-ops between
+        begin(WIDTH, HEIGHT);
+        fill_random(data, 128);
+        literal(data, 127);
+        run(0x00, 128);
+        frame[frame_len++] = 128;
+        literal(data, 128);
+        run(0x55, 127);
+        frame[frame_len++] = 128;
+        frame[frame_len++] = 128;
+        run(0xaa, 128);
+        literal(data + 1, 1);
+        fill(0xff);
+        round_trip("limits");
+
+        // picture: runs and literals of any length
+        srand(1);
+        for (int f = 0; f < 20; f++) {
+                begin(WIDTH, HEIGHT);
+                while (bitmap_len < SIZE) {
+                        int n = 1 + rand() % 128;
+                        if (n > SIZE - bitmap_len)
+                                n = SIZE - bitmap_len;
+                        if (rand() % 2 && n >= 2) {
+                                run(rand(), n);
+                        } else {
+                                fill_random(data, n);
+                                literal(data, n);
+                        }
+                }
+                round_trip("random");
+        }
+}
+
+static void reject(const char *what, int w, int h, int len, int expected)
+{
+        for (int chunk = 1; chunk <= 1024; chunk *= 32) {
+                int err = decode(w, h, len, chunk);
+                CHECK(err == expected, "%s in pieces of %d: error %d, expected %d", what, chunk, err, expected);
+        }
+}
+
+static void test_reject(void)
+{
+        uint8_t data[100];
+
+        begin(WIDTH, HEIGHT);
+        fill_random(data, sizeof data);
+        literal(data, sizeof data);
+        fill(0xff);
+        end();
+        reject("good frame", WIDTH, HEIGHT, frame_len, FRAME_OK);
+
+        // another display, or a bitmap with rows of another length
+        reject("wider frame", WIDTH + 8, HEIGHT, frame_len, FRAME_ERR_FORMAT);
+        reject("narrower frame", WIDTH - 8, HEIGHT, frame_len, FRAME_ERR_FORMAT);
+        reject("taller frame", WIDTH, HEIGHT + 1, frame_len, FRAME_ERR_FORMAT);
+        reject("lower frame", WIDTH, HEIGHT - 1, frame_len, FRAME_ERR_FORMAT);
+
+        frame[12] ^= 1;
+        reject("CRC", WIDTH, HEIGHT, frame_len, FRAME_ERR_CRC);
+        frame[12] ^= 1;
+        frame[FRAME_HEADER_SIZE + 1] ^= 0x80;
+        reject("changed literal", WIDTH, HEIGHT, frame_len, FRAME_ERR_CRC);
+        frame[FRAME_HEADER_SIZE + 1] ^= 0x80;
+
+        reject("body cut in a run", WIDTH, HEIGHT, frame_len - 1, FRAME_ERR_SIZE);
+        reject("body cut after a run", WIDTH, HEIGHT, frame_len - 2, FRAME_ERR_SIZE);
+        reject("body cut in a literal", WIDTH, HEIGHT, FRAME_HEADER_SIZE + 50, FRAME_ERR_SIZE);
+        reject("no body", WIDTH, HEIGHT, FRAME_HEADER_SIZE, FRAME_ERR_SIZE);
+        reject("header cut", WIDTH, HEIGHT, FRAME_HEADER_SIZE - 1, FRAME_ERR_FORMAT);
+        run(0, 2);
+        reject("body too long", WIDTH, HEIGHT, frame_len, FRAME_ERR_SIZE);
+        frame_len -= 2;
+
+        frame[8] = FRAME_PACKBITS + 1;
+        reject("encoding", WIDTH, HEIGHT, frame_len, FRAME_ERR_FORMAT);
+        frame[8] = FRAME_PACKBITS;
+        frame[3] = '2';
+        reject("magic", WIDTH, HEIGHT, frame_len, FRAME_ERR_FORMAT);
+}
+
+// a screen of text and bars, as the display shows
+static int write_picture(const char *path)
+{
+        for (int y = 0; y < HEIGHT; y++)
+                for (int x = 0; x < WIDTH / 8; x++) {
+                        uint8_t c = 0xff;
+                        if (y % 60 < 40 && x % 25 < 20)
+                                c = rand();
+                        else if (y % 60 >= 50)
+                                c = 0x00;
+                        bitmap[y * WIDTH / 8 + x] = c;
+                }
+        FILE *f = fopen(path, "wb");
+        if (f == NULL || fwrite(bitmap, 1, SIZE, f) != SIZE || fclose(f) != 0) {
+                perror(path);
+                return 1;
+        }
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        if (argc > 1)
+                return write_picture(argv[1]);
+        test_round_trip();
+        test_reject();
+        return check_done();
+}
@@ -0,0 +1,95 @@
+/*
+  ftoa() against glibc printf("%.*f"): every float from 2^-12 to 2^17,
+  which covers the values sensors report at any precision, and from 2^23
+  to 2^25, where the value has no fractional bits left; each with one of
+  the precisions and either sign. The rest of the float range, NaN and
+  infinities included, is sampled. ftofix() must give the digits of
+  ftoa() wherever the result fits into int32_t, as frames carry it.
+
+  With -a every float is checked at every precision, which takes hours.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ftoa.h"
+#include "check.h"
+
+static long checked;
+
+// a is ftoa() of the value, n its length or -1
+static void check_fixed(uint32_t u, int precision, const char *a, int n)
+{
+        union { uint32_t u; float f; } v = { .u = u };
+        int32_t x;
+        char b[48];
+
+        if (ftofix(&x, v.f, precision) < 0) {
+                if (n < 0 || !isfinite(v.f) || fabsl(v.f) * powl(10, precision) >= 0x1p31l - 1)
+                        return;
+                strcpy(b, "-1");
+        } else {
+                fixtoa(b, sizeof b, x, precision);
+                // a negative value that rounds to zero is "-0" only in ftoa()
+                if (n > 0 && strcmp(a + (a[0] == '-' && x == 0), b) == 0)
+                        return;
+        }
+        if (failed++ < 10)
+                printf("%08x precision %d: ftofix %s, ftoa %s\n", u, precision, b, n < 0 ? "-1" : a);
+}
+
+static void check(uint32_t u, int precision)
+{
+        union { uint32_t u; float f; } v = { .u = u };
+        char a[48], b[64];
+        int n = ftoa(a, sizeof a, v.f, precision);
+        checked++;
+        check_fixed(u, precision, a, n);
+        if (n < 0) {
+                // only values that don't fit into 64 bits may fail
+                if (ldexpl(fabsl(v.f) * powl(10, precision), -64) >= 1)
+                        return;
+                strcpy(a, "-1");
+        }
+        snprintf(b, sizeof b, "%.*f", precision, v.f);
+        if (strcmp(a, b) == 0 && n == (int)strlen(b))
+                return;
+        if (failed++ < 10)
+                printf("%08x precision %d: ftoa %s, printf %s\n", u, precision, a, b);
+}
+
+// bits of u pick the precision and the sign, so that each of them meets every mantissa bit pattern
+static void sweep(float from, float to)
+{
+        union { float f; uint32_t u; } lo = { .f = from }, hi = { .f = to };
+        for (uint32_t u = lo.u; u < hi.u; u++) {
+                uint32_t h = u * 0x9e3779b1u;
+                check(u | (h >> 31) << 31, (h >> 16) % (FTOA_MAX_PRECISION + 1));
+        }
+}
+
+int main(int argc, char **argv)
+{
+        if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+                uint32_t u = 0;
+                do
+                        for (int p = 0; p <= FTOA_MAX_PRECISION; p++)
+                                check(u, p);
+                while (++u != 0);
+        } else {
+                sweep(0x1p-12f, 0x1p17f);
+                sweep(0x1p23f, 0x1p25f);
+                for (uint64_t u = 0; u < 1ull << 32; u += 4093)
+                        for (int p = 0; p <= FTOA_MAX_PRECISION; p++)
+                                check(u, p);
+                const uint32_t special[] = { 0x00000000, 0x80000000, 0x00000001, 0x7f7fffff,
+                                             0x7f800000, 0xff800000, 0x7fc00000, 0xffc00000 };
+                for (int i = 0; i < sizeof special / sizeof special[0]; i++)
+                        for (int p = 0; p <= FTOA_MAX_PRECISION; p++)
+                                check(special[i], p);
+        }
+        printf("%s: %d mismatches in %ld values\n", failed ? "FAIL" : "ok", failed, checked);
+        return check_done();
+}
@@ -0,0 +1,246 @@
+/*
+  Batch API on the wire: datagrams are sent to a yaws-relay child
+  process, and the plaintext lines the fake carbon behind it gets are
+  compared with the Graphite lines of the metrics added. Each datagram
+  must fit into 1472 bytes and hold whole lines. Built twice, the second
+  time with CONFIG_GRAPHITE_COMPACT, whose datagrams the relay expands.
+  Datagrams the relay must not take apart are sent to it directly: cut,
+  and with lines short of a timestamp or with a field too many.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+// packet and its length are looked at directly
+#include "graphite.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "relay_child.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char carbon_lines[1 << 20];
+static int carbon_len;
+
+static void *carbon(void *arg)
+{
+        int fd = accept(*(int *)arg, NULL, NULL);
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof buf)) > 0) {
+                pthread_mutex_lock(&lock);
+                if (carbon_len + n < sizeof carbon_lines) {
+                        memcpy(carbon_lines + carbon_len, buf, n);
+                        carbon_len += n;
+                }
+                pthread_mutex_unlock(&lock);
+        }
+        close(fd);
+        return NULL;
+}
+
+static int relay_port, wire_len, datagrams;
+
+ssize_t __real_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *to, socklen_t tolen);
+
+ssize_t __wrap_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *to, socklen_t tolen)
+{
+        const struct sockaddr_in *in = (const struct sockaddr_in *)to;
+        CHECK(in->sin_port == htons(relay_port), "sent to port %d", ntohs(in->sin_port));
+        CHECK(len <= MTU_PAYLOAD, "datagram %d: %zu bytes", datagrams, len);
+        CHECK(len > 0 && ((const char *)buf)[len - 1] == '\n', "datagram %d: line split", datagrams);
+        CHECK(memchr(buf, 0, len) == NULL, "datagram %d: zero byte", datagrams);
+        wire_len += len;
+        datagrams++;
+        return __real_sendto(fd, buf, len, flags, to, tolen);
+}
+
+static char expected[1 << 20];
+static int expected_len;
+
+// value in units of 10^-precision, printed without going through fixtoa()
+static void expect(const char *prefix, const char *metric, int32_t value, int precision, uint32_t ts)
+{
+        char v[24], t[16];
+        int64_t a = value < 0 ? -(int64_t)value : value, scale = 1;
+        for (int i = 0; i < precision; i++)
+                scale *= 10;
+        int n = snprintf(v, sizeof v, "%s%lld", value < 0 ? "-" : "", (long long)(a / scale));
+        if (precision > 0)
+                snprintf(v + n, sizeof v - n, ".%0*lld", precision, (long long)(a % scale));
+        snprintf(t, sizeof t, ts == 0 ? "-1" : "%u", ts);
+        expected_len += snprintf(expected + expected_len, sizeof expected - expected_len,
+                                 "%s.%s %s %s\n", prefix, metric, v, t);
+}
+
+static void add_fixed(const char *prefix, const char *metric, int32_t value, int precision, uint32_t ts)
+{
+        esp_err_t err = graphite_batch_add_fixed(prefix, metric, value, precision, ts);
+        CHECK(err == ESP_OK, "%s.%s: %s", prefix, metric, esp_err_to_name(err));
+        expect(prefix, metric, value, precision, ts);
+}
+
+static void add(const char *prefix, const char *metric, float value, int precision, int32_t fixed, uint32_t ts)
+{
+        esp_err_t err = graphite_batch_add(prefix, metric, value, precision, ts);
+        CHECK(err == ESP_OK, "%s.%s: %s", prefix, metric, esp_err_to_name(err));
+        expect(prefix, metric, fixed, precision, ts);
+}
+
+static time_t start;
+
+/*
+  Lines of carbon against expected ones; the relay stamps lines of an
+  unknown time (-1) with the time they arrive.
+ */
+static bool same(const char *got, int got_len, const char *exp, int exp_len)
+{
+        const char *g = got, *e = exp;
+        while (g < got + got_len && e < exp + exp_len) {
+                const char *gnl = memchr(g, '\n', got + got_len - g), *enl = memchr(e, '\n', exp + exp_len - e);
+                if (gnl == NULL || enl == NULL)
+                        return false;
+                const char *gts = g, *ets = e;
+                for (const char *p = g; p < gnl; p++)
+                        gts = *p == ' ' ? p + 1 : gts;
+                for (const char *p = e; p < enl; p++)
+                        ets = *p == ' ' ? p + 1 : ets;
+                if (gts - g != ets - e || memcmp(g, e, gts - g) != 0)
+                        return false;
+                if (enl - ets == 2 && memcmp(ets, "-1", 2) == 0) {
+                        long ts = strtol(gts, NULL, 10);
+                        if (ts < start || ts > time(NULL) + 1)
+                                return false;
+                } else if (gnl - gts != enl - ets || memcmp(gts, ets, enl - ets) != 0) {
+                        return false;
+                }
+                g = gnl + 1;
+                e = enl + 1;
+        }
+        return g == got + got_len && e == exp + exp_len;
+}
+
+static int count_lines(const char *buf, int len)
+{
+        int lines = 0;
+        for (int i = 0; i < len; i++)
+                lines += buf[i] == '\n';
+        return lines;
+}
+
+// until carbon has as many lines as expected, or a second has passed
+static void check_carbon(const char *what)
+{
+        int lines = count_lines(expected, expected_len), got = 0;
+        for (int i = 0; i < 1000 && got < lines; i++) {
+                usleep(1000);
+                pthread_mutex_lock(&lock);
+                got = count_lines(carbon_lines, carbon_len);
+                pthread_mutex_unlock(&lock);
+        }
+        usleep(10000); // and nothing more comes
+        pthread_mutex_lock(&lock);
+        CHECK(same(carbon_lines, carbon_len, expected, expected_len),
+              "%s: carbon got %d bytes:\n%.*s\nexpected %d bytes:\n%.*s", what,
+              carbon_len, carbon_len, carbon_lines, expected_len, expected_len, expected);
+        printf("%s: %d lines, %d bytes in %d datagrams, %d bytes in carbon\n",
+               what, lines, wire_len, datagrams, carbon_len);
+        carbon_len = 0;
+        pthread_mutex_unlock(&lock);
+        wire_len = expected_len = datagrams = 0;
+}
+
+static void check_flushed(const char *what)
+{
+        CHECK(graphite_batch_flush() == ESP_OK, "%s: flush failed", what);
+        CHECK(packet_len == 0, "%s: %d bytes left after flush", what, packet_len);
+        check_carbon(what);
+}
+
+// datagrams built by hand, the relay passes on whole lines only
+static void test_malformed(void)
+{
+        static const char *const datagram[] = {
+                "yaws.cut.first 1 1700000000\nyaws.cut.second 2 17000",
+                "yaws.good 1 1700000000\n"
+                "yaws.no_timestamp 2\n"
+                "yaws.extra_field 3 1700000000 4\n"
+                "yaws.bad_value 3x 1700000000\n"
+                "yaws.bad_timestamp 4 17000000x0\n"
+                "yaws.unknown_time 5 -1\n",
+                "@yaws.compact\nextra_field 1 1700000000 1\nno_timestamp 2\nfirst 3 1700000000\nsame_time 4\n",
+        };
+        struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = htons(relay_port),
+                                  .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        for (int i = 0; i < sizeof datagram / sizeof datagram[0]; i++)
+                __real_sendto(fd, datagram[i], strlen(datagram[i]), 0, (struct sockaddr *)&to, sizeof to);
+        close(fd);
+        // a compact line without a timestamp has the one before, unknown at first
+        expected_len = snprintf(expected, sizeof expected,
+                                "yaws.good 1 1700000000\n"
+                                "yaws.unknown_time 5 -1\n"
+                                "yaws.compact.no_timestamp 2 -1\n"
+                                "yaws.compact.first 3 1700000000\n"
+                                "yaws.compact.same_time 4 1700000000\n");
+        check_carbon("malformed");
+}
+
+int main(void)
+{
+        const char *node = "yaws.sensor_600194123456", *other = "yaws.display_600194abcdef";
+        const char *metric[] = {"temperature", "pressure", "humidity", "voltage"};
+        int carbon_port, carbon_fd = loopback_socket(SOCK_STREAM, true, &carbon_port);
+        pthread_t thread;
+
+        start = time(NULL);
+        pthread_create(&thread, NULL, carbon, &carbon_fd);
+        pid_t relay = relay_child_start(YAWS_RELAY, carbon_port, &relay_port, NULL, NULL);
+        CHECK(graphite_init() == ESP_OK, "graphite_init");
+        addr.sin_port = htons(relay_port);
+
+        // a wake: float and fixed values, unknown and known timestamps
+        add(node, "temperature", 21.37f, 2, 2137, 1700000000);
+        add(node, "pressure", 101325.0f, 0, 101325, 1700000000);
+        add(node, "humidity", 45.6f, 1, 456, 1700000000);
+        add(node, "voltage", 3.012f, 3, 3012, 1700000000);
+        add_fixed(node, "temperature", -1005, 2, 0);
+        add_fixed(node, "wake.total_ms", 1298, 0, 0);
+        add_fixed(node, "wake.energy_uah", 214, 1, 0);
+        check_flushed("wake");
+
+        // batched samples from flash: many datagrams, timestamps repeat in runs
+        for (int i = 0; i < 2000; i++) {
+                int32_t v = (i * 7919) % 200000 - 100000;
+                add_fixed(node, metric[i % 4], v, i % 4, i % 17 == 0 ? 0 : 1700000000 + i / 4 * 60);
+        }
+        check_flushed("samples");
+
+        // prefix changes within a batch
+        for (int i = 0; i < 300; i++)
+                add_fixed(i % 3 ? node : other, metric[i % 4], i, 1, 1700000000 + i / 2);
+        check_flushed("prefixes");
+
+        // a line that fills a datagram on its own, and one that can't fit
+        char long_metric[MTU_PAYLOAD];
+        memset(long_metric, 'm', sizeof long_metric);
+        int fill = MTU_PAYLOAD - strlen(node) - 20;
+        long_metric[fill] = 0;
+        add_fixed(node, "before", 1, 0, 1700000000);
+        add_fixed(node, long_metric, 1, 0, 1700000000);
+        add_fixed(node, "after", 1, 0, 1700000000);
+        long_metric[fill] = 'm';
+        long_metric[sizeof long_metric - 1] = 0;
+        CHECK(graphite_batch_add_fixed(node, long_metric, 1, 0, 0) == ESP_ERR_INVALID_SIZE,
+              "line longer than a datagram accepted");
+        check_flushed("long lines");
+
+        test_malformed();
+        graphite_close();
+        relay_child_stop(relay);
+        pthread_join(thread, NULL);
+        return check_done();
+}
@@ -0,0 +1,236 @@
+/*
+  OTA version negotiation and update against a local HTTP server, see
+  http_mock.h: which files ota() asks for in which case, on how many
+  connections, what it concludes, and that a delta patch or a full image
+  ends up in the update partition byte for byte, or not at all if the
+  patch doesn't check out. The patch is built by tools/yaws-delta.c from
+  two images as a release differs from the one before.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+// manifest cache is looked at directly
+#include "ota.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "flash_mock.h"
+#include "http_mock.h"
+#include "ota_mock.h"
+#include "check.h"
+
+#define NODE "/ota/00:00:00:00:00:00/"
+#define IMAGE_SIZE (64 * 1024)
+
+static const esp_partition_t *running, *next;
+static uint8_t old_image[IMAGE_SIZE], new_image[IMAGE_SIZE], patch[IMAGE_SIZE / 4];
+static int patch_len;
+
+static void sha256(const void *data, int len, uint8_t out[32])
+{
+        mbedtls_sha256_context ctx;
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts_ret(&ctx, 0);
+        mbedtls_sha256_update_ret(&ctx, data, len);
+        mbedtls_sha256_finish_ret(&ctx, out);
+        mbedtls_sha256_free(&ctx);
+}
+
+// FIPS 180-4 examples, one and two blocks
+static void test_sha256(void)
+{
+        static const struct {
+                const char *text;
+                uint8_t digest[32];
+        } vector[] = {
+                {"abc", {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+                         0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad}},
+                {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                 {0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+                  0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1}},
+        };
+        for (int i = 0; i < sizeof vector / sizeof vector[0]; i++) {
+                uint8_t digest[32];
+                sha256(vector[i].text, strlen(vector[i].text), digest);
+                CHECK(memcmp(digest, vector[i].digest, 32) == 0, "SHA-256 of \"%s\" is wrong", vector[i].text);
+        }
+}
+
+static void write_file(const char *path, const void *data, int len)
+{
+        FILE *f = fopen(path, "wb");
+        if (f == NULL || fwrite(data, 1, len, f) != len || fclose(f) != 0) {
+                perror(path);
+                exit(1);
+        }
+}
+
+/*
+  The new image is the old one with code inserted a third of the way
+  in, so that the rest is shifted, a block repeated, and an address
+  changed every 4 KiB. yaws-delta diffs the two.
+ */
+static void make_images(void)
+{
+        char old_path[] = "/tmp/yaws-old-XXXXXX", new_path[] = "/tmp/yaws-new-XXXXXX",
+             patch_path[] = "/tmp/yaws-patch-XXXXXX";
+        int status;
+
+        for (int i = 0; i < IMAGE_SIZE; i++)
+                old_image[i] = i * 2654435761u >> 24 ^ i >> 8;
+        memcpy(new_image, old_image, IMAGE_SIZE / 3);
+        for (int i = 0; i < 100; i++)
+                new_image[IMAGE_SIZE / 3 + i] = i * 40503u >> 8;
+        memcpy(new_image + IMAGE_SIZE / 3 + 100, old_image + IMAGE_SIZE / 3, IMAGE_SIZE - IMAGE_SIZE / 3 - 100);
+        memcpy(new_image + IMAGE_SIZE / 2, new_image + IMAGE_SIZE / 2 - 1000, 300);
+        for (int off = 4092; off < IMAGE_SIZE; off += 4096)
+                memcpy(new_image + off, "\x12\x34\x56\x78", 4);
+
+        close(mkstemp(old_path));
+        close(mkstemp(new_path));
+        close(mkstemp(patch_path));
+        write_file(old_path, old_image, IMAGE_SIZE);
+        write_file(new_path, new_image, IMAGE_SIZE);
+        pid_t pid = fork();
+        if (pid == 0) {
+                execl(YAWS_DELTA, "yaws-delta", "diff", old_path, new_path, patch_path, NULL);
+                perror(YAWS_DELTA);
+                _exit(1);
+        }
+        waitpid(pid, &status, 0);
+        FILE *f = fopen(patch_path, "rb");
+        patch_len = f == NULL ? 0 : fread(patch, 1, sizeof patch, f);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0 && f != NULL && feof(f),
+              "yaws-delta diff failed or the patch is larger than %zu bytes", sizeof patch);
+        if (f != NULL)
+                fclose(f);
+        unlink(old_path);
+        unlink(new_path);
+        unlink(patch_path);
+
+        uint8_t digest[32];
+        sha256(new_image, IMAGE_SIZE, digest);
+        CHECK(patch_len > DELTA_HEADER_SIZE && memcmp(patch, DELTA_MAGIC, 4) == 0 &&
+              memcmp(patch + 8, digest, 32) == 0, "patch header doesn't describe the new image");
+        printf("patch: %d bytes\n", patch_len);
+}
+
+// a wake: power-on drops the manifest cache in RTC memory
+static void wake(bool power_on)
+{
+        manifest_fetched = false;
+        manifest_flags = 0;
+        if (power_on)
+                memset(&manifest_cache, 0, sizeof manifest_cache);
+        ota_mock_init(running, next);
+        esp_partition_erase_range(next, 0, next->size);
+        memset(&http_mock_stats, 0, sizeof http_mock_stats);
+}
+
+static void check_ota(const char *what, esp_err_t expected, bool update, unsigned long requests,
+                      unsigned long connections)
+{
+        char updated = 0;
+        esp_err_t err = ota(&updated);
+        static uint8_t flash[IMAGE_SIZE];
+
+        CHECK(err == expected, "%s: ota() returned %s, expected %s", what, esp_err_to_name(err),
+              esp_err_to_name(expected));
+        CHECK(updated == update && (ota_mock_boot == next) == update, "%s: %supdated", what, updated ? "" : "not ");
+        CHECK(http_mock_stats.requests == requests, "%s: %lu requests, expected %lu", what,
+              http_mock_stats.requests, requests);
+        CHECK(http_mock_stats.connections == connections, "%s: %lu connections, expected %lu", what,
+              http_mock_stats.connections, connections);
+        if (update) {
+                esp_partition_read(next, 0, flash, sizeof flash);
+                CHECK(memcmp(flash, new_image, IMAGE_SIZE) == 0, "%s: new image differs", what);
+        }
+        printf("%s: %s, %lu requests on %lu connections, %lu bytes\n", what, esp_err_to_name(err),
+               http_mock_stats.requests, http_mock_stats.connections, http_mock_stats.bytes);
+}
+
+static void serve_text(const char *path, const char *text, const char *etag)
+{
+        http_mock_file(path, text, strlen(text), etag);
+}
+
+int main(void)
+{
+        running = flash_mock_temp("ota_0", 2 * IMAGE_SIZE);
+        next = flash_mock_temp("ota_1", 2 * IMAGE_SIZE);
+        if (running == NULL || next == NULL)
+                return 1;
+
+        esp_log_level_set("*", ESP_LOG_WARN);
+        test_sha256();
+        make_images();
+        esp_partition_write(running, 0, old_image, IMAGE_SIZE);
+        strcpy(ota_mock_app.project_name, "sensor");
+        strcpy(ota_mock_app.version, "1.0");
+
+        // up to date by the global manifest; the node one's 404 is read,
+        // so the connection is kept for the next request
+        serve_text("/ota/sensor.manifest", "version 1.0\nflags vdd_offset_calibration\n", "\"m1\"");
+        wake(true);
+        check_ota("up to date", ESP_OK, false, 2, 1);
+        CHECK(manifest_cache.magic == OTA_MANIFEST_MAGIC, "manifest ETag not kept");
+        CHECK(vdd_offset_calibration_requested() == 1 && http_mock_stats.requests == 2,
+              "flags not answered from the manifest");
+
+        // next wake asks with the ETag and keeps the flags of the cache
+        wake(false);
+        check_ota("not modified", ESP_OK, false, 2, 1);
+        CHECK(http_mock_stats.not_modified == 1, "manifest fetched again");
+        CHECK(vdd_offset_calibration_requested() == 1, "flags of the cached manifest lost");
+
+        // a node manifest wins, images default to its directory; the
+        // patch comes on the same connection
+        serve_text(NODE "sensor.manifest", "version 1.1\n", NULL);
+        http_mock_file(NODE "sensor.1.0.delta", patch, patch_len, NULL);
+        http_mock_file(NODE "sensor.bin", new_image, IMAGE_SIZE, NULL);
+        wake(false);
+        check_ota("delta", ESP_OK, true, 2, 1);
+        CHECK(manifest_cache.magic == 0, "manifest of another version kept");
+        CHECK(vdd_offset_calibration_requested() == 0, "flags of the global manifest used");
+
+        // a patch whose SHA-256 doesn't match is not booted, the full image is
+        patch[8] ^= 1;
+        http_mock_file(NODE "sensor.1.0.delta", patch, patch_len, NULL);
+        patch[8] ^= 1;
+        wake(false);
+        check_ota("bad delta", ESP_OK, true, 3, 2);
+        http_mock_remove(NODE "sensor.bin");
+        wake(false);
+        check_ota("bad delta, no image", ESP_ERR_NOT_FOUND, false, 3, 2);
+
+        // full image from another host, without a patch
+        serve_text(NODE "sensor.manifest", "version 1.1\nurl http://images.home.arpa/fw/sensor-1.1.bin\n", NULL);
+        http_mock_file("/fw/sensor-1.1.bin", new_image, IMAGE_SIZE, NULL);
+        wake(false);
+        check_ota("other host", ESP_OK, true, 3, 3);
+
+        // server without manifests: .version files, per node first, each
+        // on a client of its own; the patch is asked for on the manifest's
+        http_mock_clear();
+        serve_text("/ota/sensor.version", "1.0\n", NULL);
+        wake(true);
+        check_ota("version file", ESP_OK, false, 4, 3);
+        serve_text(NODE "sensor.version", "1.1\n", NULL);
+        http_mock_file(NODE "sensor.bin", new_image, IMAGE_SIZE, NULL);
+        wake(true);
+        check_ota("node version file", ESP_OK, true, 5, 3);
+        unsigned long requests = http_mock_stats.requests;
+        CHECK(vdd_offset_calibration_requested() == 0 && http_mock_stats.requests == requests + 1,
+              "calibration flag file not asked for");
+        serve_text(NODE "sensor.vdd_offset_calibration", "", NULL);
+        CHECK(vdd_offset_calibration_requested() == 1, "calibration flag file not found");
+
+        // nothing at all
+        http_mock_clear();
+        wake(true);
+        check_ota("nothing", ESP_ERR_NOT_FOUND, false, 4, 3);
+
+        return check_done();
+}
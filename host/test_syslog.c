@@ -0,0 +1,216 @@
+/*
+  Log hook and syslog_task on recorded ESP_LOG output: a sensor boot log
+  written before the socket exists must come out whole and in order, SDK
+  noise filtered, and lines of tasks logging at once must neither mix
+  nor go missing without being counted in a "dropped N messages" record.
+  Datagrams are taken from sendmsg(), see --wrap in CMakeLists.txt.
+
+  cmake -S host -B build-host && cmake --build build-host && ctest --test-dir build-host
+ */
+// ring and counters are looked at directly
+#include "syslog.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+
+static pthread_mutex_t sent_lock = PTHREAD_MUTEX_INITIALIZER;
+static char sent[8 << 20];
+static int sent_len, datagrams;
+
+// messages of a datagram go into sent[] one per line
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+        ssize_t n = 0;
+        pthread_mutex_lock(&sent_lock);
+        for (int i = 0; i < msg->msg_iovlen; i++)
+                n += msg->msg_iov[i].iov_len;
+        if (sent_len + n + 2 < sizeof sent) {
+                for (int i = 0; i < msg->msg_iovlen; i++) {
+                        memcpy(sent + sent_len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+                        sent_len += msg->msg_iov[i].iov_len;
+                }
+                sent[sent_len++] = '\n';
+                sent[sent_len] = 0;
+        }
+        datagrams++;
+        pthread_mutex_unlock(&sent_lock);
+        return n;
+}
+
+static void hook(const char *fmt, ...)
+{
+        va_list va;
+        va_start(va, fmt);
+        syslog_vprintf(fmt, va);
+        va_end(va);
+}
+
+// until syslog_task has sent everything
+static void drain(void)
+{
+        for (int i = 0; i < 2000 && tail != head; i++)
+                usleep(1000);
+        usleep(10000);
+}
+
+/*
+  Console output of a sensor wake, as the hook gets it, and the message
+  expected on the wire; NULL if it is filtered.
+ */
+static const struct {
+        const char *line, *message;
+} recorded[] = {
+        {"\033[0;32mI (312) yaws-sensor: version: 1.4-12-gf6c08ca\033[0m\n",
+         "<133> yaws-sensor I (312) version: 1.4-12-gf6c08ca"},
+        {"\033[0;32mI (318) yaws-sensor: reset reason 5, wake 1234\033[0m\n",
+         "<133> yaws-sensor I (318) reset reason 5, wake 1234"},
+        {"\033[0;32mI (325) yaws-wifi: cached AP: channel 6, bssid 4c:ed:fb:b2:df:a8\033[0m\n",
+         "<133> yaws-wifi I (325) cached AP: channel 6, bssid 4c:ed:fb:b2:df:a8"},
+        {"mode : sta(60:01:94:12:34:56)\n", "<134> mode : sta(60:01:94:12:34:56)"},
+        {"add if0\n", "<134> add if0"},
+        {"wifi E (238) timer:0x3ffe9a24 cb is null\n", NULL},
+        {"\033[0;32mI (341) yaws-sensor: bme280 at 0x76\033[0m\n", "<133> yaws-sensor I (341) bme280 at 0x76"},
+        {"\033[0;32mI (342) yaws-sensor: adt7410 not found\033[0m\n", "<133> yaws-sensor I (342) adt7410 not found"},
+        {"\033[0;32mI (356) yaws-sensor: temperature: 21.37°C\033[0m\n",
+         "<133> yaws-sensor I (356) temperature: 21.37°C"},
+        {"\033[0;32mI (356) yaws-sensor: pressure: 101325 Pa\033[0m\n",
+         "<133> yaws-sensor I (356) pressure: 101325 Pa"},
+        {"\033[0;32mI (357) yaws-sensor: humidity: 45.2%\033[0m\n", "<133> yaws-sensor I (357) humidity: 45.2%"},
+        {"\033[0;32mI (358) yaws-sensor: voltage: 3.712 V\033[0m\n", "<133> yaws-sensor I (358) voltage: 3.712 V"},
+        {"scandone\n", "<134> scandone"},
+        {"state: 0 -> 2 (b0)\n", "<134> state: 0 -> 2 (b0)"},
+        {"state: 2 -> 3 (0)\n", "<134> state: 2 -> 3 (0)"},
+        {"state: 3 -> 5 (10)\n", "<134> state: 3 -> 5 (10)"},
+        {"\033[0;33mW (787) wifi:<ba-add>idx:1 (ifx:0, 4c:ed:fb:b2:df:a8), tid:0, ssn:0, winSize:64\033[0m\n",
+         NULL},
+        {"\033[0;32mI (801) wifi: connected with yaws, channel 6\033[0m\n",
+         "<133> wifi I (801) connected with yaws, channel 6"},
+        {"\033[0;32mI (1012) event: sta ip: 192.168.1.42, mask: 255.255.255.0, gw: 192.168.1.1\033[0m\n",
+         "<133> event I (1012) sta ip: 192.168.1.42, mask: 255.255.255.0, gw: 192.168.1.1"},
+        {"\033[0;32mI (1013) yaws-wifi: connected in 688 ms\033[0m\n",
+         "<133> yaws-wifi I (1013) connected in 688 ms"},
+        {"\033[0;33mW (817) wifi:hmac tx: ifx0 stop, discard\033[0m\n", NULL},
+        {"\033[0;33mW (817) wifi:<ba-del>idx\033[0m\n", NULL},
+        {"@@ pm open\n", NULL},
+        {"\033[0;31mE (1523) yaws-graphite: frame 12 not acknowledged: ESP_ERR_TIMEOUT\033[0m\n",
+         "<131> yaws-graphite E (1523) frame 12 not acknowledged: ESP_ERR_TIMEOUT"},
+        {"\033[0;33mW (1530) yaws-sensor: sent 6 of 8 samples\033[0m\n",
+         "<132> yaws-sensor W (1530) sent 6 of 8 samples"},
+        {"\033[0;32mI (1601) yaws-ota: up to date\033[0m\n", "<133> yaws-ota I (1601) up to date"},
+        {"\033[0;32mI (1610) yaws-sensor: wake: total 1298 ms, energy 21.4 uAh\033[0m\n",
+         "<133> yaws-sensor I (1610) wake: total 1298 ms, energy 21.4 uAh"},
+        {"\033[0;32mI (1611) yaws-sensor: sleeping for 180 s\033[0m\n",
+         "<133> yaws-sensor I (1611) sleeping for 180 s"},
+};
+#define RECORDED (sizeof recorded / sizeof recorded[0])
+
+// before WiFi is up all lines wait in the ring
+static void test_boot(void)
+{
+        char expected[8192] = "";
+        int messages = 0;
+
+        syslog_early_init();
+        old_vprintf = NULL; // no console
+        for (int i = 0; i < RECORDED; i++) {
+                hook("%s", recorded[i].line);
+                if (recorded[i].message != NULL) {
+                        strcat(expected, recorded[i].message);
+                        strcat(expected, "\n");
+                        messages++;
+                }
+        }
+        // a line written in parts, and one longer than a line buffer
+        hook("I (2000) yaws-sensor: temperature: ");
+        hook("%d.%02d\n", 21, 37);
+        strcat(expected, "<133> yaws-sensor I (2000) temperature: 21.37\n");
+        char long_line[SIZE + 100];
+        memset(long_line, 'x', sizeof long_line);
+        memcpy(long_line, "I (2001) long: ", 15);
+        long_line[sizeof long_line - 2] = '\n';
+        long_line[sizeof long_line - 1] = 0;
+        hook("%s", long_line);
+        snprintf(expected + strlen(expected), sizeof expected - strlen(expected),
+                 "<133> long I (2001) %.*s\n", SIZE - 1 - 15, long_line + 15);
+
+        usleep(200000);
+        CHECK(sent_len == 0, "sent before there is a socket");
+        syslog_init();
+        drain();
+
+        // newline framing: messages of a datagram are split by newlines too
+        pthread_mutex_lock(&sent_lock);
+        CHECK(strcmp(sent, expected) == 0, "sent:\n%s\nexpected:\n%s", sent, expected);
+        printf("boot: %d of %d lines sent in %d datagrams, %u dropped\n",
+               messages + 2, (int)RECORDED + 2, datagrams, dropped);
+        sent_len = datagrams = 0;
+        pthread_mutex_unlock(&sent_lock);
+}
+
+#define TASKS WRITERS
+#define LINES 20000
+
+static volatile int done;
+
+static void writer_task(void *arg)
+{
+        int t = (intptr_t)arg;
+        for (int i = 0; i < LINES; i++)
+                ESP_LOGI("writer", "task %d line %d:%.*s", t, i, (t * 7 + i) % 40, "........................................");
+        __sync_fetch_and_add(&done, 1);
+        vTaskDelete(NULL);
+}
+
+// lines of tasks logging at once are whole, in order, or counted as dropped
+static void test_tasks(void)
+{
+        vprintf_like_t console = esp_log_set_vprintf(syslog_vprintf);
+        for (intptr_t t = 0; t < TASKS; t++)
+                xTaskCreate(writer_task, "writer", 4096, (void *)t, 5, NULL);
+        while (done < TASKS)
+                usleep(1000);
+        drain();
+        // reported with the next batch
+        ESP_LOGI("writer", "done");
+        drain();
+        esp_log_set_vprintf(console);
+
+        int next[TASKS] = {0}, got = 0, reported = 0, bad = 0;
+        pthread_mutex_lock(&sent_lock);
+        for (char *save, *line = strtok_r(sent, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+                int t, i;
+                unsigned tick, lost;
+                char *end = strrchr(line, ':');
+                if (sscanf(line, "<132> yaws-syslog W (%u) dropped %u messages", &tick, &lost) == 2) {
+                        reported += lost;
+                        continue;
+                }
+                if (sscanf(line, "<133> writer I (%u) done", &tick) == 1 && strcmp(line + strlen(line) - 6, ") done") == 0)
+                        continue;
+                if (sscanf(line, "<133> writer I (%u) task %d line %d:", &tick, &t, &i) != 3 || end == NULL ||
+                    t < 0 || t >= TASKS || i < next[t]) {
+                        if (bad++ < 5)
+                                printf("mixed line: %s\n", line);
+                        continue;
+                }
+                int pad = strspn(end + 1, ".");
+                CHECK(pad == (t * 7 + i) % 40 && end[1 + pad] == 0, "cut line: %s", line);
+                next[t] = i + 1;
+                got++;
+        }
+        pthread_mutex_unlock(&sent_lock);
+        CHECK(bad == 0, "%d lines mixed or out of order", bad);
+        CHECK(got + reported == TASKS * LINES, "%d lines sent, %d reported dropped, %d written",
+              got, reported, TASKS * LINES);
+        printf("%d tasks: %d lines sent in %d datagrams, %d dropped\n", TASKS, got, datagrams, reported);
+}
+
+int main(void)
+{
+        test_boot();
+        test_tasks();
+        return check_done();
+}
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "graphite.h"
+#include "flashlog.h"
+#include "batch.h"
+
+static const char *TAG = "yaws-batch";
+
+const char *const metric_name[METRIC_MAX] = {
+        [METRIC_TEMPERATURE] = "temperature",
+        [METRIC_PRESSURE] = "pressure",
+        [METRIC_HUMIDITY] = "humidity",
+        [METRIC_VOLTAGE] = "voltage",
+};
+
+const struct metric_format metric_format[METRIC_MAX] = {
+        [METRIC_TEMPERATURE] = { 2, "°C" },
+        [METRIC_PRESSURE] = { 0, "Pa" },
+        [METRIC_HUMIDITY] = { 1, "%" },
+        [METRIC_VOLTAGE] = { 3, "V" },
+};
+
+#define SAMPLES 8
+#define BATCH_MAGIC 0x5a3c0005
+
+static RTC_DATA_ATTR struct {
+        uint32_t magic;
+        uint32_t uptime;        // seconds since power-on at the start of current wake
+        uint16_t uptime_ms;     // and the fraction of a second, carried from wake to wake
+        uint32_t epoch;         // unix time of power-on, 0 if unknown
+        uint8_t wakes;          // wakes since last flush, or attempt with the store
+        uint8_t failures;       // flushes failed in a row, counted with the store
+        uint8_t head, count;
+        struct sample sample[SAMPLES];
+        struct sample reported; // last value queued per metric, ts is unused
+        uint32_t reported_ts[METRIC_MAX];
+} batch;
+
+uint32_t batch_uptime(void)
+{
+        return batch.uptime + (batch.uptime_ms + esp_log_timestamp()) / 1000;
+}
+
+uint32_t batch_epoch(void)
+{
+        return batch.epoch;
+}
+
+void batch_clock_set(time_t now)
+{
+        batch.epoch = now - batch_uptime();
+}
+
+void batch_sleep(uint32_t seconds)
+{
+        uint32_t ms = batch.uptime_ms + esp_log_timestamp();
+        batch.uptime += ms / 1000 + seconds;
+        batch.uptime_ms = ms % 1000;
+}
+
+void batch_init(void)
+{
+        if (batch.magic != BATCH_MAGIC) {
+                // RTC memory holds garbage after power-on
+                memset(&batch, 0, sizeof batch);
+                batch.magic = BATCH_MAGIC;
+        }
+        if (batch.wakes < UINT8_MAX)
+                batch.wakes++;
+}
+
+/*
+  When the network is down for long, samples that don't fit into RTC
+  memory go to the "samples" flash partition (see flashlog.h and
+  sensor/partitions.csv) instead of overwriting the oldest ones, and are
+  sent before the ones in RTC memory once it is back. Without the
+  partition only RTC memory is used.
+ */
+#define DRAIN_CHUNK 16          // samples per flash read
+static RTC_DATA_ATTR struct flashlog_index store_index;
+static struct flashlog store;
+static bool store_ok;
+
+void batch_store_open(void)
+{
+        esp_err_t err = flashlog_open(&store, "samples", sizeof(struct sample), &store_index);
+        store_ok = err == ESP_OK;
+        if (err != ESP_OK && err != ESP_ERR_NOT_FOUND)
+                ESP_LOGE(TAG, "sample store: %s", esp_err_to_name(err));
+}
+
+// RTC memory is full: samples move to flash, stamped with unix time, as
+// uptime doesn't survive power loss
+static void batch_spill(void)
+{
+        struct sample spill[SAMPLES];
+        for (int i = 0; i < batch.count; i++) {
+                spill[i] = batch.sample[(batch.head + i) % SAMPLES];
+                spill[i].ts = batch.epoch ? batch.epoch + spill[i].ts : 0;
+        }
+        esp_err_t err = flashlog_append(&store, spill, batch.count);
+        if (err != ESP_OK) {
+                ESP_LOGE(TAG, "sample store: %s", esp_err_to_name(err));
+                return;
+        }
+        ESP_LOGI(TAG, "%d samples moved to flash", batch.count);
+        batch.head = batch.count = 0;
+}
+
+bool batch_flush_due(void)
+{
+        bool stored = store_ok && !flashlog_empty(&store);
+        if (batch.count == 0 && !stored)
+                return false;
+        // offline: samples wait in flash, WiFi is tried less and less often
+        if (store_ok && batch.failures > 0)
+                return batch.wakes >= CONFIG_SENSOR_BATCH_WAKES << (batch.failures < 4 ? batch.failures : 4);
+        // backlog left in flash by the last flush goes on right away
+        return stored || batch.wakes >= CONFIG_SENSOR_BATCH_WAKES || batch.count >= SAMPLES - 1;
+}
+
+void batch_flush_done(void)
+{
+        // a successful flush resets wakes; with the store, failures back off
+        if (batch.wakes != 0 && store_ok) {
+                batch.wakes = 0;
+                if (batch.failures < UINT8_MAX)
+                        batch.failures++;
+        }
+}
+
+static const int32_t deadband_threshold[METRIC_MAX] = {
+        [METRIC_TEMPERATURE] = CONFIG_SENSOR_DEADBAND_TEMPERATURE,
+        [METRIC_PRESSURE] = CONFIG_SENSOR_DEADBAND_PRESSURE,
+        [METRIC_HUMIDITY] = CONFIG_SENSOR_DEADBAND_HUMIDITY,
+        [METRIC_VOLTAGE] = CONFIG_SENSOR_DEADBAND_VOLTAGE,
+};
+
+void batch_deadband(struct sample *s)
+{
+        for (int m = 0; m < METRIC_MAX; m++) {
+                if (!(s->mask & (1 << m)))
+                        continue;
+                if ((batch.reported.mask & (1 << m)) &&
+                    abs(s->value[m] - batch.reported.value[m]) <= deadband_threshold[m] &&
+                    s->ts - batch.reported_ts[m] < CONFIG_SENSOR_HEARTBEAT) {
+                        s->mask &= ~(1 << m);
+                        continue;
+                }
+                sample_set(&batch.reported, m, s->value[m]);
+                batch.reported_ts[m] = s->ts;
+        }
+}
+
+void batch_add(const struct sample *s)
+{
+        if (batch.count == SAMPLES && store_ok)
+                batch_spill();
+        int i = (batch.head + batch.count) % SAMPLES;
+        if (batch.count == SAMPLES)
+                batch.head = (batch.head + 1) % SAMPLES; // overwrite the oldest one
+        else
+                batch.count++;
+        batch.sample[i] = *s;
+}
+
+esp_err_t batch_flush(const char *prefix)
+{
+        esp_err_t err = ESP_OK;
+
+        // flash goes first, its samples are older; a chunk is delivered
+        // once a datagram goes out while a later one is added
+        static struct sample chunk[DRAIN_CHUNK];
+        struct flashlog_pos read = store_index.tail, delivered = read;
+        int stored = 0;
+        while (store_ok && err == ESP_OK && stored < CONFIG_SENSOR_STORE_DRAIN) {
+                struct flashlog_pos start = read;
+                int n = flashlog_read(&store, &read, chunk, DRAIN_CHUNK);
+                if (n <= 0)
+                        break;
+                uint32_t datagrams = graphite_batch_sent();
+                for (int i = 0; i < n && err == ESP_OK; i++)
+                        for (int m = 0; m < METRIC_MAX && err == ESP_OK; m++)
+                                if (chunk[i].mask & (1 << m))
+                                        err = graphite_batch_add_fixed(prefix, metric_name[m], chunk[i].value[m],
+                                                                       metric_format[m].precision, chunk[i].ts);
+                if (graphite_batch_sent() != datagrams)
+                        delivered = start;
+                stored += n;
+        }
+        uint32_t datagrams = graphite_batch_sent();
+
+        // samples whose datagrams went out are dropped even if a later one fails
+        int sent = 0;
+        for (int i = 0; i < batch.count && err == ESP_OK; i++) {
+                const struct sample *s = &batch.sample[(batch.head + i) % SAMPLES];
+                uint32_t ts = batch.epoch ? batch.epoch + s->ts : 0;
+                uint32_t datagrams = graphite_batch_sent();
+                for (int m = 0; m < METRIC_MAX && err == ESP_OK; m++)
+                        if (s->mask & (1 << m))
+                                err = graphite_batch_add_fixed(prefix, metric_name[m], s->value[m],
+                                                               metric_format[m].precision, ts);
+                if (graphite_batch_sent() != datagrams)
+                        sent = i;
+        }
+        if (err == ESP_OK)
+                err = graphite_batch_flush();
+        if (stored > 0) {
+                flashlog_consume(&store, err == ESP_OK || graphite_batch_sent() != datagrams ? read : delivered);
+                ESP_LOGI(TAG, "%d samples from flash, %s left", stored, flashlog_empty(&store) ? "none" : "more");
+        }
+        if (err == ESP_OK) {
+                ESP_LOGI(TAG, "sent %d samples", batch.count);
+                batch.head = batch.count = batch.wakes = batch.failures = 0;
+        } else if (sent > 0) {
+                ESP_LOGI(TAG, "sent %d of %d samples", sent, batch.count);
+                batch.head = (batch.head + sent) % SAMPLES;
+                batch.count -= sent;
+        }
+        return err;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <esp_err.h>
+
+/*
+  Samples of the sensor node. Radio is the most power hungry part of the
+  wake, so samples are kept in RTC memory and WiFi is brought up only
+  every CONFIG_SENSOR_BATCH_WAKES wakes to send them all at once. Metrics
+  that didn't change since they were last reported are not even queued,
+  see batch_deadband().
+
+  Samples are stamped with seconds since power-on, which the node keeps
+  across deep sleep, and sent with unix time once the clock has been set.
+ */
+enum metric {
+        METRIC_TEMPERATURE,
+        METRIC_PRESSURE,
+        METRIC_HUMIDITY,
+        METRIC_VOLTAGE,
+        METRIC_MAX
+};
+
+struct metric_format {
+        uint8_t precision;
+        const char *unit;
+};
+
+extern const char *const metric_name[METRIC_MAX];
+extern const struct metric_format metric_format[METRIC_MAX];
+
+struct sample {
+        uint32_t ts;    // seconds since power-on, see batch_uptime()
+        uint8_t mask;   // bit N is set if value[N] is valid
+        int32_t value[METRIC_MAX]; // in units of 10^-metric_format[].precision, see fixed.h
+};
+
+static inline void sample_set(struct sample *s, enum metric m, int32_t value)
+{
+        s->mask |= 1 << m;
+        s->value[m] = value;
+}
+
+// first thing on wake, before any other batch_*() call
+void batch_init(void);
+// flash store of samples that don't fit into RTC memory, if there is a partition for it
+void batch_store_open(void);
+// seconds since power-on
+uint32_t batch_uptime(void);
+// unix time of power-on, 0 if the clock was never set
+uint32_t batch_epoch(void);
+// the clock reads now, e.g. after SNTP sync
+void batch_clock_set(time_t now);
+// call right before deep sleep, so that uptime goes on on the next wake
+void batch_sleep(uint32_t seconds);
+
+// nothing to send is no reason to connect
+bool batch_flush_due(void);
+// drop metrics within the dead band of their last reported value, unless the heartbeat is due
+void batch_deadband(struct sample *s);
+void batch_add(const struct sample *s);
+// samples, oldest first, into the Graphite batch, which is flushed
+esp_err_t batch_flush(const char *prefix);
+// after batch_flush_due() said so, whether or not the flush ran: a failed one backs off
+void batch_flush_done(void);
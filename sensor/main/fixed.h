@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+/*
+  ESP8266 has no FPU: measurements are kept as integers in units of
+  10^-precision of their metric (0.01 °C, 1 Pa, 0.1 %RH, 1 mV) from the
+  driver to the wire. Conversions round half to even, so that printed
+  values are the same as printf("%.*f") of the float ones.
+ */
+
+// n / d, d > 0
+static inline int32_t fixed_div(int32_t n, int32_t d)
+{
+        int32_t q = n / d, r = n % d;
+        if (r < 0) {
+                q--;
+                r += d;
+        }
+        if (2 * r > d || (2 * r == d && (q & 1)))
+                q++;
+        return q;
+}
+
+// BME280 compensated pressure, Q24.8 Pa
+static inline int32_t fixed_pressure_pa(uint32_t q24_8)
+{
+        return fixed_div(q24_8, 256);
+}
+
+// BME280 compensated humidity, Q22.10 %RH, to 0.1 %RH
+static inline int32_t fixed_humidity_deci(uint32_t q22_10)
+{
+        return fixed_div(q22_10 * 10, 1024);
+}
+
+// MCP9808 ambient temperature register, 1/16 °C and flags, to 0.01 °C
+static inline int32_t fixed_mcp9808_centi(uint16_t ta)
+{
+        int32_t v = ta & 0x0fff;
+        if (ta & 0x1000)
+                v -= 0x1000;
+        return fixed_div(v * 100, 16);
+}
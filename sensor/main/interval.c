@@ -0,0 +1,51 @@
+#include <stdlib.h>
+
+#include "interval.h"
+
+#define INTERVAL_MAGIC 0x696e7401
+#define BACKOFF_MAX 4   // interval multiplier at the cutoff voltage
+
+static uint32_t clamp(uint32_t v, uint32_t min, uint32_t max)
+{
+        return v < min ? min : v > max ? max : v;
+}
+
+uint32_t interval_next(struct interval *s, const struct interval_config *c,
+                       bool valid, int32_t value, uint32_t ts, int32_t vdd_mv)
+{
+        if (s->magic != INTERVAL_MAGIC) {
+                // RTC memory holds garbage after power-on
+                s->magic = INTERVAL_MAGIC;
+                s->seconds = c->min;
+                s->known = false;
+        } else if (valid && s->known && ts > s->ts) {
+                uint32_t elapsed = ts - s->ts;
+                uint32_t change = abs(value - s->value);
+                if (change < c->delta) {
+                        // steady: lengthened gradually, one quiet pair of
+                        // readings is not a trend yet
+                        s->seconds = clamp(s->seconds * 3 / 2 + 1, c->min, c->max);
+                } else {
+                        // moving: shortened at once to the interval in which
+                        // the signal changes by delta at this rate
+                        s->seconds = clamp((uint64_t)c->delta * elapsed / change, c->min, c->max);
+                }
+        }
+        if (valid) {
+                s->known = true;
+                s->ts = ts;
+                s->value = value;
+        }
+
+        uint32_t seconds = s->seconds;
+        if (vdd_mv >= 1000 && vdd_mv < c->vdd_full) {
+                int32_t left = vdd_mv > c->vdd_cutoff ? vdd_mv - c->vdd_cutoff : 0;
+                int32_t range = c->vdd_full - c->vdd_cutoff;
+                // linear from 1 at full to BACKOFF_MAX at the cutoff
+                if (range > 0)
+                        seconds += seconds * (BACKOFF_MAX - 1) * (range - left) / range;
+                else
+                        seconds *= BACKOFF_MAX;
+        }
+        return seconds;
+}
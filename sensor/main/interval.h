@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  Sleep interval of the sensor node. It is chosen so that the signal
+  changes by about the configured delta between wakes: lengthened
+  gradually while the signal is steady, shortened at once when it moves
+  fast, and stretched further as battery voltage approaches the cutoff.
+ */
+struct interval_config {
+        uint16_t min, max;      // s
+        uint32_t delta;         // target change between samples, in signal units
+        int32_t vdd_full;       // mV, no back-off above
+        int32_t vdd_cutoff;     // mV, back-off is the largest at and below; if not
+                                // below vdd_full, it is a step there
+};
+
+// kept in RTC memory between wakes
+struct interval {
+        uint32_t magic;
+        uint32_t ts;            // time of the previous value, s
+        int32_t value;          // previous value
+        uint16_t seconds;       // interval before battery back-off
+        bool known;             // value and ts are set
+};
+
+// vdd_mv < 1000 means no battery: no back-off
+uint32_t interval_next(struct interval *s, const struct interval_config *c,
+                       bool valid, int32_t value, uint32_t ts, int32_t vdd_mv);
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "driver/adc.h"
 #include "driver/i2c.h"
@@ -14,6 +17,7 @@
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "lwip/apps/sntp.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -24,7 +28,12 @@
 
 #include "syslog.h"
 #include "graphite.h"
+#include "ftoa.h"
 #include "wifi.h"
+#include "wake.h"
+#include "fixed.h"
+#include "interval.h"
+#include "batch.h"
 
 static const char* TAG = "undefined";
 
@@ -33,11 +42,25 @@ static const char* TAG = "undefined";
 #define SCL_GPIO GPIO_NUM_5  // pin D1
 #define PWR_GPIO GPIO_NUM_13 // pin D7
 
-#if CONFIG_NEWLIB_NANO_FORMAT
-# error newlib nano format library does not support formatting floats
-#endif
+static void sample_log(const struct sample *s)
+{
+        char buf[128], *w = buf, *end = buf + sizeof buf;
+        for (int m = 0; m < METRIC_MAX && end - w > 1; m++) {
+                if ((s->mask & (1 << m)) == 0)
+                        continue;
+                w += snprintf(w, end - w, "%s%s: ", w == buf ? "" : ", ", metric_name[m]);
+                if (w >= end)
+                        break;
+                int n = fixtoa(w, end - w, s->value[m], metric_format[m].precision);
+                if (n < 0)
+                        break;
+                w += n;
+                w += snprintf(w, end - w, "%s", metric_format[m].unit);
+        }
+        ESP_LOGI(TAG, "%s", buf);
+}
 
-static float vdd;
+static int32_t vdd; // mV
 static void vdd_read()
 {
         // WiFI and interrupts must be off, otherwise readings are noisy
@@ -65,103 +88,234 @@ static void vdd_read()
                         break;
                 }
         }
-        vdd = (float)adc_data / 1000 * offset;
+        // the only float operation left: the table is written by hand
+        vdd = fixed_div(adc_data * (int32_t)(offset * 1000 + 0.5f), 1000);
 }
 
-static esp_err_t read_bme280(struct timeval *poweron __attribute__(()))
-{
-        bmp280_params_t params;
-        bmp280_init_default_params(&params);
-        bmp280_t dev;
-        memset(&dev, 0, sizeof(bmp280_t));
-
-        ESP_ERROR_CHECK(bmp280_init_desc(&dev, BMP280_I2C_ADDRESS_1, I2C_PORT, SDA_GPIO, SCL_GPIO));
-        ESP_ERROR_CHECK(bmp280_init(&dev, &params));
+// Sensor module is power-cycled every wake, but identification and
+// calibration of its sensors don't change. They are kept here, so that a
+// warm wake only writes the configuration.
+static RTC_DATA_ATTR struct {
+        uint8_t known;          // bit per sensors[] entry initialized before
+        adt7410_shadow_t adt7410;
+        struct {
+                uint8_t id;
+                uint8_t calib[offsetof(bmp280_t, i2c_dev)]; // dig_T1..dig_H6
+        } bmp280;
+        uint8_t crc;
+} shadow;
 
-        bool busy;
-        do {
-                ets_delay_us(250); // for whatever reason, bme280 doesn't start measuring right away
-                ESP_ERROR_CHECK(bmp280_is_measuring(&dev, &busy));
-        } while (busy);
+enum { SENSOR_ADT7410, SENSOR_MCP9808, SENSOR_BME280, SENSOR_MAX };
 
-        float pressure, temperature, humidity;
-        esp_err_t res = bmp280_read_float(&dev, &temperature, &pressure, &humidity);
+#define KNOWN(sensor) (shadow.known & BIT(sensor))
 
-        gpio_set_level(PWR_GPIO, 0); // power-off sensor module
-        if (res == ESP_OK) {
-                const char *metric[] = {"temperature", "pressure", "humidity", vdd > 0.5 ? "voltage" : NULL, NULL};
-                const float value[] = {temperature, pressure, humidity, vdd};
-
-                graphite(macstr("yaws.sensor_", ""), metric, value);
-                ESP_LOGI(TAG, "temperature: %.2f°C, pressure: %.2fPa, humidity: %.2f%%, voltage: %0.2fV", temperature, pressure, humidity, vdd);
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+        uint8_t crc = 0xff;
+        while (len--) {
+                crc ^= *data++;
+                for (int i = 0; i < 8; i++)
+                        crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
         }
-        return res;
+        return crc;
 }
 
-static esp_err_t read_mcp9808(struct timeval *poweron)
+// RTC memory holds garbage after power-on, the CRC tells
+static void shadow_load()
 {
-        i2c_dev_t dev = {.port = 0};
-        ESP_ERROR_CHECK(mcp9808_init_desc(&dev, MCP9808_I2C_ADDR_000, I2C_PORT, SDA_GPIO, SCL_GPIO));
-        ESP_ERROR_CHECK(mcp9808_init(&dev));
+        if (shadow.crc != crc8((uint8_t *)&shadow, offsetof(typeof(shadow), crc)))
+                memset(&shadow, 0, sizeof shadow);
+        if (!KNOWN(SENSOR_ADT7410))
+                shadow.adt7410.id = 0;
+        shadow.adt7410.conf = 0; // power-on default, the module was off
+}
+
+static void shadow_store()
+{
+        shadow.crc = crc8((uint8_t *)&shadow, offsetof(typeof(shadow), crc));
+}
 
+static int msec_since(const struct timeval *t)
+{
         struct timeval now;
         gettimeofday(&now, NULL);
-        int poweron_duration_msec = (now.tv_sec - poweron->tv_sec) *  1000 + (now.tv_usec - poweron->tv_usec) / 1000;
+        return (now.tv_sec - t->tv_sec) * 1000 + (now.tv_usec - t->tv_usec) / 1000;
+}
 
-        // mcp9808 needs 250ms to perform measurement
-        const int measurement_delay_msec = 250 * 1.2; // +20% tolerance
-        if (poweron_duration_msec <  measurement_delay_msec)
-                vTaskDelay((measurement_delay_msec - poweron_duration_msec) / portTICK_PERIOD_MS);
+static bmp280_t bme280;
 
-        float temperature = 0;
-        esp_err_t res = mcp9808_get_temperature(&dev, &temperature, NULL, NULL, NULL);
+// bmp280_init() without the ID, reset and calibration reads
+static esp_err_t bmp280_init_shadow(bmp280_t *dev, bmp280_params_t *params)
+{
+        if (!KNOWN(SENSOR_BME280)) {
+                esp_err_t err = bmp280_init(dev, params);
+                if (err == ESP_OK) {
+                        shadow.bmp280.id = dev->id;
+                        memcpy(shadow.bmp280.calib, dev, sizeof shadow.bmp280.calib);
+                }
+                return err;
+        }
+        memcpy(dev, shadow.bmp280.calib, sizeof shadow.bmp280.calib);
+        dev->id = shadow.bmp280.id;
 
-        gpio_set_level(PWR_GPIO, 0); // power-off sensor module
+        // forced mode measurement is started separately
+        uint8_t mode = params->mode == BMP280_MODE_FORCED ? BMP280_MODE_SLEEP : params->mode;
+        uint8_t config = (params->standby << 5) | (params->filter << 2);
+        uint8_t ctrl = (params->oversampling_temperature << 5) | (params->oversampling_pressure << 2) | mode;
+        uint8_t ctrl_hum = params->oversampling_humidity;
 
-        if (res == ESP_OK) {
-                const char *metric[] = {"temperature", vdd > 0.5 ? "voltage": NULL, NULL};
-                const float value[] = {temperature, vdd };
+        esp_err_t err;
+        I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+        err = i2c_dev_write_reg(&dev->i2c_dev, 0xf5, &config, 1);
+        // humidity setting takes effect on the following ctrl_meas write
+        if (err == ESP_OK && dev->id == BME280_CHIP_ID)
+                err = i2c_dev_write_reg(&dev->i2c_dev, 0xf2, &ctrl_hum, 1);
+        if (err == ESP_OK)
+                err = i2c_dev_write_reg(&dev->i2c_dev, 0xf4, &ctrl, 1);
+        I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+        return err;
+}
+
+static esp_err_t start_bme280(struct timeval *started)
+{
+        bmp280_params_t params;
+        bmp280_init_default_params(&params);
+        memset(&bme280, 0, sizeof(bmp280_t));
+
+        esp_err_t err = bmp280_init_desc(&bme280, BMP280_I2C_ADDRESS_1, I2C_PORT, SDA_GPIO, SCL_GPIO);
+        if (err == ESP_OK)
+                err = bmp280_init_shadow(&bme280, &params); // normal mode, measures right away
+        return err;
+}
+
+static esp_err_t read_bme280(struct sample *sample)
+{
+        bool busy;
+        esp_err_t res;
+        do {
+                ets_delay_us(250); // for whatever reason, bme280 doesn't start measuring right away
+                if ((res = bmp280_is_measuring(&bme280, &busy)) != ESP_OK)
+                        return res;
+        } while (busy);
 
-                graphite(macstr("yaws.sensor_", ""), metric, value);
-                ESP_LOGI(TAG, "temperature: %.2f°C, voltage: %0.2fV", temperature, vdd);
+        int32_t temperature;
+        uint32_t pressure, humidity;
+        res = bmp280_read_fixed(&bme280, &temperature, &pressure, &humidity);
+        if (res == ESP_OK) {
+                sample_set(sample, METRIC_TEMPERATURE, temperature);
+                sample_set(sample, METRIC_PRESSURE, fixed_pressure_pa(pressure));
+                // BMP280 has no humidity sensor
+                if (bme280.id == BME280_CHIP_ID)
+                        sample_set(sample, METRIC_HUMIDITY, fixed_humidity_deci(humidity));
         }
         return res;
 }
 
-static esp_err_t read_adt7410(struct timeval *poweron)
+static i2c_dev_t mcp9808 = {.port = 0};
+
+static esp_err_t start_mcp9808(struct timeval *started)
 {
-        adt7410_t dev = {.i2c_dev = {.port = 0}};
-        ESP_ERROR_CHECK(adt7410_init_desc(&dev, ADT7410_I2C_ADDR_000, I2C_PORT, SDA_GPIO, SCL_GPIO));
-        ESP_ERROR_CHECK(adt7410_init(&dev, ADT7410_ONE_SHOT, ADT7410_RES_16));
+        esp_err_t err = mcp9808_init_desc(&mcp9808, MCP9808_I2C_ADDR_000, I2C_PORT, SDA_GPIO, SCL_GPIO);
+        // only configuration and alert lock bits are set by mcp9808_init(),
+        // power-on defaults are as good on a known device
+        if (err == ESP_OK && !KNOWN(SENSOR_MCP9808))
+                err = mcp9808_init(&mcp9808);
+        if (err != ESP_OK)
+                return err;
 
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        int poweron_duration_msec = (now.tv_sec - poweron->tv_sec) *  1000 + (now.tv_usec - poweron->tv_usec) / 1000;
+        // the first conversion after power-on runs at the finest resolution,
+        // for any other one restart conversion from shutdown with the new setting
+        const mcp9808_resolution_t resolution = CONFIG_SENSOR_MCP9808_RESOLUTION;
+        if (resolution == MCP9808_RES_00625)
+                return ESP_OK;
+        if ((err = mcp9808_set_mode(&mcp9808, MCP9808_SHUTDOWN)) == ESP_OK &&
+            (err = mcp9808_set_resolution(&mcp9808, resolution)) == ESP_OK)
+                err = mcp9808_set_mode(&mcp9808, MCP9808_CONTINUOUS);
+        gettimeofday(started, NULL);
+        return err;
+}
 
-        // adt7410 needs 240ms to perform measurement
-        const int measurement_delay_msec = 240 * 1.2; // +20% tolerance
-        if (poweron_duration_msec <  measurement_delay_msec)
-                vTaskDelay((measurement_delay_msec - poweron_duration_msec) / portTICK_PERIOD_MS);
+// ambient temperature register directly: mcp9808_get_temperature() returns float
+static esp_err_t read_mcp9808(struct sample *sample)
+{
+        uint8_t ta[2];
+        I2C_DEV_TAKE_MUTEX(&mcp9808);
+        I2C_DEV_CHECK(&mcp9808, i2c_dev_read_reg(&mcp9808, 0x05, ta, 2));
+        I2C_DEV_GIVE_MUTEX(&mcp9808);
+        sample_set(sample, METRIC_TEMPERATURE, fixed_mcp9808_centi(ta[0] << 8 | ta[1]));
+        return ESP_OK;
+}
 
-        float temperature = 0;
-        esp_err_t res = adt7410_get_temperature(&dev, &temperature);
+#if CONFIG_SENSOR_ADT7410_FAST
+#define ADT7410_MODE ADT7410_1SPC
+#define ADT7410_RESOLUTION ADT7410_RES_13
+#else
+#define ADT7410_MODE ADT7410_ONE_SHOT
+#define ADT7410_RESOLUTION ADT7410_RES_16
+#endif
 
-        gpio_set_level(PWR_GPIO, 0); // power-off sensor module
+static adt7410_t adt7410 = {.i2c_dev = {.port = 0}, .shadow = &shadow.adt7410};
 
-        if (res == ESP_OK) {
-                const char *metric[] = {"temperature", vdd > 0.5 ? "voltage": NULL, NULL};
-                const float value[] = {temperature, vdd };
+static esp_err_t start_adt7410(struct timeval *started)
+{
+        esp_err_t err = adt7410_init_desc(&adt7410, ADT7410_I2C_ADDR_000, I2C_PORT, SDA_GPIO, SCL_GPIO);
+        // switching from power-on continuous mode starts the conversion
+        if (err == ESP_OK)
+                err = adt7410_init(&adt7410, ADT7410_MODE, ADT7410_RESOLUTION);
+        return err;
+}
 
-                graphite(macstr("yaws.sensor_", ""), metric, value);
-                ESP_LOGI(TAG, "temperature: %.2f°C, voltage: %0.2fV", temperature, vdd);
-        }
+static esp_err_t read_adt7410(struct sample *sample)
+{
+        int16_t temperature = 0;
+        esp_err_t res = adt7410_wait_ready(&adt7410, adt7410_conversion_time(ADT7410_MODE) * 12 / 10); // +20% tolerance
+        if (res == ESP_OK)
+                res = adt7410_get_temperature_fixed(&adt7410, &temperature);
+        if (res == ESP_OK)
+                sample_set(sample, METRIC_TEMPERATURE, temperature);
         return res;
 }
 
-static uint8_t i2c_addr_detect()
+// MCP9808 has no data ready flag, conversion time depends on resolution
+#define MCP9808_CONVERSION_MSEC                         \
+        (CONFIG_SENSOR_MCP9808_RESOLUTION == 0 ? 30 :   \
+         CONFIG_SENSOR_MCP9808_RESOLUTION == 1 ? 65 :   \
+         CONFIG_SENSOR_MCP9808_RESOLUTION == 2 ? 130 : 250)
+
+// All detected sensors start conversion together and are read as their
+// conversions complete, so the sensor module is on for the slowest one.
+// When sensors share a metric, the value of the earlier entry is kept:
+// they are listed from the most to the least accurate one.
+static const struct sensor_driver {
+        const char *name;
+        uint8_t addr;
+        uint8_t metrics;                // bit per enum metric
+        uint16_t conversion_msec;       // from start to the earliest read
+        esp_err_t (*start)(struct timeval *started); // init and start conversion
+        esp_err_t (*read)(struct sample *sample);
+} sensors[SENSOR_MAX] = {
+        [SENSOR_ADT7410] = {
+                "adt7410", ADT7410_I2C_ADDR_000, BIT(METRIC_TEMPERATURE),
+                // the rest of the conversion is polled for RDY
+                (ADT7410_MODE == ADT7410_1SPC ? 60 : 240) * 3 / 4,
+                start_adt7410, read_adt7410,
+        },
+        [SENSOR_MCP9808] = {
+                "mcp9808", MCP9808_I2C_ADDR_000, BIT(METRIC_TEMPERATURE),
+                MCP9808_CONVERSION_MSEC * 12 / 10, // +20% tolerance
+                start_mcp9808, read_mcp9808,
+        },
+        [SENSOR_BME280] = {
+                "bme280", BMP280_I2C_ADDRESS_1,
+                BIT(METRIC_TEMPERATURE) | BIT(METRIC_PRESSURE) | BIT(METRIC_HUMIDITY),
+                // x4 oversampling of all three, the rest is polled
+                26,
+                start_bme280, read_bme280,
+        },
+};
+
+static uint8_t sensors_detect()
 {
-        uint8_t addr_list[] = { BMP280_I2C_ADDRESS_1, MCP9808_I2C_ADDR_000, ADT7410_I2C_ADDR_000, 0x80 };
-
         i2c_config_t i2c = {
                 .mode = I2C_MODE_MASTER,
                 .sda_io_num = SDA_GPIO,
@@ -175,7 +329,7 @@ static uint8_t i2c_addr_detect()
         i2c.master.clk_speed = I2C_FREQ_HZ;
         ESP_ERROR_CHECK(i2c_param_config(I2C_PORT, &i2c));
         if ((res = i2c_driver_install(I2C_PORT, i2c.mode, 0, 0, 0)) != ESP_OK)
-            return 0x80;
+            return 0;
 #endif
 #if HELPER_TARGET_IS_ESP8266
 #if HELPER_TARGET_VERSION > HELPER_TARGET_VERSION_ESP8266_V3_2
@@ -183,40 +337,43 @@ static uint8_t i2c_addr_detect()
         i2c.clk_stretch_tick = I2CDEV_MAX_STRETCH_TIME;
 #endif
         if ((res = i2c_driver_install(I2C_PORT, i2c.mode)) != ESP_OK)
-            return 0x80;
+            return 0;
         ESP_ERROR_CHECK(i2c_param_config(I2C_PORT, &i2c));
 #endif
-        int result = 0x80; // return 0x80 in case of errror, no valid i2c addr can have highest bit set
-        for (uint8_t *addr = addr_list; *addr != 0x80; addr++) {
+        uint8_t detected = 0;
+        for (int i = 0; i < SENSOR_MAX; i++) {
                 i2c_cmd_handle_t cmd = i2c_cmd_link_create();
                 ESP_ERROR_CHECK(i2c_master_start(cmd));
-                ESP_ERROR_CHECK(i2c_master_write_byte(cmd, *addr << 1, true));
+                ESP_ERROR_CHECK(i2c_master_write_byte(cmd, sensors[i].addr << 1, true));
                 ESP_ERROR_CHECK(i2c_master_stop(cmd));
                 esp_err_t check = i2c_master_cmd_begin(I2C_PORT, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
                 i2c_cmd_link_delete(cmd);
 
                 if (check == ESP_OK) {
-                        ESP_LOGI(TAG, "detected I2C sensor with 0x%02x addr", *addr);
-                        result = *addr;
-                        break;
+                        ESP_LOGI(TAG, "detected %s with 0x%02x addr", sensors[i].name, sensors[i].addr);
+                        detected |= BIT(i);
                 }
         }
 
         ESP_ERROR_CHECK(i2c_driver_delete(I2C_PORT));
-        return result;
+        return detected;
 }
 
-static esp_err_t i2c_addr_store(uint8_t addr)
+static esp_err_t sensors_store(uint8_t detected)
 {
         nvs_handle nvs;
         esp_err_t err;
         if ((err = nvs_open(TAG, NVS_READWRITE, &nvs)) != ESP_OK)
                 goto out;
-        if (addr == 0x80)
-                err = nvs_erase_key(nvs, "i2c_addr");
+        if (detected == 0)
+                err = nvs_erase_key(nvs, "sensors");
         else
-                err = nvs_set_u8(nvs, "i2c_addr", addr);
-        if (err != ESP_OK)
+                err = nvs_set_u8(nvs, "sensors", detected);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+                goto out;
+        // single sensor address of older firmware
+        err = nvs_erase_key(nvs, "i2c_addr");
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
                 goto out;
         err = nvs_commit(nvs);
 out:
@@ -224,50 +381,235 @@ out:
         return err;
 }
 
-static esp_err_t i2c_addr_load(uint8_t *addr)
+static esp_err_t sensors_load(uint8_t *detected)
 {
         nvs_handle nvs;
         esp_err_t err;
         if ((err = nvs_open(TAG, NVS_READONLY, &nvs)) != ESP_OK)
                 return err;
-        err = nvs_get_u8(nvs, "i2c_addr", addr);
+        err = nvs_get_u8(nvs, "sensors", detected);
         nvs_close(nvs);
         return err;
 }
 
-static uint8_t i2c_addr()
+// bit per sensors[] entry
+static uint8_t sensors_present()
 {
-        uint8_t addr;
+        uint8_t detected;
         esp_err_t err;
 
-        err = i2c_addr_load(&addr);
+        err = sensors_load(&detected);
         if (err == ESP_OK) {
-                ESP_LOGD(TAG, "I2C sensor addr 0x%02x loaded from NVS", addr);
-                return addr;
+                ESP_LOGD(TAG, "sensors 0x%02x loaded from NVS", detected);
+                return detected;
         }
 
-        addr = i2c_addr_detect();
-        if (addr == 0x80) {
-                ESP_LOGI(TAG, "detect I2C sensor");
-                return addr;
+        detected = sensors_detect();
+        if (detected == 0) {
+                ESP_LOGI(TAG, "no I2C sensor detected");
+                return detected;
         }
 
         if (err == ESP_ERR_NVS_NOT_FOUND) {
-                err = i2c_addr_store(addr);
+                err = sensors_store(detected);
                 if (err != ESP_OK)
-                        ESP_LOGE(TAG, "store i2c_addr to NVS: %s", esp_err_to_name(err));
+                        ESP_LOGE(TAG, "store sensors to NVS: %s", esp_err_to_name(err));
         } else {
-                ESP_LOGE(TAG, "load i2c_addr from NVS: %s", esp_err_to_name(err));
+                ESP_LOGE(TAG, "load sensors from NVS: %s", esp_err_to_name(err));
+        }
+
+        return detected;
+}
+
+// start all sensors, then read each one when its conversion is done
+static void sensors_read(uint8_t present, const struct timeval *poweron, struct sample *sample)
+{
+        struct timeval started[SENSOR_MAX];
+        uint8_t pending = 0;
+
+        shadow_load();
+        for (int i = 0; i < SENSOR_MAX; i++) {
+                if (!(present & BIT(i)))
+                        continue;
+                started[i] = *poweron;
+                esp_err_t res = sensors[i].start(&started[i]);
+                if (res == ESP_OK) {
+                        pending |= BIT(i);
+                } else {
+                        ESP_LOGE(TAG, "%s start: %d (%s)", sensors[i].name, res, esp_err_to_name(res));
+                        shadow.known &= ~BIT(i); // identify again next time
+                }
         }
 
-        return addr;
+        while (pending) {
+                // the one to complete first
+                int next = -1, left = 0;
+                for (int i = 0; i < SENSOR_MAX; i++) {
+                        if (!(pending & BIT(i)))
+                                continue;
+                        int l = sensors[i].conversion_msec - msec_since(&started[i]);
+                        if (next < 0 || l < left) {
+                                next = i;
+                                left = l;
+                        }
+                }
+                if (left > 0)
+                        vTaskDelay(left / portTICK_PERIOD_MS);
+                pending &= ~BIT(next);
+
+                // a metric of a better sensor is not overwritten
+                struct sample s = { 0 };
+                esp_err_t res = sensors[next].read(&s);
+                if (res != ESP_OK) {
+                        ESP_LOGE(TAG, "Could not get %s measurments: %d (%s)", sensors[next].name,
+                                 res, esp_err_to_name(res));
+                        shadow.known &= ~BIT(next);
+                        continue;
+                }
+                shadow.known |= BIT(next);
+                for (int m = 0; m < METRIC_MAX; m++)
+                        if ((s.mask & sensors[next].metrics & BIT(m)) && !(sample->mask & BIT(m)))
+                                sample_set(sample, m, s.value[m]);
+        }
+        shadow_store();
 }
 
 volatile int RTC_DATA_ATTR ota_disabled;
 volatile char RTC_DATA_ATTR last_err[64];
 
+#define EPOCH_2020 1577836800
+
+static void clock_sync_start()
+{
+        sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_setservername(0, CONFIG_SENSOR_SNTP_SERVER);
+        sntp_init();
+}
+
+static void clock_sync_finish()
+{
+        // wait for SNTP reply only if there is no other way to know the time,
+        // otherwise time of the previous sync plus uptime is good enough
+        for (int i = batch_epoch() ? 0 : 20; i > 0 && !sntp_getreachability(0); i--)
+                vTaskDelay(50 / portTICK_PERIOD_MS);
+
+        time_t now = time(NULL);
+        if (sntp_getreachability(0) && now >= EPOCH_2020)
+                batch_clock_set(now);
+        else if (batch_epoch() == 0)
+                ESP_LOGE(TAG, "SNTP sync failed, samples are sent without timestamps");
+        sntp_stop();
+}
+
+// wakes follow temperature: see interval.h
+static RTC_DATA_ATTR struct interval interval;
+static const struct interval_config interval_config = {
+        .min = CONFIG_SENSOR_INTERVAL_MIN,
+        .max = CONFIG_SENSOR_INTERVAL_MAX,
+        .delta = CONFIG_SENSOR_INTERVAL_DELTA,
+        .vdd_full = CONFIG_SENSOR_VDD_FULL,
+        .vdd_cutoff = CONFIG_SENSOR_VDD_CUTOFF,
+};
+
+static void deep_sleep(unsigned duration)
+{
+        batch_sleep(duration / 1000000);
+        wake_done();
+        esp_deep_sleep(duration);
+}
+
+// Sensor is read while WiFi associates. OTA and metrics wait for it, so
+// that the module is powered off before the radio transmits in earnest.
+static struct timeval poweron;
+
+static struct sample measured;
+
+static esp_err_t job_sensor()
+{
+        struct sample sample = { .ts = batch_uptime() };
+        sensors_read(sensors_present(), &poweron, &sample);
+
+        gpio_set_level(PWR_GPIO, 0); // power-off sensor module
+
+        if (vdd > 500)
+                sample_set(&sample, METRIC_VOLTAGE, vdd);
+        if (sample.mask != 0)
+                sample_log(&sample);
+        measured = sample;
+        batch_deadband(&sample);
+        if (sample.mask != 0)
+                batch_add(&sample);
+        // samples already in the batch are worth sending anyway
+        return ESP_OK;
+}
+
+static esp_err_t job_wifi()
+{
+        esp_err_t err = wifi_connect();
+        if (err == ESP_OK)
+                clock_sync_start();
+        return err;
+}
+
+// OTA source is checked only once after boot to save power.
+// If you want to force OTA: do a power cycle (reset is not enough).
+static esp_err_t job_ota()
+{
+        if (ota_disabled == 0x13131313)
+                return ESP_OK;
+
+        char updated = 0;
+        esp_err_t err = ota(&updated);
+        if (err == ESP_OK || err == ESP_ERR_NOT_FOUND)
+                ota_disabled = 0x13131313;
+        if (updated) {
+                // force I2C redetection on OTA
+                uint8_t detected = sensors_detect();
+                if (detected != 0)
+                        sensors_store(detected);
+
+                vTaskDelay(100 / portTICK_PERIOD_MS);
+                esp_restart();
+        }
+        return ESP_OK;
+}
+
+static esp_err_t job_send()
+{
+        // over ESP-NOW WiFi is connected only for OTA
+        if (wifi_connected())
+                clock_sync_finish();
+
+        const char *prefix = macstr("yaws.sensor_", "");
+        esp_err_t err = wake_publish(prefix);
+        if (err == ESP_OK)
+                err = graphite_tx_publish(prefix);
+        if (err == ESP_OK)
+                err = batch_flush(prefix);
+        return err;
+}
+
+enum { JOB_SENSOR, JOB_WIFI, JOB_OTA, JOB_SEND };
+
+static struct wake_job jobs[] = {
+        [JOB_SENSOR] = { "sensor", WAKE_SENSOR, job_sensor, 0, 2048 },
+        [JOB_WIFI] = { "wifi", WAKE_WIFI, job_wifi, 0, 3072 },
+        [JOB_OTA] = { "ota", WAKE_OTA, job_ota, BIT(JOB_WIFI) | BIT(JOB_SENSOR), 6144 },
+        [JOB_SEND] = { "send", WAKE_SEND, job_send, BIT(JOB_WIFI) | BIT(JOB_SENSOR) | BIT(JOB_OTA), 3072 },
+};
+
+#ifdef CONFIG_GRAPHITE_ESPNOW
+// ESP-NOW needs no association, samples go out as soon as they are read.
+// The clock is set by SNTP on the first wake, when OTA is checked.
+static struct wake_job jobs_espnow[] = {
+        { "sensor", WAKE_SENSOR, job_sensor, 0, 2048 },
+        { "send", WAKE_SEND, job_send, BIT(0), 3072 },
+};
+#endif
+
 void app_main()
 {
+        wake_phase(WAKE_INIT);
         const esp_app_desc_t *app_desc = esp_ota_get_app_description();
         TAG = app_desc->project_name;
         syslog_early_init();
@@ -277,6 +619,8 @@ void app_main()
         esp_log_level_set(TAG, ESP_LOG_INFO);
         esp_log_level_set("yaws-wifi", ESP_LOG_INFO);
         esp_log_level_set("yaws-syslog", ESP_LOG_INFO);
+        esp_log_level_set("yaws-wake", ESP_LOG_INFO);
+        esp_log_level_set("yaws-batch", ESP_LOG_INFO);
 
         ESP_ERROR_CHECK(nvs_flash_init());
         ESP_ERROR_CHECK(esp_netif_init());
@@ -304,60 +648,49 @@ void app_main()
                 last_err[0] = 0;
         }
 
+        batch_init();
+        // system clock doesn't survive deep sleep, restore it from the
+        // estimate so that time() users (e.g. DHCP lease cache) see it
+        if (batch_epoch() != 0)
+                settimeofday(&(struct timeval){ .tv_sec = batch_epoch() + batch_uptime() }, NULL);
+        batch_store_open();
+        // OTA check is also due on the first wake after power-on
+        bool flush = ota_disabled != 0x13131313 || batch_flush_due();
+
         gpio_config_t cfg = {
                 .pin_bit_mask = BIT(PWR_GPIO),
                 .mode = GPIO_MODE_OUTPUT,
         };
         ESP_ERROR_CHECK(gpio_config(&cfg));
         ESP_ERROR_CHECK(gpio_set_level(PWR_GPIO, 1)); // power-on sensor module
-        struct timeval poweron;
         gettimeofday(&poweron, NULL);
 
-        // connect to WiFi before anything else. OTA must run _before_ any potentially buggy code
-        if (wifi_connect() != ESP_OK)
-                esp_deep_sleep(10 * 1000000);
-
-        // OTA source is checked only once after boot to save power.
-        // If you want to force OTA: do a power cycle (reset is not enough).
-        if (ota_disabled != 0x13131313) {
-                char updated = 0;
-                esp_err_t err = ota(&updated);
-                if (err == ESP_OK || err == ESP_ERR_NOT_FOUND)
-                        ota_disabled = 0x13131313;
-                if (updated) {
-                        // force I2C redetection on OTA
-                        uint8_t addr = i2c_addr_detect();
-                        if (addr != 0x80)
-                                i2c_addr_store(addr);
-
-                        vTaskDelay(100 / portTICK_PERIOD_MS);
-                        esp_restart();
-                }
-        }
+        // WiFi is needed only when samples are flushed, the sensor job is
+        // first in the table so that it may run alone
+#ifdef CONFIG_GRAPHITE_ESPNOW
+        if (ota_disabled == 0x13131313)
+                wake_run(jobs_espnow, flush ? 2 : 1);
+        else
+#endif
+        wake_run(jobs, flush ? 4 : 1);
+        graphite_close();
 
-        esp_err_t res = ESP_OK;
-        uint8_t addr = i2c_addr();
-        switch (addr) {
-        case BMP280_I2C_ADDRESS_1: res = read_bme280(&poweron); break;
-        case MCP9808_I2C_ADDR_000: res = read_mcp9808(&poweron); break;
-        case ADT7410_I2C_ADDR_000: res = read_adt7410(&poweron); break;
-        case 0x80:
-                break;
-        default:
-                ESP_LOGE(TAG, "unknown sensor addr 0x%02x", addr);
-        }
-        if (res != ESP_OK)
-                ESP_LOGE(TAG, "Could not get sensor measurments: %d (%s)", res, esp_err_to_name(res));
+        if (flush)
+                batch_flush_done();
 
-        gpio_set_level(PWR_GPIO, 0); // power-off sensor module
+        // OTA must run _before_ any potentially buggy code, retry soon
+        if (flush && jobs[JOB_WIFI].err != ESP_OK && ota_disabled != 0x13131313)
+                deep_sleep(10 * 1000000);
 
         if (syslog_last_err[0])
                 memcpy((char *)last_err, syslog_last_err, sizeof(last_err));
 
+        wake_phase(WAKE_DISCONNECT);
         wifi_disconnect();
 
-        unsigned sleep_duration = 2 * 60 * 1000000;
-        if (vdd < 1)
-                sleep_duration /= 3;
-        esp_deep_sleep(sleep_duration);
+        uint32_t seconds = interval_next(&interval, &interval_config,
+                                         measured.mask & BIT(METRIC_TEMPERATURE),
+                                         measured.value[METRIC_TEMPERATURE], measured.ts, vdd);
+        ESP_LOGI(TAG, "sleep for %u s", seconds);
+        deep_sleep(seconds * 1000000);
 }
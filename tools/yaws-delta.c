@@ -0,0 +1,341 @@
+/*
+  Build and apply delta OTA patches (see components/wifi/delta.h).
+
+  cc -O2 -I components/wifi -o yaws-delta tools/yaws-delta.c components/wifi/delta.c
+
+  yaws-delta diff OLD.bin NEW.bin PATCH     build patch
+  yaws-delta apply OLD.bin PATCH NEW.bin    reconstruct new image
+  yaws-delta check OLD.bin NEW.bin          build patch, apply it and compare
+
+  The device looks for the patch next to the full image, named after the
+  version it runs:
+
+     sensor-mcp9808.bin  ->  sensor-mcp9808.<running version>.delta
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "delta.h"
+
+struct buf {
+        uint8_t *data;
+        size_t len, cap;
+};
+
+static void die(const char *msg, const char *arg)
+{
+        fprintf(stderr, "yaws-delta: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+        exit(1);
+}
+
+static void put(struct buf *b, const void *data, size_t len)
+{
+        if (b->len + len > b->cap) {
+                b->cap = (b->len + len) * 2;
+                b->data = realloc(b->data, b->cap);
+                if (b->data == NULL)
+                        die("out of memory", NULL);
+        }
+        memcpy(b->data + b->len, data, len);
+        b->len += len;
+}
+
+static void put_varint(struct buf *b, uint32_t v)
+{
+        do {
+                uint8_t c = v & 0x7f;
+                v >>= 7;
+                if (v)
+                        c |= 0x80;
+                put(b, &c, 1);
+        } while (v);
+}
+
+static struct buf load(const char *path)
+{
+        struct buf b = {0};
+        uint8_t chunk[4096];
+        size_t n;
+        FILE *f = fopen(path, "rb");
+        if (f == NULL)
+                die("can't open", path);
+        while ((n = fread(chunk, 1, sizeof chunk, f)) > 0)
+                put(&b, chunk, n);
+        fclose(f);
+        return b;
+}
+
+static void save(const char *path, const struct buf *b)
+{
+        FILE *f = fopen(path, "wb");
+        if (f == NULL || fwrite(b->data, 1, b->len, f) != b->len || fclose(f) != 0)
+                die("can't write", path);
+}
+
+/* SHA-256, FIPS 180-4 */
+static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+static void sha256_block(uint32_t h[8], const uint8_t *p)
+{
+        uint32_t w[64], s[8];
+        for (int i = 0; i < 16; i++)
+                w[i] = (uint32_t)p[4 * i] << 24 | p[4 * i + 1] << 16 | p[4 * i + 2] << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; i++) {
+                uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ w[i - 15] >> 3;
+                uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ w[i - 2] >> 10;
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        memcpy(s, h, sizeof s);
+        for (int i = 0; i < 64; i++) {
+                uint32_t t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) +
+                        ((s[4] & s[5]) ^ (~s[4] & s[6])) + K[i] + w[i];
+                uint32_t t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) +
+                        ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+                memmove(s + 1, s, 7 * sizeof *s);
+                s[4] += t1;
+                s[0] = t1 + t2;
+        }
+        for (int i = 0; i < 8; i++)
+                h[i] += s[i];
+}
+
+static void sha256(const uint8_t *data, size_t len, uint8_t out[32])
+{
+        uint32_t h[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+        uint8_t tail[128] = {0};
+        size_t full = len & ~(size_t)63, rest = len - full;
+        uint64_t bits = (uint64_t)len * 8;
+
+        for (size_t i = 0; i < full; i += 64)
+                sha256_block(h, data + i);
+        memcpy(tail, data + full, rest);
+        tail[rest] = 0x80;
+        size_t tail_len = rest < 56 ? 64 : 128;
+        for (int i = 0; i < 8; i++)
+                tail[tail_len - 1 - i] = bits >> (8 * i);
+        for (size_t i = 0; i < tail_len; i += 64)
+                sha256_block(h, tail + i);
+        for (int i = 0; i < 8; i++)
+                for (int j = 0; j < 4; j++)
+                        out[4 * i + j] = h[i] >> (24 - 8 * j);
+}
+
+/*
+  Greedy matcher: at each position of the new image take the longest of
+  a match in the old image (hash chains over 4 byte prefixes) and a match
+  in the last DELTA_WINDOW bytes of the new image. Firmware images mostly
+  differ by shifted addresses, so old matches are usually found at a small
+  offset from the end of the previous one; that position is tried first.
+ */
+#define HASH_BITS 16
+#define CHAIN 32
+#define MIN_OLD 8
+#define MIN_NEW 6
+
+static uint32_t hash4(const uint8_t *p)
+{
+        uint32_t v = (uint32_t)p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+struct index {
+        int32_t head[1 << HASH_BITS];
+        int32_t *prev;
+};
+
+static void index_init(struct index *x, size_t len)
+{
+        memset(x->head, 0xff, sizeof x->head);
+        x->prev = malloc((len + 1) * sizeof *x->prev);
+        if (x->prev == NULL)
+                die("out of memory", NULL);
+}
+
+static void index_add(struct index *x, const uint8_t *data, size_t pos)
+{
+        uint32_t h = hash4(data + pos);
+        x->prev[pos] = x->head[h];
+        x->head[h] = pos;
+}
+
+static size_t match(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len)
+{
+        size_t n = 0, max = a_len < b_len ? a_len : b_len;
+        while (n < max && a[n] == b[n])
+                n++;
+        return n;
+}
+
+static void flush_literal(struct buf *patch, const uint8_t *data, size_t len)
+{
+        if (len == 0)
+                return;
+        uint8_t op = DELTA_OP_LITERAL;
+        put(patch, &op, 1);
+        put_varint(patch, len);
+        put(patch, data, len);
+}
+
+static struct buf diff(const struct buf *old, const struct buf *new)
+{
+        struct buf patch = {0};
+        struct index xo, xn;
+        size_t pos = 0, literal = 0, old_pos = 0;
+        uint8_t header[DELTA_HEADER_SIZE];
+
+        memcpy(header, DELTA_MAGIC, 4);
+        for (int i = 0; i < 4; i++)
+                header[4 + i] = new->len >> (8 * i);
+        sha256(new->data, new->len, header + 8);
+        put(&patch, header, sizeof header);
+
+        index_init(&xo, old->len);
+        index_init(&xn, new->len);
+        for (size_t i = 0; i + 4 <= old->len; i++)
+                index_add(&xo, old->data, i);
+
+        while (pos < new->len) {
+                const uint8_t *p = new->data + pos;
+                size_t rest = new->len - pos;
+                size_t best_old = 0, best_old_len = 0, best_dist = 0, best_new_len = 0;
+
+                if (old_pos < old->len)
+                        best_old_len = match(old->data + old_pos, old->len - old_pos, p, rest);
+                best_old = old_pos;
+                if (rest >= 4) {
+                        int32_t c = xo.head[hash4(p)];
+                        for (int i = 0; i < CHAIN && c >= 0; i++, c = xo.prev[c]) {
+                                size_t n = match(old->data + c, old->len - c, p, rest);
+                                if (n > best_old_len) {
+                                        best_old_len = n;
+                                        best_old = c;
+                                }
+                        }
+                        c = xn.head[hash4(p)];
+                        for (int i = 0; i < CHAIN && c >= 0 && pos - c <= DELTA_WINDOW; i++, c = xn.prev[c]) {
+                                size_t n = match(new->data + c, new->len - c, p, rest);
+                                if (n > best_new_len) {
+                                        best_new_len = n;
+                                        best_dist = pos - c;
+                                }
+                        }
+                }
+
+                size_t n = 0;
+                if (best_old_len >= MIN_OLD && best_old_len >= best_new_len) {
+                        flush_literal(&patch, p - literal, literal);
+                        literal = 0;
+                        int32_t off = (int32_t)(best_old - old_pos);
+                        uint8_t op = DELTA_OP_COPY_OLD;
+                        put(&patch, &op, 1);
+                        put_varint(&patch, (uint32_t)off << 1 ^ (uint32_t)(off >> 31));
+                        put_varint(&patch, best_old_len);
+                        old_pos = best_old + best_old_len;
+                        n = best_old_len;
+                } else if (best_new_len >= MIN_NEW) {
+                        flush_literal(&patch, p - literal, literal);
+                        literal = 0;
+                        uint8_t op = DELTA_OP_COPY_NEW;
+                        put(&patch, &op, 1);
+                        put_varint(&patch, best_dist);
+                        put_varint(&patch, best_new_len);
+                        n = best_new_len;
+                } else {
+                        literal++;
+                        n = 1;
+                }
+
+                for (size_t i = 0; i < n; i++, pos++)
+                        if (pos + 4 <= new->len)
+                                index_add(&xn, new->data, pos);
+        }
+        flush_literal(&patch, new->data + pos - literal, literal);
+
+        free(xo.prev);
+        free(xn.prev);
+        return patch;
+}
+
+static const struct buf *apply_old;
+
+static int read_old(void *ctx, uint32_t offset, void *buf, uint32_t len)
+{
+        (void)ctx;
+        if (offset > apply_old->len || len > apply_old->len - offset)
+                return -1;
+        memcpy(buf, apply_old->data + offset, len);
+        return 0;
+}
+
+static int write_new(void *ctx, const void *buf, uint32_t len)
+{
+        put(ctx, buf, len);
+        return 0;
+}
+
+static struct buf apply(const struct buf *old, const struct buf *patch)
+{
+        static struct delta d;
+        struct buf out = {0};
+        struct delta_io io = {.read_old = read_old, .write = write_new, .ctx = &out};
+        uint8_t digest[32];
+        int err = DELTA_OK;
+
+        apply_old = old;
+        delta_init(&d, &io);
+        // feed in small uneven chunks, like HTTP reads on the device
+        for (size_t i = 0; i < patch->len && err == DELTA_OK; i += 1000) {
+                size_t n = patch->len - i < 1000 ? patch->len - i : 1000;
+                err = delta_feed(&d, patch->data + i, n);
+        }
+        if (err == DELTA_OK)
+                err = delta_finish(&d);
+        if (err != DELTA_OK) {
+                fprintf(stderr, "yaws-delta: patch failed with %d at %u\n", err, d.out);
+                exit(1);
+        }
+        sha256(out.data, out.len, digest);
+        if (memcmp(digest, delta_sha256(&d), sizeof digest) != 0)
+                die("SHA-256 mismatch", NULL);
+        return out;
+}
+
+int main(int argc, char **argv)
+{
+        if (argc == 5 && strcmp(argv[1], "diff") == 0) {
+                struct buf old = load(argv[2]), new = load(argv[3]);
+                struct buf patch = diff(&old, &new);
+                save(argv[4], &patch);
+                printf("%zu -> %zu bytes\n", new.len, patch.len);
+        } else if (argc == 5 && strcmp(argv[1], "apply") == 0) {
+                struct buf old = load(argv[2]), patch = load(argv[3]);
+                struct buf new = apply(&old, &patch);
+                save(argv[4], &new);
+        } else if (argc == 4 && strcmp(argv[1], "check") == 0) {
+                struct buf old = load(argv[2]), new = load(argv[3]);
+                struct buf patch = diff(&old, &new);
+                struct buf out = apply(&old, &patch);
+                if (out.len != new.len || memcmp(out.data, new.data, new.len) != 0)
+                        die("reconstructed image differs", NULL);
+                printf("ok: %zu -> %zu bytes\n", new.len, patch.len);
+        } else {
+                fprintf(stderr, "usage: %s diff OLD NEW PATCH | apply OLD PATCH NEW | check OLD NEW\n", argv[0]);
+                return 2;
+        }
+        return 0;
+}
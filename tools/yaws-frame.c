@@ -0,0 +1,172 @@
+/*
+  Compress 1-bpp display bitmaps (see display/main/frame.h).
+
+  cc -O2 -I display/main -o yaws-frame tools/yaws-frame.c display/main/frame.c
+
+  yaws-frame encode WIDTH HEIGHT IN.raw OUT     compress raw bitmap
+  yaws-frame decode WIDTH HEIGHT IN OUT.raw     decompress, checking CRC
+  yaws-frame check WIDTH HEIGHT IN.raw          compress, decompress and compare
+
+  The display accepts both formats at the same URL, so the server may
+  serve either.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+struct buf {
+        uint8_t *data;
+        size_t len, cap;
+};
+
+static void die(const char *msg, const char *arg)
+{
+        fprintf(stderr, "yaws-frame: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+        exit(1);
+}
+
+static void put(struct buf *b, const void *data, size_t len)
+{
+        if (b->len + len > b->cap) {
+                b->cap = (b->len + len) * 2;
+                b->data = realloc(b->data, b->cap);
+                if (b->data == NULL)
+                        die("out of memory", NULL);
+        }
+        memcpy(b->data + b->len, data, len);
+        b->len += len;
+}
+
+static struct buf load(const char *path)
+{
+        struct buf b = {0};
+        uint8_t chunk[4096];
+        size_t n;
+        FILE *f = fopen(path, "rb");
+        if (f == NULL)
+                die("can't open", path);
+        while ((n = fread(chunk, 1, sizeof chunk, f)) > 0)
+                put(&b, chunk, n);
+        fclose(f);
+        return b;
+}
+
+static void save(const char *path, const struct buf *b)
+{
+        FILE *f = fopen(path, "wb");
+        if (f == NULL || fwrite(b->data, 1, b->len, f) != b->len || fclose(f) != 0)
+                die("can't write", path);
+}
+
+static struct buf encode(int width, int height, const struct buf *raw)
+{
+        struct buf out = {0};
+        uint8_t header[FRAME_HEADER_SIZE] = {0};
+        uint32_t crc = frame_crc32(0, raw->data, raw->len);
+
+        if (raw->len != (size_t)width * height / 8)
+                die("bitmap size does not match width and height", NULL);
+
+        memcpy(header, FRAME_MAGIC, 4);
+        header[4] = width & 0xff;
+        header[5] = width >> 8;
+        header[6] = height & 0xff;
+        header[7] = height >> 8;
+        header[8] = FRAME_PACKBITS;
+        for (int i = 0; i < 4; i++)
+                header[12 + i] = crc >> (8 * i);
+        put(&out, header, sizeof header);
+
+        size_t i = 0, literal = 0;
+        while (i < raw->len) {
+                size_t run = 1;
+                while (i + run < raw->len && run < 128 && raw->data[i + run] == raw->data[i])
+                        run++;
+                // a run of two in the middle of a literal is cheaper kept literal
+                if (run >= 3 || (run == 2 && literal == 0)) {
+                        if (literal) {
+                                uint8_t c = literal - 1;
+                                put(&out, &c, 1);
+                                put(&out, raw->data + i - literal, literal);
+                                literal = 0;
+                        }
+                        uint8_t c[2] = {257 - run, raw->data[i]};
+                        put(&out, c, 2);
+                        i += run;
+                        continue;
+                }
+                literal++;
+                i++;
+                if (literal == 128) {
+                        uint8_t c = literal - 1;
+                        put(&out, &c, 1);
+                        put(&out, raw->data + i - literal, literal);
+                        literal = 0;
+                }
+        }
+        if (literal) {
+                uint8_t c = literal - 1;
+                put(&out, &c, 1);
+                put(&out, raw->data + i - literal, literal);
+        }
+        return out;
+}
+
+static void write_raw(void *ctx, const uint8_t *data, int len)
+{
+        put(ctx, data, len);
+}
+
+static struct buf decode(int width, int height, const struct buf *in)
+{
+        static struct frame_decoder d;
+        struct buf out = {0};
+        int err = FRAME_OK;
+
+        frame_init(&d, width, height, write_raw, &out);
+        // feed in small uneven chunks, like HTTP reads on the device
+        for (size_t i = 0; i < in->len && err == FRAME_OK; i += 1000) {
+                size_t n = in->len - i < 1000 ? in->len - i : 1000;
+                err = frame_feed(&d, in->data + i, n);
+        }
+        if (err == FRAME_OK)
+                err = frame_finish(&d);
+        if (err != FRAME_OK) {
+                fprintf(stderr, "yaws-frame: decoding failed with %d\n", err);
+                exit(1);
+        }
+        return out;
+}
+
+int main(int argc, char **argv)
+{
+        if (argc < 5) {
+usage:
+                fprintf(stderr, "usage: %s encode|decode WIDTH HEIGHT IN OUT | check WIDTH HEIGHT IN\n", argv[0]);
+                return 2;
+        }
+
+        int width = atoi(argv[2]), height = atoi(argv[3]);
+        struct buf in = load(argv[4]);
+
+        if (argc == 6 && strcmp(argv[1], "encode") == 0) {
+                struct buf out = encode(width, height, &in);
+                save(argv[5], &out);
+                printf("%zu -> %zu bytes\n", in.len, out.len);
+        } else if (argc == 6 && strcmp(argv[1], "decode") == 0) {
+                struct buf out = decode(width, height, &in);
+                save(argv[5], &out);
+        } else if (argc == 5 && strcmp(argv[1], "check") == 0) {
+                struct buf enc = encode(width, height, &in);
+                struct buf dec = decode(width, height, &enc);
+                if (dec.len != in.len || memcmp(dec.data, in.data, in.len) != 0)
+                        die("decoded bitmap differs", NULL);
+                printf("ok: %zu -> %zu bytes\n", in.len, enc.len);
+        } else {
+                goto usage;
+        }
+        return 0;
+}
@@ -0,0 +1,491 @@
+/*
+  Relay between yaws nodes and carbon.
+
+  cc -O2 -I host/include -I components/graphite -o yaws-relay tools/yaws-relay.c \
+     components/graphite/espnow_frame.c components/graphite/espnow_gateway.c components/graphite/ftoa.c
+
+  yaws-relay [-l PORT] [-c HOST:PORT] [-n NODES] [-b BYTES] [-d LOSS]
+
+  Nodes send UDP datagrams to PORT (2003) in any of:
+
+    binary frames   CONFIG_GRAPHITE_BINARY, see espnow_frame.h; frames
+                    retransmitted by a node are dropped by (MAC, sequence
+                    number), NODES (65536) nodes are remembered; each
+                    frame, retransmitted or not, is acknowledged once
+                    all of its lines are queued (CONFIG_GRAPHITE_ACK);
+                    a frame that doesn't fit is neither queued nor
+                    remembered, so that the node sends it again
+    compact lines   CONFIG_GRAPHITE_COMPACT, see graphite.h
+    plaintext       Graphite plaintext protocol
+
+  and carbon gets plaintext over one TCP connection to HOST:PORT
+  (127.0.0.1:2003). Unknown timestamps are replaced with the time of
+  arrival. All datagrams waiting in the socket are expanded before the
+  next write, so lines go to carbon in batches as large as the load.
+  While carbon is unreachable the relay reconnects with backoff and keeps
+  up to BYTES (16 MiB) of lines, newer lines are dropped after that.
+
+  SIGUSR1 logs counters, SIGINT and SIGTERM flush pending lines and exit.
+
+  For testing nodes against a lossy link, -d drops LOSS percent of
+  datagrams on arrival and as many of the acknowledgements.
+ */
+#define _GNU_SOURCE // recvmmsg()
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "espnow_frame.h"
+#include "espnow_gateway.h"
+#include "ftoa.h"
+
+#define DATAGRAM_MAX 1472       // MTU_PAYLOAD of graphite.c
+#define PREFIX_MAX 128          // of compact lines, with the terminating zero
+#define BATCH 64                // datagrams per recvmmsg()
+#define ROUNDS 16               // recvmmsg() calls before carbon gets a turn
+#define BACKOFF_MAX 30
+
+static struct {
+        unsigned long long datagrams, frames, duplicates, malformed, lines, dropped, written, connects;
+        unsigned long long acks, lost;
+} stats;
+
+static struct espnow_gateway gateway;
+static uint32_t arrival;        // unix time of the datagrams being expanded
+
+static char *out;
+static size_t out_len, out_off; // out[out_off, out_len) is not written yet
+static size_t out_max = 16 << 20;
+
+static int ep, udp, carbon = -1, timer;
+static bool connected;
+static int backoff = 1;
+static const char *carbon_host = "127.0.0.1", *carbon_port = "2003";
+static int loss;                // percent of datagrams dropped, -d
+
+static void say(const char *fmt, ...)
+{
+        va_list va;
+        va_start(va, fmt);
+        fprintf(stderr, "yaws-relay: ");
+        vfprintf(stderr, fmt, va);
+        fprintf(stderr, "\n");
+        va_end(va);
+}
+
+static void die(const char *msg)
+{
+        say("%s: %s", msg, strerror(errno));
+        exit(1);
+}
+
+static void report(void)
+{
+        say("datagrams %llu, frames %llu, duplicates %llu, malformed %llu, lines %llu, dropped %llu, "
+            "written %llu bytes, connects %llu, pending %zu bytes, acks %llu, lost %llu",
+            stats.datagrams, stats.frames, stats.duplicates, stats.malformed, stats.lines,
+            stats.dropped, stats.written, stats.connects, out_len - out_off, stats.acks, stats.lost);
+}
+
+// false if the line is dropped
+static bool emit(const char *prefix, const char *metric, const char *value, uint32_t ts)
+{
+        // a line as long as a datagram, its prefix and a timestamp
+        char line[PREFIX_MAX + DATAGRAM_MAX + 16];
+        int n;
+
+        if (ts == 0)
+                ts = arrival;
+        if (prefix != NULL)
+                n = snprintf(line, sizeof line, "%s.%s %s %u\n", prefix, metric, value, ts);
+        else
+                n = snprintf(line, sizeof line, "%s %s %u\n", metric, value, ts);
+        if (n >= sizeof line) {
+                stats.malformed++;
+                return false;
+        }
+        if (out_len + n > out_max && out_off != 0) {
+                memmove(out, out + out_off, out_len - out_off);
+                out_len -= out_off;
+                out_off = 0;
+        }
+        if (out_len + n > out_max) {
+                stats.dropped++;
+                return false;
+        }
+        memcpy(out + out_len, line, n);
+        out_len += n;
+        stats.lines++;
+        return true;
+}
+
+static esp_err_t emit_record(void *ctx, const char *prefix, const struct espnow_record *r)
+{
+        char v[24];
+        if (r == NULL)
+                return ESP_OK; // lines are written out as carbon takes them
+        fixtoa(v, sizeof v, r->value, r->precision);
+        return emit(prefix, r->metric, v, r->ts) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// plaintext and compact lines, see graphite.h
+static void text(char *buf, int len)
+{
+        char prefix[PREFIX_MAX];
+        bool compact = false;
+        uint32_t ts = 0;
+
+        if (len == 0 || buf[len - 1] != '\n') {
+                stats.malformed++; // cut, lines are never split between datagrams
+                return;
+        }
+        buf[len - 1] = 0;
+        for (char *next, *line = buf; line != NULL; line = next) {
+                next = strchr(line, '\n');
+                if (next != NULL)
+                        *next++ = 0;
+                if (line == buf && line[0] == '@') {
+                        if (strlen(line + 1) >= sizeof prefix || line[1] == 0) {
+                                stats.malformed++;
+                                return;
+                        }
+                        strcpy(prefix, line + 1);
+                        compact = true;
+                        continue;
+                }
+
+                char *save, *metric = strtok_r(line, " ", &save);
+                char *value = strtok_r(NULL, " ", &save);
+                char *stamp = strtok_r(NULL, " ", &save), *end;
+                if (metric == NULL)
+                        continue;
+                if (value == NULL || strtok_r(NULL, " ", &save) != NULL || (stamp == NULL && !compact)) {
+                        stats.malformed++;
+                        continue;
+                }
+                strtod(value, &end);
+                if (*end != 0) {
+                        stats.malformed++;
+                        continue;
+                }
+                // the timestamp of a compact line is that of the previous one if omitted
+                if (stamp != NULL && strcmp(stamp, "-1") == 0) {
+                        ts = 0;
+                } else if (stamp != NULL) {
+                        ts = strtoul(stamp, &end, 10);
+                        if (*end != 0) {
+                                stats.malformed++;
+                                continue;
+                        }
+                }
+                emit(compact ? prefix : NULL, metric, value, ts);
+        }
+}
+
+static bool lost(void)
+{
+        if (loss == 0 || rand() % 100 >= loss)
+                return false;
+        stats.lost++;
+        return true;
+}
+
+// true if the datagram is a frame to acknowledge
+static bool datagram(uint8_t *buf, int len, uint32_t now)
+{
+        stats.datagrams++;
+        // text never starts with a control character
+        if (len > 0 && buf[0] == ESPNOW_FRAME_VERSION) {
+                uint32_t frames = gateway.frames, duplicates = gateway.duplicates;
+                size_t pending = out_len - out_off;
+                unsigned long long lines = stats.lines;
+                esp_err_t err = espnow_gateway_receive(&gateway, buf, len, now, emit_record, NULL);
+                if (err == ESP_ERR_NO_MEM) {
+                        // lines of the frame are taken back: the node keeps its
+                        // records and sends them again
+                        out_len = out_off + pending;
+                        stats.dropped += stats.lines - lines;
+                        stats.lines = lines;
+                } else if (err != ESP_OK) {
+                        stats.malformed++;
+                }
+                stats.frames += gateway.frames - frames;
+                stats.duplicates += gateway.duplicates - duplicates;
+                return err == ESP_OK;
+        }
+        text((char *)buf, len);
+        return false;
+}
+
+static void watch(int fd, uint32_t events, int op)
+{
+        struct epoll_event ev = { .events = events, .data.fd = fd };
+        if (epoll_ctl(ep, op, fd, &ev) != 0)
+                die("epoll_ctl");
+}
+
+static void carbon_retry(void)
+{
+        struct itimerspec t = { .it_value.tv_sec = backoff };
+        timerfd_settime(timer, 0, &t, NULL);
+        backoff = backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX : backoff * 2;
+}
+
+static void carbon_close(const char *why, int err)
+{
+        say("carbon %s:%s: %s%s%s", carbon_host, carbon_port, why, err ? ": " : "", err ? strerror(err) : "");
+        if (carbon >= 0)
+                close(carbon);
+        carbon = -1;
+        connected = false;
+        carbon_retry();
+}
+
+static void carbon_connect(void)
+{
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *ai;
+        int err = getaddrinfo(carbon_host, carbon_port, &hints, &ai);
+        if (err != 0) {
+                say("carbon %s:%s: %s", carbon_host, carbon_port, gai_strerror(err));
+                carbon_retry();
+                return;
+        }
+        carbon = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (carbon < 0)
+                die("socket");
+        if (connect(carbon, ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS) {
+                freeaddrinfo(ai);
+                carbon_close("connect", errno);
+                return;
+        }
+        freeaddrinfo(ai);
+        // writable once connected
+        watch(carbon, EPOLLOUT | EPOLLRDHUP, EPOLL_CTL_ADD);
+}
+
+static void carbon_write(void)
+{
+        while (connected && out_off < out_len) {
+                ssize_t n = send(carbon, out + out_off, out_len - out_off, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0 && errno == EAGAIN)
+                        break;
+                if (n < 0) {
+                        carbon_close("send", errno);
+                        return;
+                }
+                out_off += n;
+                stats.written += n;
+        }
+        if (out_off == out_len)
+                out_off = out_len = 0;
+        if (connected)
+                watch(carbon, EPOLLRDHUP | (out_off < out_len ? EPOLLOUT : 0), EPOLL_CTL_MOD);
+}
+
+static void carbon_event(uint32_t events)
+{
+        if (!connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int err = 0;
+                socklen_t len = sizeof err;
+                getsockopt(carbon, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                        carbon_close("connect", err);
+                        return;
+                }
+                connected = true;
+                backoff = 1;
+                stats.connects++;
+                say("carbon %s:%s: connected", carbon_host, carbon_port);
+        } else if (events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+                carbon_close("connection closed", 0);
+                return;
+        }
+        carbon_write();
+}
+
+static void udp_event(void)
+{
+        static uint8_t buf[BATCH][DATAGRAM_MAX + 1], ack[BATCH][ESPNOW_FRAME_ACK_LEN];
+        static struct sockaddr_in6 from[BATCH];
+        static struct iovec iov[BATCH], ack_iov[BATCH];
+        static struct mmsghdr msg[BATCH], ack_msg[BATCH];
+
+        for (int round = 0; round < ROUNDS; round++) {
+                for (int i = 0; i < BATCH; i++) {
+                        iov[i] = (struct iovec) { buf[i], sizeof buf[i] };
+                        msg[i] = (struct mmsghdr) { .msg_hdr = {
+                                .msg_name = &from[i], .msg_namelen = sizeof from[i],
+                                .msg_iov = &iov[i], .msg_iovlen = 1,
+                        } };
+                }
+                int n = recvmmsg(udp, msg, BATCH, MSG_DONTWAIT, NULL);
+                if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                        break;
+                if (n < 0)
+                        die("recvmmsg");
+
+                struct timespec mono;
+                clock_gettime(CLOCK_MONOTONIC, &mono);
+                arrival = time(NULL);
+                int acks = 0;
+                for (int i = 0; i < n; i++) {
+                        if (msg[i].msg_len > DATAGRAM_MAX) {
+                                stats.datagrams++;
+                                stats.malformed++;
+                                continue;
+                        }
+                        if (lost() || !datagram(buf[i], msg[i].msg_len, mono.tv_sec) || lost())
+                                continue;
+                        espnow_frame_ack(ack[acks], buf[i]);
+                        ack_iov[acks] = (struct iovec) { ack[acks], ESPNOW_FRAME_ACK_LEN };
+                        ack_msg[acks] = (struct mmsghdr) { .msg_hdr = {
+                                .msg_name = &from[i], .msg_namelen = msg[i].msg_hdr.msg_namelen,
+                                .msg_iov = &ack_iov[acks], .msg_iovlen = 1,
+                        } };
+                        acks++;
+                }
+                // best effort: a node that misses it sends the frame again
+                if (acks > 0 && (acks = sendmmsg(udp, ack_msg, acks, MSG_DONTWAIT)) > 0)
+                        stats.acks += acks;
+                if (n < BATCH)
+                        break;
+        }
+        carbon_write();
+}
+
+static void finish(void)
+{
+        // give carbon a moment to take what is pending
+        for (int i = 0; i < 20 && connected && out_off < out_len; i++) {
+                struct epoll_event ev;
+                carbon_write();
+                epoll_wait(ep, &ev, 1, 100);
+        }
+        report();
+        exit(0);
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr, "usage: %s [-l PORT] [-c HOST:PORT] [-n NODES] [-b BYTES] [-d LOSS]\n", argv0);
+        exit(2);
+}
+
+int main(int argc, char **argv)
+{
+        int port = 2003, opt;
+        uint32_t nodes = 65536;
+
+        while ((opt = getopt(argc, argv, "l:c:n:b:d:")) != -1) {
+                switch (opt) {
+                case 'l':
+                        port = atoi(optarg);
+                        break;
+                case 'c': {
+                        char *colon = strrchr(optarg, ':');
+                        if (colon == NULL)
+                                usage(argv[0]);
+                        *colon = 0;
+                        carbon_host = optarg;
+                        carbon_port = colon + 1;
+                        break;
+                }
+                case 'n':
+                        nodes = strtoul(optarg, NULL, 0);
+                        break;
+                case 'b':
+                        out_max = strtoul(optarg, NULL, 0);
+                        break;
+                case 'd':
+                        loss = atoi(optarg);
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (optind != argc || nodes == 0 || out_max == 0 || loss < 0 || loss > 100)
+                usage(argv[0]);
+        srand(getpid());
+        while (nodes & (nodes - 1))
+                nodes += nodes & -nodes; // round up to a power of two
+
+        struct espnow_gateway_node *node = malloc(nodes * sizeof *node);
+        out = malloc(out_max);
+        if (node == NULL || out == NULL)
+                die("malloc");
+        espnow_gateway_init(&gateway, node, nodes);
+
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGUSR1);
+        sigprocmask(SIG_BLOCK, &signals, NULL);
+        int sig = signalfd(-1, &signals, SFD_CLOEXEC);
+
+        udp = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (udp < 0)
+                die("socket");
+        int zero = 0, rcvbuf = 4 << 20;
+        setsockopt(udp, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof zero);
+        // bursts of nodes waking up together
+        setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+        struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = in6addr_any };
+        if (bind(udp, (struct sockaddr *)&addr, sizeof addr) != 0)
+                die("bind");
+
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        ep = epoll_create1(EPOLL_CLOEXEC);
+        if (sig < 0 || timer < 0 || ep < 0)
+                die("epoll");
+        watch(udp, EPOLLIN, EPOLL_CTL_ADD);
+        watch(sig, EPOLLIN, EPOLL_CTL_ADD);
+        watch(timer, EPOLLIN, EPOLL_CTL_ADD);
+
+        say("listening on udp port %d, carbon %s:%s", port, carbon_host, carbon_port);
+        carbon_connect();
+
+        for (;;) {
+                struct epoll_event ev[8];
+                int n = epoll_wait(ep, ev, 8, -1);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        die("epoll_wait");
+                for (int i = 0; i < n; i++) {
+                        int fd = ev[i].data.fd;
+                        if (fd == udp) {
+                                udp_event();
+                        } else if (fd == carbon && carbon >= 0) {
+                                carbon_event(ev[i].events);
+                        } else if (fd == timer) {
+                                uint64_t expired;
+                                read(timer, &expired, sizeof expired);
+                                if (carbon < 0)
+                                        carbon_connect();
+                        } else if (fd == sig) {
+                                struct signalfd_siginfo si;
+                                if (read(sig, &si, sizeof si) != sizeof si)
+                                        continue;
+                                if (si.ssi_signo == SIGUSR1)
+                                        report();
+                                else
+                                        finish();
+                        }
+                }
+        }
+}